@@ -0,0 +1,138 @@
+#ifndef ISBI_CONNECTED_COMPONENTS_HXX
+#define ISBI_CONNECTED_COMPONENTS_HXX
+
+// stl
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+// vigra
+#include <vigra/multi_array.hxx> /* for MultiArrayView */
+#include <vigra/tinyvector.hxx> /* for TinyVector */
+
+// own
+#include "common.h"
+
+namespace isbi_pipeline {
+
+// Count, intensity mean and variance, center and bounding box of a region
+// as vigra::acc calculates them (Count, Mean, Variance, RegionCenter,
+// Coord<Minimum> and Coord<Maximum>), accumulated while labeling. Two
+// statistics are merged with the pairwise formula of Chan et al.
+template<int N>
+struct RegionStatistics {
+  typedef vigra::TinyVector<double, N> CoordinateType;
+  RegionStatistics();
+  void add(const CoordinateType& coordinate, const double value);
+  void merge(const RegionStatistics<N>& other);
+  // move the coordinates by offset
+  void shift(const CoordinateType& offset);
+  double get_variance() const;
+  CoordinateType get_center() const;
+
+  double count_;
+  double mean_;
+  // sum of the squared deviations from the mean
+  double squared_deviations_;
+  CoordinateType coordinate_sum_;
+  CoordinateType coordinate_min_;
+  CoordinateType coordinate_max_;
+};
+
+// Label the connected components (indirect neighborhood) of the pixels
+// whose value is above the threshold, the background gets label 0. The
+// labels are the same as those of vigra::labelMultiArrayWithBackground on
+// the thresholded image: the components are numbered in the scan order of
+// their first pixel. The threshold is applied to one row at a time while
+// labeling, no binary image is stored. Returns the number of components.
+//
+// With several OpenMP threads the image is cut into slabs along the
+// outermost axis which are labeled in parallel, the components touching
+// across slab borders are merged with a lock free union find. The
+// numbering does not depend on the number of threads.
+template<int N>
+size_t label_above_threshold(
+  const vigra::MultiArrayView<N, DataType>& values,
+  const DataType threshold,
+  vigra::MultiArrayView<N, LabelType> labels);
+
+// same as above, also fills the statistics of the pixels of image within
+// each component (index 0 is the background and stays empty)
+template<int N>
+size_t label_above_threshold(
+  const vigra::MultiArrayView<N, DataType>& values,
+  const DataType threshold,
+  vigra::MultiArrayView<N, LabelType> labels,
+  const vigra::MultiArrayView<N, DataType>& image,
+  std::vector<RegionStatistics<N> >& statistics);
+
+/*=============================================================================
+  Implementation
+=============================================================================*/
+
+template<int N>
+RegionStatistics<N>::RegionStatistics() :
+  count_(0.0),
+  mean_(0.0),
+  squared_deviations_(0.0),
+  coordinate_sum_(0.0),
+  coordinate_min_(std::numeric_limits<double>::max()),
+  coordinate_max_(std::numeric_limits<double>::lowest())
+{
+}
+
+template<int N>
+void RegionStatistics<N>::add(
+  const CoordinateType& coordinate,
+  const double value)
+{
+  count_ += 1.0;
+  const double delta = value - mean_;
+  mean_ += delta / count_;
+  squared_deviations_ += delta * (value - mean_);
+  coordinate_sum_ += coordinate;
+  for (size_t n = 0; n < N; n++) {
+    coordinate_min_[n] = std::min(coordinate_min_[n], coordinate[n]);
+    coordinate_max_[n] = std::max(coordinate_max_[n], coordinate[n]);
+  }
+}
+
+template<int N>
+void RegionStatistics<N>::merge(const RegionStatistics<N>& other) {
+  if (other.count_ == 0.0) {
+    return;
+  }
+  const double count = count_ + other.count_;
+  const double delta = other.mean_ - mean_;
+  mean_ += delta * other.count_ / count;
+  squared_deviations_ += other.squared_deviations_
+    + delta * delta * count_ * other.count_ / count;
+  count_ = count;
+  coordinate_sum_ += other.coordinate_sum_;
+  for (size_t n = 0; n < N; n++) {
+    coordinate_min_[n] = std::min(coordinate_min_[n], other.coordinate_min_[n]);
+    coordinate_max_[n] = std::max(coordinate_max_[n], other.coordinate_max_[n]);
+  }
+}
+
+template<int N>
+void RegionStatistics<N>::shift(const CoordinateType& offset) {
+  coordinate_sum_ += count_ * offset;
+  coordinate_min_ += offset;
+  coordinate_max_ += offset;
+}
+
+template<int N>
+double RegionStatistics<N>::get_variance() const {
+  return squared_deviations_ / count_;
+}
+
+template<int N>
+typename RegionStatistics<N>::CoordinateType
+RegionStatistics<N>::get_center() const {
+  return coordinate_sum_ / count_;
+}
+
+} // end of namespace isbi_pipeline
+
+#endif // ISBI_CONNECTED_COMPONENTS_HXX
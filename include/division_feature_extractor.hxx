@@ -5,6 +5,7 @@
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <limits>
 
 // pgmlink
 #include <pgmlink/feature.h>
@@ -18,6 +19,11 @@
 
 // own
 #include "common.h"
+#include "flat_forest.hxx"
+#include "object_classification.hxx"
+#include "object_feature_table.hxx"
+#include "object_index.hxx"
+#include "pipeline_helpers.hxx" /* for TrackingOptions */
 
 namespace isbi_pipeline
 {
@@ -27,6 +33,34 @@ void copy_vector(
 	const std::vector<T>& vector,
 	vigra::MultiArrayView<N, T>& multi_array_view);
 
+// Parents ruled out by the cascade get divProb 0 without evaluating the
+// division forests on their features. The bounds also skip the division
+// features of such parents.
+enum DivisionCascadeMode
+{
+	NoDivisionCascade,
+	// exact: the forests are evaluated once for all parents without
+	// candidate children that have the same features
+	ExactDivisionCascade,
+	// additionally parents with fewer than min_candidate_count candidate
+	// children or a ParentChildrenRatio_Count outside [min_ratio_count,
+	// max_ratio_count], decided right after the search for the children
+	BoundsDivisionCascade
+};
+
+struct DivisionCascade
+{
+	DivisionCascade();
+	DivisionCascadeMode mode;
+	size_t min_candidate_count;
+	float min_ratio_count;
+	float max_ratio_count;
+};
+
+// the cascade of the options DivisionCascade, DivisionCandidateCountMin,
+// DivisionRatioCountMin and DivisionRatioCountMax
+DivisionCascade get_division_cascade(const TrackingOptions& options);
+
 template<int N, class LabelType>
 class DivisionFeatureExtractor
 {
@@ -36,44 +70,105 @@ public:
 public:
 	DivisionFeatureExtractor(size_t template_size = 50);
 
+	// find the candidate children with a grid over their bounding boxes
+	// (default) or by scanning the template in the label image
+	void set_use_grid(bool use_grid);
+
+	// applies to the next extract and compute_div_prob on its objects
+	void set_cascade(const DivisionCascade& cascade);
+
+	// parents the last compute_div_prob did not evaluate the forests for
+	size_t get_skipped_count() const;
+
 	void extract(std::vector<pgmlink::Traxel>& traxels_current_frame,
 				 std::vector<pgmlink::Traxel>& traxels_next_frame,
 				 vigra::MultiArrayView<N, LabelType> label_image_next_frame);
 
+	// the same on the object tables of both frames, adds the division
+	// feature columns to the current frame
+	void extract(ObjectFeatureTable& objects_current_frame,
+				 const ObjectFeatureTable& objects_next_frame,
+				 vigra::MultiArrayView<N, LabelType> label_image_next_frame);
+
+	// classifies all traxels of the frame at once, uses the flat forests if given
 	void compute_div_prob(std::vector<pgmlink::Traxel>& traxels_current_frame,
 						const std::vector<std::string>& feature_selection,
-						const RandomForestVectorType& random_forests);
+						const RandomForestVectorType& random_forests,
+						const FlatForestVectorType& flat_forests = FlatForestVectorType());
+
+	// the same for all objects of the frame, adds the column "divProb"
+	void compute_div_prob(ObjectFeatureTable& objects_current_frame,
+						const std::vector<std::string>& feature_selection,
+						const RandomForestVectorType& random_forests,
+						const FlatForestVectorType& flat_forests = FlatForestVectorType());
 
   static std::set<LabelType> find_unique_labels_in_roi(vigra::MultiArrayView<N, LabelType> roi,
                          bool ignore_label_zero = true);
 
 private:
-	pgmlink::feature_array parent_children_ratio_operation(const pgmlink::feature_array& a,
-														   const pgmlink::feature_array& b,
-														   const pgmlink::feature_array& c);
-
-	pgmlink::feature_array parent_children_angle_operation(const pgmlink::feature_array& a,
-														   const pgmlink::feature_array& b,
-														   const pgmlink::feature_array& c);
-
-	void compute_traxel_division_features(pgmlink::Traxel& t,
-											std::vector<TraxelWithDistance>& nearest_neighbors,
-											std::vector<pgmlink::Traxel>& traxels_next_frame);
-
-	std::vector< TraxelWithDistance > find_nearest_neighbors(const pgmlink::feature_array& traxel_position,
-															 std::vector<pgmlink::Traxel>& traxels_next_frame,
-															 vigra::MultiArrayView<N, LabelType> label_image_next_frame);
-
-	void get_division_probability(const std::vector<std::string>& feature_selection,
-								const RandomForestVectorType& random_forests,
-								pgmlink::Traxel& traxel);
+	// the columns of the features used and calculated in extract
+	struct DivisionColumns
+	{
+		ObjectFeatureTable::FeatureId center, count, mean;
+		ObjectFeatureTable::FeatureId next_center, next_count, next_mean;
+		ObjectFeatureTable::FeatureId squared_distances[3];
+		ObjectFeatureTable::FeatureId children_ratio_count, children_ratio_mean;
+		ObjectFeatureTable::FeatureId parent_children_ratio_count, parent_children_ratio_mean;
+		ObjectFeatureTable::FeatureId parent_children_angle;
+	};
+
+	// the ratio of the smaller to the larger value, as the RatioCalculator
+	// of pgmlink
+	static float children_ratio(float a, float b);
+	static float parent_children_ratio(float a, float b, float c);
+
+	// false if the bounds of the cascade rule out the parent in row
+	bool is_plausible_parent(const ObjectFeatureTable& objects_current_frame,
+							 const size_t row,
+							 const std::vector<TraxelWithDistance>& nearest_neighbors,
+							 const ObjectFeatureTable& objects_next_frame,
+							 const DivisionColumns& columns) const;
+
+	// the rows of features to evaluate the forests on and for each object
+	// the index of the evaluated row its probability is taken from, -1 for
+	// divProb 0
+	void get_cascade_rows(const ObjectFeatureTable& objects_current_frame,
+						  const vigra::MultiArray<2, FeatureType>& features,
+						  std::vector<size_t>& evaluated_rows,
+						  std::vector<std::ptrdiff_t>& sources) const;
+
+	static float parent_children_angle(const FeatureType* a,
+									   const FeatureType* b,
+									   const FeatureType* c);
+
+	// implausible parents only get the squared distances, the other
+	// features are 0
+	void compute_division_features(ObjectFeatureTable& objects_current_frame,
+								   const size_t row,
+								   const std::vector<TraxelWithDistance>& nearest_neighbors,
+								   const ObjectFeatureTable& objects_next_frame,
+								   const DivisionColumns& columns,
+								   const bool is_plausible);
+
+	// rows of the objects in the next frame within the template around
+	// position, sorted by distance
+	void find_nearest_neighbors(const FeatureType* position,
+								const ObjectFeatureTable& objects_next_frame,
+								const DivisionColumns& columns,
+								const ObjectIndex<N>& object_index,
+								vigra::MultiArrayView<N, LabelType> label_image_next_frame,
+								std::vector<LabelType>& labels_in_roi,
+								std::vector<TraxelWithDistance>& nearest_neighbors);
 
 private:
 	size_t template_size_;
-	std::shared_ptr<pgmlink::feature_extraction::FeatureCalculator> squared_distance_calculator_;
-	std::shared_ptr<pgmlink::feature_extraction::FeatureCalculator> children_ratio_calculator_;
-	std::shared_ptr<pgmlink::feature_extraction::FeatureCalculator> parent_children_ratio_calculator_;
-	std::shared_ptr<pgmlink::feature_extraction::FeatureCalculator> parent_children_angle_calculator_;
+	bool use_grid_;
+	DivisionCascade cascade_;
+	// the number of candidate children per object of the last extract and
+	// whether the bounds of the cascade keep it (0 or 1)
+	std::vector<size_t> candidate_counts_;
+	std::vector<unsigned char> is_plausible_;
+	size_t skipped_count_;
 };
 
 std::ostream& operator<<(std::ostream& lhs, const pgmlink::feature_array& rhs);
@@ -97,35 +192,42 @@ void copy_vector(
 template<int N, class LabelType>
 DivisionFeatureExtractor<N, LabelType>::DivisionFeatureExtractor(size_t template_size):
 	template_size_(template_size),
-	squared_distance_calculator_(new pgmlink::feature_extraction::SquareRootSquaredDifferenceCalculator()),
-	children_ratio_calculator_(new pgmlink::feature_extraction::RatioCalculator())
+	use_grid_(true),
+	skipped_count_(0)
 {
-	parent_children_ratio_calculator_ = std::shared_ptr<pgmlink::feature_extraction::FeatureCalculator>(new pgmlink::feature_extraction::TripletOperationCalculator(
-		std::bind(&DivisionFeatureExtractor<N, LabelType>::parent_children_ratio_operation,
-				  this,
-				  std::placeholders::_1,
-				  std::placeholders::_2,
-				  std::placeholders::_3),
-		"ParentChildrenRatio"));
-	parent_children_angle_calculator_ = std::shared_ptr<pgmlink::feature_extraction::FeatureCalculator>(new pgmlink::feature_extraction::TripletOperationCalculator(
-		std::bind(&DivisionFeatureExtractor<N, LabelType>::parent_children_angle_operation,
-				  this,
-				  std::placeholders::_1,
-				  std::placeholders::_2,
-				  std::placeholders::_3),
-		"ParentChildrenAngle"));
 }
 
 
 // ---------------------------------------------------------------------------------------------------------------
 template<int N, class LabelType>
-pgmlink::feature_array DivisionFeatureExtractor<N, LabelType>::parent_children_angle_operation(const pgmlink::feature_array& a,
-							const pgmlink::feature_array& b,
-							const pgmlink::feature_array& c)
+void DivisionFeatureExtractor<N, LabelType>::set_use_grid(bool use_grid)
 {
-	assert(a.size() == b.size() && a.size() == c.size() && a.size() >= N);
-	pgmlink::feature_array ret(1, 0.);
+	use_grid_ = use_grid;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------------
+template<int N, class LabelType>
+void DivisionFeatureExtractor<N, LabelType>::set_cascade(const DivisionCascade& cascade)
+{
+	cascade_ = cascade;
+}
 
+
+// ---------------------------------------------------------------------------------------------------------------
+template<int N, class LabelType>
+size_t DivisionFeatureExtractor<N, LabelType>::get_skipped_count() const
+{
+	return skipped_count_;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------------
+template<int N, class LabelType>
+float DivisionFeatureExtractor<N, LabelType>::parent_children_angle(const FeatureType* a,
+							const FeatureType* b,
+							const FeatureType* c)
+{
 	vigra::TinyVector<float, N> v1, v2;
 	for(size_t i = 0; i < N; i++)
 	{
@@ -136,14 +238,12 @@ pgmlink::feature_array DivisionFeatureExtractor<N, LabelType>::parent_children_a
 	float length_product = sqrt(vigra::squaredNorm(v1) * vigra::squaredNorm(v2));
 	if(length_product == 0)
 	{
-		ret[0] = 0;
+		return 0;
 	}
 	else
 	{
-		ret[0] = acos(vigra::dot(v1, v2) / length_product) * 180.0 / M_PI;
+		return acos(vigra::dot(v1, v2) / length_product) * 180.0 / M_PI;
 	}
-
-	return std::move(ret);
 }
 
 
@@ -172,231 +272,382 @@ void DivisionFeatureExtractor<N, LabelType>::extract(std::vector<pgmlink::Traxel
 										 std::vector<pgmlink::Traxel>& traxels_next_frame,
 										 vigra::MultiArrayView<N, LabelType> label_image_next_frame)
 {
+	ObjectFeatureTable objects_current_frame, objects_next_frame;
+	objects_current_frame.add_traxels(traxels_current_frame);
+	objects_next_frame.add_traxels(traxels_next_frame);
+	extract(objects_current_frame, objects_next_frame, label_image_next_frame);
+	objects_current_frame.fill_feature_maps(traxels_current_frame);
+}
 
-	//for(pgmlink::Traxel& t : traxels_current_frame)
-	#pragma omp parallel for
-	for(size_t i = 0; i < traxels_current_frame.size(); i++)
-	{
-		pgmlink::Traxel& t = traxels_current_frame[i];
-		// std::cout << "Investigating " << t << " at com " << t.features["RegionCenter"] << std::endl;
-		std::vector<TraxelWithDistance> nearest_neighbors = find_nearest_neighbors(t.features["RegionCenter"],
-																				   traxels_next_frame,
-																				   label_image_next_frame);
-
-		// std::cout << "Distances after sorting:" << std::endl;
-		// for(TraxelWithDistance& twd : nearest_neighbors)
-		// {
-		// 	std::cout << "\t" << traxels_next_frame[twd.first] << " at distance " << twd.second << std::endl;
-		// }
-
-		compute_traxel_division_features(t, nearest_neighbors, traxels_next_frame);
 
+// ---------------------------------------------------------------------------------------------------------------
+template<int N, class LabelType>
+void DivisionFeatureExtractor<N, LabelType>::extract(ObjectFeatureTable& objects_current_frame,
+										 const ObjectFeatureTable& objects_next_frame,
+										 vigra::MultiArrayView<N, LabelType> label_image_next_frame)
+{
+	// look up the columns once per frame
+	DivisionColumns columns;
+	columns.center = objects_current_frame.get_feature_id("RegionCenter");
+	columns.count = objects_current_frame.get_feature_id("Count");
+	columns.mean = objects_current_frame.get_feature_id("Mean");
+	if(objects_next_frame.get_row_count() > 0)
+	{
+		columns.next_center = objects_next_frame.get_feature_id("RegionCenter");
+		columns.next_count = objects_next_frame.get_feature_id("Count");
+		columns.next_mean = objects_next_frame.get_feature_id("Mean");
+	}
+	columns.squared_distances[0] = objects_current_frame.add_feature("SquaredDistances_0", 1);
+	columns.squared_distances[1] = objects_current_frame.add_feature("SquaredDistances_1", 1);
+	columns.squared_distances[2] = objects_current_frame.add_feature("SquaredDistances_2", 1);
+	columns.children_ratio_count = objects_current_frame.add_feature("ChildrenRatio_Count", 1);
+	columns.children_ratio_mean = objects_current_frame.add_feature("ChildrenRatio_Mean", 1);
+	columns.parent_children_ratio_mean = objects_current_frame.add_feature("ParentChildrenRatio_Mean", 1);
+	columns.parent_children_ratio_count = objects_current_frame.add_feature("ParentChildrenRatio_Count", 1);
+	columns.parent_children_angle = objects_current_frame.add_feature("ParentChildrenAngle_RegionCenter", 1);
+
+	// the first row of each label in the next frame and a grid over their
+	// bounding boxes, a template overlaps at most two cells per axis
+	ObjectIndex<N> object_index(objects_next_frame);
+	if(use_grid_)
+		object_index.build_grid(label_image_next_frame.shape(), template_size_);
+	candidate_counts_.assign(objects_current_frame.get_row_count(), 0);
+	is_plausible_.assign(objects_current_frame.get_row_count(), 1);
+
+	#pragma omp parallel
+	{
+		std::vector<LabelType> labels_in_roi;
+		std::vector<TraxelWithDistance> nearest_neighbors;
+		// the number of candidates differs between the objects
+		#pragma omp for schedule(dynamic)
+		for(size_t row = 0; row < objects_current_frame.get_row_count(); row++)
+		{
+			find_nearest_neighbors(objects_current_frame.get(columns.center, row),
+								   objects_next_frame,
+								   columns,
+								   object_index,
+								   label_image_next_frame,
+								   labels_in_roi,
+								   nearest_neighbors);
+			candidate_counts_[row] = nearest_neighbors.size();
+			is_plausible_[row] = is_plausible_parent(objects_current_frame,
+													 row,
+													 nearest_neighbors,
+													 objects_next_frame,
+													 columns);
+			compute_division_features(objects_current_frame,
+									  row,
+									  nearest_neighbors,
+									  objects_next_frame,
+									  columns,
+									  is_plausible_[row]);
+		}
 	}
 }
 
 
 // ---------------------------------------------------------------------------------------------------------------
 template<int N, class LabelType>
-std::vector< typename DivisionFeatureExtractor<N, LabelType>::TraxelWithDistance >
-DivisionFeatureExtractor<N, LabelType>::find_nearest_neighbors(
-	const pgmlink::feature_array& traxel_position,
-	std::vector<pgmlink::Traxel>& traxels_next_frame,
-	vigra::MultiArrayView<N, LabelType> label_image_next_frame)
+void DivisionFeatureExtractor<N, LabelType>::find_nearest_neighbors(
+	const FeatureType* position,
+	const ObjectFeatureTable& objects_next_frame,
+	const DivisionColumns& columns,
+	const ObjectIndex<N>& object_index,
+	vigra::MultiArrayView<N, LabelType> label_image_next_frame,
+	std::vector<LabelType>& labels_in_roi,
+	std::vector<TraxelWithDistance>& nearest_neighbors)
 {
 	// get ROI from next frame
-	vigra::TinyVector<size_t, N> start, stop;
+	typename ObjectIndex<N>::ShapeType start, stop;
 
 	for(int i = 0; i < N; i++)
 	{
-		start[i] = std::max(0, int(traxel_position[i] - template_size_ / 2));
-		stop[i]  = std::min(int(label_image_next_frame.shape(i)), int(traxel_position[i] + template_size_ / 2));
+		start[i] = std::max(0, int(position[i] - template_size_ / 2));
+		stop[i]  = std::min(int(label_image_next_frame.shape(i)), int(position[i] + template_size_ / 2));
 	}
 
-	vigra::MultiArrayView<N, LabelType> roi = label_image_next_frame.subarray(start, stop);
+	// find all labels in this roi, in ascending order
+	object_index.find_labels_in_box(start, stop, label_image_next_frame, labels_in_roi);
 
-	// find all labels in this roi, and order them according to their distances
-	std::set<LabelType> labels_in_roi = find_unique_labels_in_roi(roi);
-	std::vector< TraxelWithDistance > nearest_neighbors;
-
-	// compute distance for each of those
+	// compute distance for each of those with an object
+	nearest_neighbors.clear();
 	for(LabelType label : labels_in_roi)
 	{
-		// find traxel with this label
-		for(size_t trax_idx = 0; trax_idx < traxels_next_frame.size(); trax_idx++)
+		size_t row;
+		if(!object_index.find_row(label, row))
+			continue;
+		const FeatureType* center = objects_next_frame.get(columns.next_center, row);
+		float distance = 0;
+		for(size_t i = 0; i < N; i++)
 		{
-			pgmlink::Traxel& tr = traxels_next_frame[trax_idx];
-			if(tr.Id == label)
-			{
-				// compute distance
-				pgmlink::feature_array distance = squared_distance_calculator_->calculate(traxel_position, tr.features["RegionCenter"]);
-				// std::cout << "\tFound " << tr << " at distance " << distance[0] << std::endl;
-				nearest_neighbors.push_back(std::make_pair(trax_idx, distance[0]));
-				break;
-			}
+			float difference = position[i] - center[i];
+			distance += difference * difference;
 		}
+		nearest_neighbors.push_back(std::make_pair(row, sqrt(distance)));
 	}
 
 	// sort neighbors according to distance
 	auto compareDistances = [](const TraxelWithDistance& a, const TraxelWithDistance& b){ return a.second < b.second; };
 	std::sort(nearest_neighbors.begin(), nearest_neighbors.end(), compareDistances);
+}
 
-	return std::move(nearest_neighbors);
+
+// ---------------------------------------------------------------------------------------------------------------
+template<int N, class LabelType>
+float DivisionFeatureExtractor<N, LabelType>::children_ratio(float a, float b)
+{
+	if(a == b)
+		return 1.0;
+	else if(a < b)
+		return a / b;
+	else
+		return b / a;
 }
 
 
 // ---------------------------------------------------------------------------------------------------------------
 template<int N, class LabelType>
-pgmlink::feature_array DivisionFeatureExtractor<N, LabelType>::parent_children_ratio_operation(const pgmlink::feature_array& a,
-							const pgmlink::feature_array& b,
-							const pgmlink::feature_array& c)
+float DivisionFeatureExtractor<N, LabelType>::parent_children_ratio(float a, float b, float c)
 {
-	assert(a.size() == b.size() && a.size() == c.size());
-	pgmlink::feature_array ret(a.size(), 0.);
-	for(size_t i = 0; i < a.size(); i++)
+	float ret = b + c;
+	if(ret < 0.000001)
+		ret = 9999.0;
+	else
+		ret = a / ret;
+	return ret;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------------
+template<int N, class LabelType>
+bool DivisionFeatureExtractor<N, LabelType>::is_plausible_parent(const ObjectFeatureTable& objects_current_frame,
+	const size_t row,
+	const std::vector<TraxelWithDistance>& nearest_neighbors,
+	const ObjectFeatureTable& objects_next_frame,
+	const DivisionColumns& columns) const
+{
+	if(cascade_.mode != BoundsDivisionCascade)
+		return true;
+	if(nearest_neighbors.size() < cascade_.min_candidate_count)
+		return false;
+	// ParentChildrenRatio_Count, 0 without two children
+	float ratio = 0.0f;
+	if(nearest_neighbors.size() > 1)
 	{
-		ret[i] = b[i] + c[i];
-		if(ret[i] < 0.000001)
-			ret[i] = 9999.0;
-		else
-			ret[i] = a[i] / ret[i];
+		ratio = parent_children_ratio(
+			*objects_current_frame.get(columns.count, row),
+			*objects_next_frame.get(columns.next_count, nearest_neighbors[0].first),
+			*objects_next_frame.get(columns.next_count, nearest_neighbors[1].first));
 	}
-	return std::move(ret);
+	return ratio >= cascade_.min_ratio_count && ratio <= cascade_.max_ratio_count;
 }
 
 
 // ---------------------------------------------------------------------------------------------------------------
 template<int N, class LabelType>
-void DivisionFeatureExtractor<N, LabelType>::compute_traxel_division_features(pgmlink::Traxel& t,
-	std::vector<TraxelWithDistance>& nearest_neighbors,
-	std::vector<pgmlink::Traxel>& traxels_next_frame)
+void DivisionFeatureExtractor<N, LabelType>::compute_division_features(ObjectFeatureTable& objects_current_frame,
+	const size_t row,
+	const std::vector<TraxelWithDistance>& nearest_neighbors,
+	const ObjectFeatureTable& objects_next_frame,
+	const DivisionColumns& columns,
+	const bool is_plausible)
 {
-	// initialize squared distances in traxels
-	t.features["SquaredDistances_0"] = {9999.f};
-	t.features["SquaredDistances_1"] = {9999.f};
-	t.features["SquaredDistances_2"] = {9999.f};
-	// overwrite squared distances if available
-	for(size_t i = 0; i < nearest_neighbors.size(); i++)
+	ObjectFeatureTable& objects = objects_current_frame;
+	// initialize squared distances, overwrite them if available
+	for(size_t i = 0; i < 3; i++)
 	{
-		std::stringstream feat_name;
-		feat_name << "SquaredDistances_" << i;
-		t.features[feat_name.str()] = { nearest_neighbors[i].second };
+		*objects.get(columns.squared_distances[i], row) =
+			i < nearest_neighbors.size() ? nearest_neighbors[i].second : 9999.f;
 	}
 
-	if(nearest_neighbors.size() > 1)
+	if(is_plausible && nearest_neighbors.size() > 1)
 	{
+		const size_t child_0 = nearest_neighbors[0].first;
+		const size_t child_1 = nearest_neighbors[1].first;
 		// compute remaining features:
-		t.features["ChildrenRatio_Count"] = children_ratio_calculator_->calculate(
-														traxels_next_frame[nearest_neighbors[0].first].features["Count"],
-														traxels_next_frame[nearest_neighbors[1].first].features["Count"]);
-		t.features["ChildrenRatio_Mean"] = children_ratio_calculator_->calculate(
-														traxels_next_frame[nearest_neighbors[0].first].features["Mean"],
-														traxels_next_frame[nearest_neighbors[1].first].features["Mean"]);
-		// t.features["ChildrenRatio_SquaredDistances"] = children_ratio_calculator_->calculate(
-		// 												t.features["SquaredDistances_0"],
-		// 												t.features["SquaredDistances_1"]);
-		t.features["ParentChildrenRatio_Mean"] = parent_children_ratio_calculator_->calculate(
-														t.features["Mean"],
-														traxels_next_frame[nearest_neighbors[0].first].features["Mean"],
-														traxels_next_frame[nearest_neighbors[1].first].features["Mean"]);
-		t.features["ParentChildrenRatio_Count"] = parent_children_ratio_calculator_->calculate(
-														t.features["Count"],
-														traxels_next_frame[nearest_neighbors[0].first].features["Count"],
-														traxels_next_frame[nearest_neighbors[1].first].features["Count"]);
-		float angle = parent_children_angle_calculator_->calculate(
-														t.features["RegionCenter"],
-														traxels_next_frame[nearest_neighbors[0].first].features["RegionCenter"],
-														traxels_next_frame[nearest_neighbors[1].first].features["RegionCenter"])[0];
+		*objects.get(columns.children_ratio_count, row) = children_ratio(
+			*objects_next_frame.get(columns.next_count, child_0),
+			*objects_next_frame.get(columns.next_count, child_1));
+		*objects.get(columns.children_ratio_mean, row) = children_ratio(
+			*objects_next_frame.get(columns.next_mean, child_0),
+			*objects_next_frame.get(columns.next_mean, child_1));
+		*objects.get(columns.parent_children_ratio_mean, row) = parent_children_ratio(
+			*objects.get(columns.mean, row),
+			*objects_next_frame.get(columns.next_mean, child_0),
+			*objects_next_frame.get(columns.next_mean, child_1));
+		*objects.get(columns.parent_children_ratio_count, row) = parent_children_ratio(
+			*objects.get(columns.count, row),
+			*objects_next_frame.get(columns.next_count, child_0),
+			*objects_next_frame.get(columns.next_count, child_1));
+		const FeatureType* center = objects.get(columns.center, row);
+		float angle = parent_children_angle(
+			center,
+			objects_next_frame.get(columns.next_center, child_0),
+			objects_next_frame.get(columns.next_center, child_1));
 		if(nearest_neighbors.size() > 2)
 		{
-			angle = std::max(angle, parent_children_angle_calculator_->calculate(
-														t.features["RegionCenter"],
-														traxels_next_frame[nearest_neighbors[1].first].features["RegionCenter"],
-														traxels_next_frame[nearest_neighbors[2].first].features["RegionCenter"])[0]);
-			angle = std::max(angle, parent_children_angle_calculator_->calculate(
-														t.features["RegionCenter"],
-														traxels_next_frame[nearest_neighbors[0].first].features["RegionCenter"],
-														traxels_next_frame[nearest_neighbors[2].first].features["RegionCenter"])[0]);
+			const size_t child_2 = nearest_neighbors[2].first;
+			angle = std::max(angle, parent_children_angle(
+				center,
+				objects_next_frame.get(columns.next_center, child_1),
+				objects_next_frame.get(columns.next_center, child_2)));
+			angle = std::max(angle, parent_children_angle(
+				center,
+				objects_next_frame.get(columns.next_center, child_0),
+				objects_next_frame.get(columns.next_center, child_2)));
 		}
-		t.features["ParentChildrenAngle_RegionCenter"] = { angle };
+		*objects.get(columns.parent_children_angle, row) = angle;
 	}
 	else
 	{
-		t.features["ChildrenRatio_Count"] = {0.0f};
-		t.features["ChildrenRatio_Mean"] = {0.0f};
-		// t.features["ChildrenRatio_SquaredDistances"] = {0.0f};
-		t.features["ParentChildrenRatio_Mean"] = {0.0f};
-		t.features["ParentChildrenRatio_Count"] = {0.0f};
-		t.features["ParentChildrenAngle_RegionCenter"] = {0.0f};
+		*objects.get(columns.children_ratio_count, row) = 0.0f;
+		*objects.get(columns.children_ratio_mean, row) = 0.0f;
+		*objects.get(columns.parent_children_ratio_mean, row) = 0.0f;
+		*objects.get(columns.parent_children_ratio_count, row) = 0.0f;
+		*objects.get(columns.parent_children_angle, row) = 0.0f;
 	}
-
-	// std::cout << "\tChildrenRatio_Count" << t.features["ChildrenRatio_Count"] << std::endl;
-	// std::cout << "\tChildrenRatio_Mean" << t.features["ChildrenRatio_Mean"] << std::endl;
-	// // std::cout << "\tChildrenRatio_SquaredDistances" << t.features["ChildrenRatio_SquaredDistances"] << std::endl;
-	// std::cout << "\tParentChildrenRatio_Mean" << t.features["ParentChildrenRatio_Mean"] << std::endl;
-	// std::cout << "\tParentChildrenRatio_Count" << t.features["ParentChildrenRatio_Count"] << std::endl;
-	// std::cout << "\tParentChildrenAngle_RegionCenter" << t.features["ParentChildrenAngle_RegionCenter"] << std::endl;
 }
 
 template<int N, class LabelType>
 void DivisionFeatureExtractor<N, LabelType>::compute_div_prob(
 	std::vector<pgmlink::Traxel>& traxels_current_frame,
 	const std::vector<std::string>& feature_selection,
-	const RandomForestVectorType& random_forests)
+	const RandomForestVectorType& random_forests,
+	const FlatForestVectorType& flat_forests)
 {
-	for(pgmlink::Traxel& t : traxels_current_frame)
+	if (traxels_current_frame.empty()) {
+		return;
+	}
+	// one row of features per traxel
+	vigra::MultiArray<2, FeatureType> features;
+	get_feature_matrix(traxels_current_frame, feature_selection, features);
+
+	// evaluate the random forests, without any forest all get zero
+	vigra::MultiArray<2, FeatureType> probabilities(
+		vigra::Shape2(traxels_current_frame.size(), 2),
+		0.0);
+	if (!random_forests.empty()) {
+		predict_forest_probabilities(random_forests, flat_forests, features, probabilities);
+	}
+
+	// fill the features maps
+	#pragma omp parallel for
+	for(size_t row = 0; row < traxels_current_frame.size(); row++)
 	{
-		get_division_probability(feature_selection, random_forests, t);
+		pgmlink::Traxel& traxel = traxels_current_frame[row];
+		traxel.features["divProb"].clear();
+		traxel.features["divProb"].push_back(probabilities(row, 1));
 	}
 }
 
 template<int N, class LabelType>
-void DivisionFeatureExtractor<N, LabelType>::get_division_probability(
+void DivisionFeatureExtractor<N, LabelType>::compute_div_prob(
+	ObjectFeatureTable& objects_current_frame,
 	const std::vector<std::string>& feature_selection,
 	const RandomForestVectorType& random_forests,
-	pgmlink::Traxel& traxel)
+	const FlatForestVectorType& flat_forests)
 {
-	// get the size of the feature vector
-	size_t offset = 0;
-	for(size_t feature_idx = 0; feature_idx < feature_selection.size(); feature_idx++) {
-		const std::string& feature_name = feature_selection[feature_idx];
-		if (traxel.features.count(feature_name) == 0) {
-			throw std::runtime_error("Feature " + feature_name + " not found");
-		} else {
-			offset += traxel.features[feature_name].size();
-		}
+	const ObjectFeatureTable::FeatureId div_prob = objects_current_frame.add_feature("divProb", 1);
+	skipped_count_ = 0;
+	if (objects_current_frame.get_row_count() == 0) {
+		return;
 	}
-
-	size_t feature_size = offset;
-	
-	// get all features into one multi array
-	vigra::MultiArray<2, FeatureType> features(vigra::Shape2(1, feature_size));
-	offset = 0;
-	for(size_t feature_idx = 0; feature_idx < feature_selection.size(); feature_idx++) {
-		const std::string& feature_name = feature_selection[feature_idx];
-		if (traxel.features.count(feature_name) == 0) {
-			throw std::runtime_error("Feature " + feature_name + " not found");
-			features(0, offset++) = 0.0f;
-		} else {
-			for(size_t i = 0; i < traxel.features[feature_name].size(); i++) {
-				features(0, offset++) = traxel.features[feature_name][i];
+	// one row of features per object
+	vigra::MultiArray<2, FeatureType> features;
+	get_feature_matrix(objects_current_frame, feature_selection, features);
+
+	// the rows left by the cascade
+	std::vector<size_t> evaluated_rows;
+	std::vector<std::ptrdiff_t> sources;
+	get_cascade_rows(objects_current_frame, features, evaluated_rows, sources);
+	skipped_count_ = sources.size() - evaluated_rows.size();
+	if (skipped_count_ > 0) {
+		vigra::MultiArray<2, FeatureType> evaluated_features(
+			vigra::Shape2(evaluated_rows.size(), features.shape(1)));
+		#pragma omp parallel for
+		for(size_t i = 0; i < evaluated_rows.size(); i++)
+		{
+			for(int column = 0; column < features.shape(1); column++)
+			{
+				evaluated_features(i, column) = features(evaluated_rows[i], column);
 			}
 		}
+		features.swap(evaluated_features);
 	}
-	
-	// evaluate the random forests
-	vigra::MultiArray<2, FeatureType> probabilities(vigra::Shape2(1, 2), 0.0);
-	for (size_t n = 0; n < random_forests.size(); n++) {
-		vigra::MultiArray<2, FeatureType> probabilities_temp(vigra::Shape2(1, 2));
-		random_forests[n].predictProbabilities(features, probabilities_temp);
-		probabilities += probabilities_temp;
+
+	// evaluate the random forests, without any forest all get zero
+	vigra::MultiArray<2, FeatureType> probabilities(
+		vigra::Shape2(evaluated_rows.size(), 2),
+		0.0);
+	if (!random_forests.empty() && !evaluated_rows.empty()) {
+		predict_forest_probabilities(random_forests, flat_forests, features, probabilities);
 	}
 
-	// std::cout << "RF feature set is: " << features << std::endl;
+	// fill the column
+	#pragma omp parallel for
+	for(size_t row = 0; row < objects_current_frame.get_row_count(); row++)
+	{
+		*objects_current_frame.get(div_prob, row) =
+			sources[row] < 0 ? 0.0f : probabilities(sources[row], 1);
+	}
+}
 
-	// fill the features map
-	traxel.features["divProb"].clear();
-	traxel.features["divProb"].push_back(probabilities(0, 1));
-	// std::cout << traxel << " has divProb: " << traxel.features["divProb"] << std::endl;
+template<int N, class LabelType>
+void DivisionFeatureExtractor<N, LabelType>::get_cascade_rows(
+	const ObjectFeatureTable& objects_current_frame,
+	const vigra::MultiArray<2, FeatureType>& features,
+	std::vector<size_t>& evaluated_rows,
+	std::vector<std::ptrdiff_t>& sources) const
+{
+	const size_t row_count = objects_current_frame.get_row_count();
+	evaluated_rows.clear();
+	sources.assign(row_count, -1);
+	// the candidate counts only fit the objects of the last extract
+	if (cascade_.mode == NoDivisionCascade
+		|| candidate_counts_.size() != row_count
+		|| is_plausible_.size() != row_count)
+	{
+		for(size_t row = 0; row < row_count; row++)
+		{
+			sources[row] = row;
+			evaluated_rows.push_back(row);
+		}
+		return;
+	}
+	// the first evaluated object without candidate children
+	std::ptrdiff_t default_source = -1;
+	for(size_t row = 0; row < row_count; row++)
+	{
+		const size_t candidate_count = candidate_counts_[row];
+		if (!is_plausible_[row])
+		{
+			continue;
+		}
+		if (candidate_count == 0)
+		{
+			if (default_source >= 0)
+			{
+				// the probability of the same features is known
+				const size_t default_row = evaluated_rows[default_source];
+				bool is_default = true;
+				for(int column = 0; column < features.shape(1) && is_default; column++)
+				{
+					is_default = features(row, column) == features(default_row, column);
+				}
+				if (is_default)
+				{
+					sources[row] = default_source;
+					continue;
+				}
+			}
+			else
+			{
+				default_source = evaluated_rows.size();
+			}
+		}
+		sources[row] = evaluated_rows.size();
+		evaluated_rows.push_back(row);
+	}
 }
 
 } // namespace isbi_pipeline
@@ -0,0 +1,122 @@
+#ifndef ISBI_FLAT_FOREST_HXX
+#define ISBI_FLAT_FOREST_HXX
+
+// stl
+#include <vector>
+
+// vigra
+#include <vigra/multi_array.hxx> /* for MultiArrayView */
+
+// own
+#include "common.h"
+#include "pipeline_helpers.hxx" /* for TrackingOptions */
+
+namespace isbi_pipeline {
+
+// Compiled form of a vigra random forest for fast prediction.
+//
+// All trees are stored in one breadth-first structure of arrays: per node
+// the feature column (-1 for leaves), the split threshold and the index of
+// the left child (the right child follows it) or, for leaves, the offset of
+// the class weights. A block of rows is pushed through each tree level by
+// level, hence the memory accesses of many rows are interleaved.
+//
+// The probabilities are identical to vigra::RandomForest::predictProbabilities:
+// - vigra splits left if double(feature) < threshold. The float threshold
+//   stored here is the smallest float >= threshold, for which
+//   feature < float_threshold gives the same decision for every float.
+// - the leaf weights are precomputed in double with the expression vigra
+//   uses and accumulated in the same (tree) order and precision.
+// - rows containing NaN get zero probabilities.
+//
+// Optionally the thresholds are quantized: the distinct thresholds of each
+// feature column are sorted and a split node stores the rank of its
+// threshold instead. A feature is replaced by the number of thresholds of
+// its column that are not larger, hence feature < threshold becomes an
+// integer compare with the same outcome. The ranks of a block of rows are
+// stored column by column, thus one SSE2 instruction decides a split for
+// 16 (uint8) or 8 (uint16) rows.
+class FlatForest {
+ public:
+  // Per block state of predict_probabilities. Keep one per thread to reuse
+  // it between calls, it only grows if a forest needs more.
+  struct Scratch {
+    std::vector<DataType> votes;
+    // the ranks of a block for rank size 1 and 2
+    std::vector<vigra::UInt8> ranks8;
+    std::vector<vigra::UInt16> ranks16;
+    std::vector<vigra::UInt64> masks;
+  };
+
+  FlatForest();
+  FlatForest(const RandomForestType& random_forest);
+  // only forests made of threshold nodes can be flattened
+  static bool is_supported(const RandomForestType& random_forest);
+  size_t get_class_count() const;
+  size_t get_column_count() const;
+  size_t get_node_count() const;
+  // Use integer ranks instead of float thresholds. Returns false (and
+  // keeps the float thresholds) if a column has too many thresholds.
+  bool quantize();
+  // 0 if not quantized, else the bytes per rank
+  size_t get_rank_size() const;
+  // the counterpart of vigra::RandomForest::predictProbabilities
+  void predict_probabilities(
+    const vigra::MultiArrayView<2, DataType>& features,
+    vigra::MultiArrayView<2, DataType> probabilities) const;
+  // the same with the block state in scratch
+  void predict_probabilities(
+    const vigra::MultiArrayView<2, DataType>& features,
+    vigra::MultiArrayView<2, DataType> probabilities,
+    Scratch& scratch) const;
+ private:
+  enum { block_size = 64 };
+  void predict_block(
+    const vigra::MultiArrayView<2, DataType>& features,
+    const size_t row_begin,
+    const size_t row_end,
+    vigra::MultiArrayView<2, DataType>& probabilities,
+    Scratch& scratch) const;
+  template<typename RankType>
+  void predict_block_quantized(
+    const vigra::MultiArrayView<2, DataType>& features,
+    const size_t row_begin,
+    const size_t row_end,
+    vigra::MultiArrayView<2, DataType>& probabilities,
+    Scratch& scratch) const;
+
+  size_t class_count_;
+  size_t column_count_;
+  std::vector<vigra::Int32> roots_;
+  std::vector<vigra::Int32> columns_;
+  std::vector<float> thresholds_;
+  std::vector<vigra::Int32> next_;
+  std::vector<double> leaf_weights_;
+  // sorted distinct thresholds of column c in
+  // [column_offsets_[c], column_offsets_[c+1]) of column_thresholds_
+  size_t rank_size_;
+  std::vector<size_t> column_offsets_;
+  std::vector<float> column_thresholds_;
+  // 1 + index of the threshold of a split node in its column
+  std::vector<vigra::UInt16> ranks_;
+  // columns any split node looks at
+  std::vector<vigra::Int32> used_columns_;
+};
+
+typedef std::vector<FlatForest> FlatForestVectorType;
+
+// flatten all random forests, returns an empty vector if one of them is not
+// supported. Forests that cannot be quantized keep float thresholds.
+FlatForestVectorType flatten_forests(
+  const RandomForestVectorType& rfs,
+  const bool quantize = false);
+
+// true if the option "ForestBackend" is set to "flat" or "quantized"
+bool use_flat_forests(const TrackingOptions& options);
+
+// true if the option "ForestBackend" is set to "quantized"
+bool use_quantized_forests(const TrackingOptions& options);
+
+} // end of namespace isbi_pipeline
+
+#endif // ISBI_FLAT_FOREST_HXX
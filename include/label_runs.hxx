@@ -0,0 +1,74 @@
+#ifndef ISBI_LABEL_RUNS_HXX
+#define ISBI_LABEL_RUNS_HXX
+
+// stl
+#include <vector>
+#include <cstdint>
+
+// vigra
+#include <vigra/multi_array.hxx> /* for MultiArray */
+
+// own
+#include "common.h"
+
+namespace isbi_pipeline {
+
+// A label image stored as the runs of equal nonzero labels along its rows
+// (the first axis). A frame needs a few bytes per run instead of a label per
+// pixel or the coordinates of every object pixel, the labels of a box are
+// decoded on demand.
+template<int N>
+class LabelRuns {
+ public:
+  typedef typename vigra::MultiArrayShape<N>::type ShapeType;
+  LabelRuns();
+  // replace the runs by the runs of label_image
+  void encode(const vigra::MultiArrayView<N, LabelType>& label_image);
+  const ShapeType& get_shape() const;
+  size_t get_run_count() const;
+  // the labels of the box [box_min, box_max), labels is reshaped to the
+  // shape of the box. Throws if the box is not inside the image.
+  void decode(
+    const ShapeType& box_min,
+    const ShapeType& box_max,
+    vigra::MultiArray<N, LabelType>& labels) const;
+ private:
+  struct Run {
+    uint32_t begin_;
+    uint32_t end_;
+    LabelType label_;
+  };
+  // index of the row with the coordinates 1 to N - 1 of position
+  size_t get_row(const ShapeType& position) const;
+  ShapeType shape_;
+  // the runs of row r are runs_[row_begins_[r]] to runs_[row_begins_[r + 1]]
+  std::vector<size_t> row_begins_;
+  std::vector<Run> runs_;
+};
+
+/*=============================================================================
+  Implementation
+=============================================================================*/
+
+template<int N>
+inline const typename LabelRuns<N>::ShapeType& LabelRuns<N>::get_shape() const {
+  return shape_;
+}
+
+template<int N>
+inline size_t LabelRuns<N>::get_run_count() const {
+  return runs_.size();
+}
+
+template<int N>
+inline size_t LabelRuns<N>::get_row(const ShapeType& position) const {
+  size_t row = 0;
+  for (int n = N - 1; n > 0; n--) {
+    row = row * shape_[n] + position[n];
+  }
+  return row;
+}
+
+} // end of namespace isbi_pipeline
+
+#endif // ISBI_LABEL_RUNS_HXX
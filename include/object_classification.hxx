@@ -0,0 +1,45 @@
+#ifndef ISBI_OBJECT_CLASSIFICATION_HXX
+#define ISBI_OBJECT_CLASSIFICATION_HXX
+
+// stl
+#include <vector>
+#include <string>
+
+// vigra
+#include <vigra/multi_array.hxx> /* for MultiArray */
+
+// own
+#include "common.h"
+#include "flat_forest.hxx"
+#include "object_feature_table.hxx"
+
+namespace isbi_pipeline {
+
+// Fill one row per traxel with the selected features (in the order of the
+// selection). Throws if a feature is missing or its size differs between
+// the traxels.
+void get_feature_matrix(
+  const TraxelVectorType& traxels,
+  const std::vector<std::string>& feature_selection,
+  vigra::MultiArray<2, FeatureType>& features);
+
+// same for the rows of an object feature table, throws if a feature is
+// missing
+void get_feature_matrix(
+  const ObjectFeatureTable& objects,
+  const std::vector<std::string>& feature_selection,
+  vigra::MultiArray<2, FeatureType>& features);
+
+// Sum of the probabilities of all random forests for each row of features.
+// Forests and blocks of rows are evaluated in parallel, the forests are
+// summed in a fixed order afterwards, hence the result equals predicting
+// each row on its own. Uses the flat forests if given, else the vigra ones.
+void predict_forest_probabilities(
+  const RandomForestVectorType& random_forests,
+  const FlatForestVectorType& flat_forests,
+  const vigra::MultiArray<2, FeatureType>& features,
+  vigra::MultiArray<2, FeatureType>& probabilities);
+
+} // end of namespace isbi_pipeline
+
+#endif // ISBI_OBJECT_CLASSIFICATION_HXX
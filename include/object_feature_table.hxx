@@ -0,0 +1,117 @@
+#ifndef ISBI_OBJECT_FEATURE_TABLE_HXX
+#define ISBI_OBJECT_FEATURE_TABLE_HXX
+
+// stl
+#include <vector>
+#include <string>
+#include <map>
+
+// own
+#include "common.h"
+
+namespace isbi_pipeline {
+
+// The object features of one frame, one row per object. The feature names
+// are interned once into ids and the values of a feature are stored in one
+// contiguous column (the feature size values of row 0, then of row 1, ...).
+// Rows are added filled with zeros. Clearing keeps the columns and their
+// memory, hence a table reused for every frame does not allocate per
+// object, but a feature only belongs to the frame again once it is added
+// after the clear. The rows become pgmlink traxels only when they are
+// handed over to the traxel store.
+class ObjectFeatureTable {
+ public:
+  typedef size_t FeatureId;
+  ObjectFeatureTable();
+  // remove all rows and unset all features, keeps the columns
+  void clear(const int timestep);
+  int get_timestep() const;
+  // id of the feature, adds a column if it is new and sets it. Throws if
+  // the feature exists with another size.
+  FeatureId add_feature(const std::string& name, const size_t size);
+  // only the features added since the last clear
+  bool has_feature(const std::string& name) const;
+  // throws if the feature was not added since the last clear
+  FeatureId get_feature_id(const std::string& name) const;
+  bool is_feature_set(const FeatureId feature) const;
+  size_t get_feature_count() const;
+  const std::string& get_feature_name(const FeatureId feature) const;
+  size_t get_feature_size(const FeatureId feature) const;
+  // append a row of zeros for the object with this label, returns its index
+  size_t add_row(const LabelType label);
+  size_t get_row_count() const;
+  LabelType get_label(const size_t row) const;
+  // the values of a feature in a row
+  FeatureType* get(const FeatureId feature, const size_t row);
+  const FeatureType* get(const FeatureId feature, const size_t row) const;
+  // one traxel per row with a ComLocator of these scales
+  void get_traxels(
+    TraxelVectorType& traxels,
+    const DataType x_scale,
+    const DataType y_scale,
+    const DataType z_scale) const;
+  // set all features of row i in the feature map of traxels[i], except
+  // those not added since the last clear
+  void fill_feature_maps(TraxelVectorType& traxels) const;
+  // one row per traxel with all its features, missing features stay zero
+  void add_traxels(const TraxelVectorType& traxels);
+ private:
+  int timestep_;
+  std::map<std::string, FeatureId> feature_ids_;
+  std::vector<std::string> feature_names_;
+  std::vector<size_t> feature_sizes_;
+  // added since the last clear, the columns of the others are empty
+  std::vector<bool> feature_set_;
+  std::vector<std::vector<FeatureType> > columns_;
+  std::vector<LabelType> labels_;
+};
+
+/*=============================================================================
+  Implementation
+=============================================================================*/
+
+inline int ObjectFeatureTable::get_timestep() const {
+  return timestep_;
+}
+
+inline bool ObjectFeatureTable::is_feature_set(
+  const FeatureId feature) const
+{
+  return feature_set_[feature];
+}
+
+inline size_t ObjectFeatureTable::get_feature_count() const {
+  return feature_names_.size();
+}
+
+inline size_t ObjectFeatureTable::get_feature_size(
+  const FeatureId feature) const
+{
+  return feature_sizes_[feature];
+}
+
+inline size_t ObjectFeatureTable::get_row_count() const {
+  return labels_.size();
+}
+
+inline LabelType ObjectFeatureTable::get_label(const size_t row) const {
+  return labels_[row];
+}
+
+inline FeatureType* ObjectFeatureTable::get(
+  const FeatureId feature,
+  const size_t row)
+{
+  return &columns_[feature][row * feature_sizes_[feature]];
+}
+
+inline const FeatureType* ObjectFeatureTable::get(
+  const FeatureId feature,
+  const size_t row) const
+{
+  return &columns_[feature][row * feature_sizes_[feature]];
+}
+
+} // end of namespace isbi_pipeline
+
+#endif // ISBI_OBJECT_FEATURE_TABLE_HXX
@@ -0,0 +1,186 @@
+#ifndef ISBI_OBJECT_INDEX_HXX
+#define ISBI_OBJECT_INDEX_HXX
+
+// stl
+#include <vector>
+#include <algorithm>
+
+// vigra
+#include <vigra/multi_array.hxx> /* for MultiArrayView */
+
+// own
+#include "common.h"
+#include "object_feature_table.hxx"
+
+namespace isbi_pipeline {
+
+// Index of the objects of a frame: a dense map from the labels to the rows
+// of the object table and, once build_grid is called, a uniform grid of
+// cells that lists the objects whose bounding box (CoordMin, CoordMax)
+// overlaps the cell. The objects in a box are then found from the few
+// cells it overlaps, the label image is only read where a bounding box
+// sticks out of the box.
+template<int N>
+class ObjectIndex {
+ public:
+  typedef typename vigra::MultiArrayShape<N>::type ShapeType;
+  // index the labels and the bounding boxes of the objects if they have
+  // the features CoordMin and CoordMax
+  explicit ObjectIndex(const ObjectFeatureTable& objects);
+  bool has_boxes() const;
+  // the row of the first object with this label, false if there is none
+  bool find_row(const LabelType label, size_t& row) const;
+  // grid over an image of this shape with cells of edge cell_size, does
+  // nothing without bounding boxes
+  void build_grid(const ShapeType& shape, const size_t cell_size);
+  // the labels of label_image with a pixel in the box [box_min, box_max)
+  // in ascending order, without 0. The labels of objects outside the table
+  // are only found without a grid, then the whole box is scanned.
+  template<class T>
+  void find_labels_in_box(
+    const ShapeType& box_min,
+    const ShapeType& box_max,
+    const vigra::MultiArrayView<N, T>& label_image,
+    std::vector<T>& labels) const;
+ private:
+  // the cells [cell_min, cell_max] that the box [box_min, box_max) overlaps
+  void get_cells(
+    const ShapeType& box_min,
+    const ShapeType& box_max,
+    ShapeType& cell_min,
+    ShapeType& cell_max) const;
+  size_t get_cell_index(const ShapeType& cell) const;
+  // step position through the box [begin, end) in scan order, false after
+  // the last position
+  static bool next_position(
+    ShapeType& position,
+    const ShapeType& begin,
+    const ShapeType& end);
+  // row + 1 per label, 0 if there is no object with the label
+  std::vector<size_t> rows_by_label_;
+  std::vector<LabelType> labels_;
+  // the bounding boxes [box_min, box_max) per row
+  std::vector<ShapeType> box_mins_;
+  std::vector<ShapeType> box_maxs_;
+  size_t cell_size_;
+  ShapeType grid_shape_;
+  // the rows in cell c are cell_rows_[cell_begins_[c]] to
+  // cell_rows_[cell_begins_[c + 1]]
+  std::vector<size_t> cell_begins_;
+  std::vector<size_t> cell_rows_;
+};
+
+/*=============================================================================
+  Implementation
+=============================================================================*/
+
+template<int N>
+inline bool ObjectIndex<N>::has_boxes() const {
+  return box_mins_.size() == labels_.size();
+}
+
+template<int N>
+inline bool ObjectIndex<N>::find_row(
+  const LabelType label,
+  size_t& row) const
+{
+  if (size_t(label) >= rows_by_label_.size() || rows_by_label_[label] == 0) {
+    return false;
+  }
+  row = rows_by_label_[label] - 1;
+  return true;
+}
+
+template<int N>
+inline bool ObjectIndex<N>::next_position(
+  ShapeType& position,
+  const ShapeType& begin,
+  const ShapeType& end)
+{
+  for (int n = 0; n < N; n++) {
+    if (++position[n] < end[n]) {
+      return true;
+    }
+    position[n] = begin[n];
+  }
+  return false;
+}
+
+template<int N>
+template<class T>
+void ObjectIndex<N>::find_labels_in_box(
+  const ShapeType& box_min,
+  const ShapeType& box_max,
+  const vigra::MultiArrayView<N, T>& label_image,
+  std::vector<T>& labels) const
+{
+  labels.clear();
+  for (int n = 0; n < N; n++) {
+    if (box_min[n] >= box_max[n]) {
+      return;
+    }
+  }
+  if (cell_size_ == 0) {
+    // no grid, scan the box
+    vigra::MultiArrayView<N, T> roi = label_image.subarray(box_min, box_max);
+    for (
+      typename vigra::MultiArrayView<N, T>::const_iterator it =
+        roi.begin();
+      it != roi.end();
+      it++)
+    {
+      if (*it != 0 && (labels.empty() || labels.back() != *it)) {
+        labels.push_back(*it);
+      }
+    }
+  } else {
+    // the rows of the cells, an object can be in several cells
+    std::vector<size_t> rows;
+    ShapeType cell_min, cell_max;
+    get_cells(box_min, box_max, cell_min, cell_max);
+    ShapeType cell = cell_min;
+    const ShapeType cell_end = cell_max + ShapeType(1);
+    do {
+      const size_t cell_index = get_cell_index(cell);
+      rows.insert(
+        rows.end(),
+        cell_rows_.begin() + cell_begins_[cell_index],
+        cell_rows_.begin() + cell_begins_[cell_index + 1]);
+    } while (next_position(cell, cell_min, cell_end));
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    for (size_t row : rows) {
+      // the part of the bounding box in the box
+      bool is_inside = true;
+      bool overlaps = true;
+      ShapeType overlap_min, overlap_max;
+      for (int n = 0; n < N; n++) {
+        overlap_min[n] = std::max(box_min[n], box_mins_[row][n]);
+        overlap_max[n] = std::min(box_max[n], box_maxs_[row][n]);
+        overlaps = overlaps && overlap_min[n] < overlap_max[n];
+        is_inside = is_inside
+          && overlap_min[n] == box_mins_[row][n]
+          && overlap_max[n] == box_maxs_[row][n];
+      }
+      if (!overlaps) {
+        continue;
+      }
+      if (!is_inside) {
+        // the object may only cover the part of the bounding box outside
+        vigra::MultiArrayView<N, T> overlap =
+          label_image.subarray(overlap_min, overlap_max);
+        if (std::find(overlap.begin(), overlap.end(), T(labels_[row]))
+            == overlap.end()) {
+          continue;
+        }
+      }
+      labels.push_back(T(labels_[row]));
+    }
+  }
+  std::sort(labels.begin(), labels.end());
+  labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+}
+
+} // end of namespace isbi_pipeline
+
+#endif // ISBI_OBJECT_INDEX_HXX
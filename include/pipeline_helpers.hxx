@@ -11,8 +11,10 @@
 #include <utility>
 #include <exception>
 #include <map>
+#include <functional>
 
 // vigra
+#include <vigra/multi_array.hxx> /* for MultiArrayShape */
 #include <vigra/random_forest.hxx>
 
 // boost
@@ -57,6 +59,16 @@ void get_bounding_box(
   vigra::TinyVector<LabelType, N>& bb_min,
   vigra::TinyVector<LabelType, N>& bb_max);
 
+// the bounding box of the field of view enlarged by halo and clipped to
+// the image shape
+template<int N>
+void get_crop_box(
+  const TrackingOptions& options,
+  const typename vigra::MultiArrayShape<N>::type& shape,
+  const typename vigra::MultiArrayShape<N>::type& halo,
+  typename vigra::MultiArrayShape<N>::type& crop_min,
+  typename vigra::MultiArrayShape<N>::type& crop_max);
+
 
 // for logging of the traxelstore
 void print_traxelstore(std::ostream& stream, const TraxelStoreType& ts);
@@ -76,6 +88,13 @@ int read_features_from_file(
   const std::string path,
   StringDataPairVectorType& features);
 
+// same as above, the optional third column of each line (the filter backend
+// of the feature) is stored in backends, lines without it give ""
+int read_features_from_file(
+  const std::string path,
+  StringDataPairVectorType& features,
+  std::vector<std::string>& backends);
+
 // read region feature list from file
 int read_region_features_from_file(
   const std::string path,
@@ -88,13 +107,24 @@ bool get_rfs_from_file(
   std::string path_in_file = "PixelClassification/ClassifierForests/Forest",
   int n_leading_zeros = 4);
 
+// mark the feature columns any split node of the random forests looks at
+std::vector<bool> get_used_feature_columns(const RandomForestVectorType& rfs);
+
+
+// fills the coordinates of the mergers in the events into the coordinate map
+typedef std::function<
+  void(const EventVectorVectorType&, CoordinateMapPtrType)
+> MergerCoordinatesFunctionType;
 
-// do the tracking
+// do the tracking, fill_merger_coordinates is called before the mergers are
+// resolved if it is set
 EventVectorVectorType track(
   TraxelStoreType& ts,
   const TrackingOptions& options,
   const CoordinateMapPtrType& coordinate_map_ptr = CoordinateMapPtrType(),
-  const std::vector<pgmlink::Traxel>& traxels_to_keep_in_first_frame = {});
+  const std::vector<pgmlink::Traxel>& traxels_to_keep_in_first_frame = {},
+  const MergerCoordinatesFunctionType& fill_merger_coordinates =
+    MergerCoordinatesFunctionType());
 
 
 // helper function to iterate over tif only
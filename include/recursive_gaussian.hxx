@@ -0,0 +1,117 @@
+#ifndef ISBI_RECURSIVE_GAUSSIAN_HXX
+#define ISBI_RECURSIVE_GAUSSIAN_HXX
+
+// stl
+#include <vector>
+#include <cstddef>
+
+// vigra
+#include <vigra/multi_array.hxx> /* for MultiArrayView */
+
+// own
+#include "common.h"
+
+namespace isbi_pipeline {
+
+// Recursive (IIR) Gaussian filters whose cost does not depend on the scale.
+//
+// Smoothing uses the third order forward/backward recursion of Young and
+// van Vliet ("Recursive implementation of the Gaussian filter", Signal
+// Processing 44, 1995). Derivatives are taken by central differences of the
+// smoothed line. Lines are reflected at the border (as the FIR filters of
+// vigra do) by 3.5 sigma, so only the border handling depends on the scale.
+//
+// The recursion approximates the sampled Gaussian less well at small scales,
+// hence axes whose scale sigma / step_size is below min_recursive_sigma are
+// filtered with sampled FIR kernels instead, which are cheap at such scales.
+// The deviation from the FIR filters (window size 3.5) per feature, scale and
+// step size is reported by tools/benchmark_recursive_gaussian.cxx.
+const double min_recursive_sigma = 2.0;
+
+// Sampled Gaussian (derivative) kernel of the given order, normalized like
+// the vigra kernels, for scales below min_recursive_sigma.
+void fir_gaussian_kernel(
+  double sigma,
+  unsigned int order,
+  double window_size,
+  std::vector<double>& kernel);
+
+// Filter one strided line of length size with a Gaussian of scale sigma
+// followed by a central difference derivative of the given order (0, 1 or
+// 2). The line is convolved with fir_kernel instead if it is not empty. The
+// result is multiplied by scale. src and dest may be identical, buffer and
+// result are scratch space that is reused between lines.
+void recursive_gaussian_line(
+  const DataType* src,
+  std::ptrdiff_t src_stride,
+  DataType* dest,
+  std::ptrdiff_t dest_stride,
+  size_t size,
+  double sigma,
+  unsigned int order,
+  double scale,
+  double window_size,
+  const std::vector<double>& fir_kernel,
+  std::vector<double>& buffer,
+  std::vector<double>& result);
+
+template<int N>
+class RecursiveGaussianFilter {
+ public:
+  typedef vigra::MultiArrayView<N, DataType, vigra::StridedArrayTag> ViewType;
+  typedef vigra::TinyVector<DataType, N> VectorType;
+  typedef vigra::TinyVector<DataType, (N*(N+1))/2> TensorType;
+  typedef vigra::MultiArrayView<N, VectorType, vigra::StridedArrayTag>
+    VectorViewType;
+  typedef vigra::MultiArrayView<N, TensorType, vigra::StridedArrayTag>
+    TensorViewType;
+  typedef vigra::TinyVector<unsigned int, N> OrderType;
+
+  RecursiveGaussianFilter(DataType window_size = 3.5);
+  RecursiveGaussianFilter(
+    const vigra::TinyVector<DataType, N>& step_size,
+    DataType window_size = 3.5);
+  // the counterparts of the vigra functions of the same name
+  void gaussian_smoothing(
+    const ViewType& src,
+    ViewType dest,
+    DataType sigma) const;
+  void gaussian_derivative(
+    const ViewType& src,
+    ViewType dest,
+    DataType sigma,
+    const OrderType& orders) const;
+  void laplacian_of_gaussian(
+    const ViewType& src,
+    ViewType dest,
+    DataType sigma,
+    ViewType temp) const;
+  void gaussian_gradient(
+    const ViewType& src,
+    VectorViewType dest,
+    DataType sigma) const;
+  void hessian_of_gaussian(
+    const ViewType& src,
+    TensorViewType dest,
+    DataType sigma) const;
+  void structure_tensor(
+    const ViewType& src,
+    TensorViewType dest,
+    DataType inner_sigma,
+    DataType outer_sigma,
+    VectorViewType gradient) const;
+ private:
+  void filter_axis(
+    const ViewType& src,
+    ViewType dest,
+    unsigned int axis,
+    DataType sigma,
+    unsigned int order) const;
+
+  vigra::TinyVector<DataType, N> step_size_;
+  DataType window_size_;
+};
+
+} // end of namespace isbi_pipeline
+
+#endif // ISBI_RECURSIVE_GAUSSIAN_HXX
@@ -0,0 +1,167 @@
+#ifndef ISBI_REGION_MOMENTS_HXX
+#define ISBI_REGION_MOMENTS_HXX
+
+// stl
+#include <vector>
+#include <cmath>
+#include <limits>
+
+// vigra
+#include <vigra/multi_array.hxx> /* for MultiArrayView */
+#include <vigra/tinyvector.hxx> /* for TinyVector */
+
+// own
+#include "common.h"
+#include "connected_components.hxx" /* for RegionStatistics */
+
+namespace isbi_pipeline {
+
+// Intensity moments and range, center and bounding box of a region, i.e.
+// the vigra::acc features Count, Sum, Mean, Variance, Skewness, Kurtosis,
+// Minimum, Maximum, RegionCenter, Coord<Minimum> and Coord<Maximum> with
+// the same definitions (population variance, skewness and excess
+// kurtosis). The central moments are summed around the mean in a second
+// pass, hence they do not suffer from cancellation.
+template<int N>
+struct RegionMoments {
+  typedef vigra::TinyVector<double, N> CoordinateType;
+  RegionMoments();
+  // the moments up to the variance of the statistics of the labeling,
+  // without the intensity range and the higher moments
+  explicit RegionMoments(const RegionStatistics<N>& statistics);
+  double get_count() const;
+  double get_sum() const;
+  double get_mean() const;
+  double get_variance() const;
+  double get_skewness() const;
+  double get_kurtosis() const;
+  double get_minimum() const;
+  double get_maximum() const;
+  CoordinateType get_center() const;
+  CoordinateType get_coordinate_min() const;
+  CoordinateType get_coordinate_max() const;
+
+  double count_;
+  double sum_;
+  double mean_;
+  double minimum_;
+  double maximum_;
+  // sums of the powers 2, 3 and 4 of the deviations from the mean
+  double squared_deviations_;
+  double cubed_deviations_;
+  double quartic_deviations_;
+  CoordinateType coordinate_sum_;
+  CoordinateType coordinate_min_;
+  CoordinateType coordinate_max_;
+};
+
+// Calculate the moments of the regions 1 to moments.size() - 1 of
+// region_image with the intensities of image, region 0 is ignored. offset is
+// added to the coordinates. Each row is split into runs of pixels of the
+// same region, the intensities of a run are summed with SSE2 if available.
+template<int N>
+void get_region_moments(
+  const vigra::MultiArrayView<N, LabelType>& region_image,
+  const vigra::MultiArrayView<N, DataType>& image,
+  const typename vigra::MultiArrayShape<N>::type& offset,
+  std::vector<RegionMoments<N> >& moments);
+
+/*=============================================================================
+  Implementation
+=============================================================================*/
+
+template<int N>
+RegionMoments<N>::RegionMoments() :
+  count_(0.0),
+  sum_(0.0),
+  mean_(0.0),
+  minimum_(std::numeric_limits<double>::max()),
+  maximum_(std::numeric_limits<double>::lowest()),
+  squared_deviations_(0.0),
+  cubed_deviations_(0.0),
+  quartic_deviations_(0.0),
+  coordinate_sum_(0.0),
+  coordinate_min_(std::numeric_limits<double>::max()),
+  coordinate_max_(std::numeric_limits<double>::lowest())
+{
+}
+
+template<int N>
+RegionMoments<N>::RegionMoments(const RegionStatistics<N>& statistics) :
+  count_(statistics.count_),
+  sum_(statistics.mean_ * statistics.count_),
+  mean_(statistics.mean_),
+  minimum_(std::numeric_limits<double>::max()),
+  maximum_(std::numeric_limits<double>::lowest()),
+  squared_deviations_(statistics.squared_deviations_),
+  cubed_deviations_(0.0),
+  quartic_deviations_(0.0),
+  coordinate_sum_(statistics.coordinate_sum_),
+  coordinate_min_(statistics.coordinate_min_),
+  coordinate_max_(statistics.coordinate_max_)
+{
+}
+
+template<int N>
+inline double RegionMoments<N>::get_count() const {
+  return count_;
+}
+
+template<int N>
+inline double RegionMoments<N>::get_sum() const {
+  return sum_;
+}
+
+template<int N>
+inline double RegionMoments<N>::get_mean() const {
+  return mean_;
+}
+
+template<int N>
+inline double RegionMoments<N>::get_variance() const {
+  return squared_deviations_ / count_;
+}
+
+template<int N>
+inline double RegionMoments<N>::get_skewness() const {
+  return std::sqrt(count_) * cubed_deviations_
+    / std::pow(squared_deviations_, 1.5);
+}
+
+template<int N>
+inline double RegionMoments<N>::get_kurtosis() const {
+  return count_ * quartic_deviations_
+    / (squared_deviations_ * squared_deviations_) - 3.0;
+}
+
+template<int N>
+inline double RegionMoments<N>::get_minimum() const {
+  return minimum_;
+}
+
+template<int N>
+inline double RegionMoments<N>::get_maximum() const {
+  return maximum_;
+}
+
+template<int N>
+inline typename RegionMoments<N>::CoordinateType
+RegionMoments<N>::get_center() const {
+  return coordinate_sum_ / count_;
+}
+
+template<int N>
+inline typename RegionMoments<N>::CoordinateType
+RegionMoments<N>::get_coordinate_min() const {
+  return coordinate_min_;
+}
+
+template<int N>
+inline typename RegionMoments<N>::CoordinateType
+RegionMoments<N>::get_coordinate_max() const {
+  return coordinate_max_;
+}
+
+} // end of namespace isbi_pipeline
+
+#endif // ISBI_REGION_MOMENTS_HXX
@@ -0,0 +1,164 @@
+#ifndef ISBI_SCRATCH_BUFFER_POOL_HXX
+#define ISBI_SCRATCH_BUFFER_POOL_HXX
+
+// stl
+#include <vector>
+#include <stdexcept>
+
+// vigra
+#include <vigra/multi_array.hxx> /* for MultiArrayView */
+
+// openmp
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// own
+#include "common.h"
+
+namespace isbi_pipeline {
+
+// Per-thread temporary storage for the pixel feature calculators.
+//
+// Every thread owns one scalar, one vector and one tensor buffer. A request
+// returns a view of the requested shape onto the buffer of the calling thread
+// and only allocates if the buffer is too small. Hence after the first frame
+// no further allocations happen as long as the frame size does not grow.
+template<int N>
+class ScratchBufferPool {
+ public:
+  typedef typename vigra::MultiArrayShape<N>::type ShapeType;
+  typedef vigra::TinyVector<DataType, N> VectorType;
+  typedef vigra::TinyVector<DataType, (N*(N+1))/2> TensorType;
+  typedef vigra::MultiArrayView<N, DataType> ScalarViewType;
+  typedef vigra::MultiArrayView<N, VectorType> VectorViewType;
+  typedef vigra::MultiArrayView<N, TensorType> TensorViewType;
+
+  ScratchBufferPool();
+  ScalarViewType scalar(const ShapeType& shape);
+  VectorViewType vector(const ShapeType& shape);
+  TensorViewType tensor(const ShapeType& shape);
+  // statistics since the last call of reset_counters()
+  size_t get_allocation_count() const;
+  size_t get_request_count() const;
+  void reset_counters();
+ private:
+  struct ThreadBuffers {
+    ThreadBuffers() : allocations_(0), requests_(0) {}
+    std::vector<DataType> scalar_;
+    std::vector<VectorType> vector_;
+    std::vector<TensorType> tensor_;
+    size_t allocations_;
+    size_t requests_;
+  };
+  ThreadBuffers& thread_buffers();
+  template<typename T>
+  vigra::MultiArrayView<N, T> get_view(
+    std::vector<T>& buffer,
+    const ShapeType& shape,
+    ThreadBuffers& thread_buffers);
+
+  std::vector<ThreadBuffers> buffers_;
+};
+
+/*=============================================================================
+  Implementation
+=============================================================================*/
+
+template<int N>
+ScratchBufferPool<N>::ScratchBufferPool() {
+#ifdef _OPENMP
+  buffers_.resize(omp_get_max_threads());
+#else
+  buffers_.resize(1);
+#endif
+}
+
+template<int N>
+typename ScratchBufferPool<N>::ThreadBuffers&
+ScratchBufferPool<N>::thread_buffers() {
+#ifdef _OPENMP
+  size_t thread_index = omp_get_thread_num();
+#else
+  size_t thread_index = 0;
+#endif
+  if (thread_index >= buffers_.size()) {
+    throw std::runtime_error("ScratchBufferPool: thread index out of range");
+  }
+  return buffers_[thread_index];
+}
+
+template<int N>
+template<typename T>
+vigra::MultiArrayView<N, T> ScratchBufferPool<N>::get_view(
+  std::vector<T>& buffer,
+  const ShapeType& shape,
+  ThreadBuffers& thread_buffers)
+{
+  size_t size = 1;
+  for (size_t dim = 0; dim < N; dim++) {
+    size *= shape[dim];
+  }
+  thread_buffers.requests_++;
+  if (buffer.size() < size) {
+    // release the old buffer first to keep the peak memory low
+    std::vector<T>().swap(buffer);
+    buffer.resize(size);
+    thread_buffers.allocations_++;
+  }
+  return vigra::MultiArrayView<N, T>(shape, buffer.data());
+}
+
+template<int N>
+typename ScratchBufferPool<N>::ScalarViewType ScratchBufferPool<N>::scalar(
+  const ShapeType& shape)
+{
+  ThreadBuffers& buffers = thread_buffers();
+  return get_view(buffers.scalar_, shape, buffers);
+}
+
+template<int N>
+typename ScratchBufferPool<N>::VectorViewType ScratchBufferPool<N>::vector(
+  const ShapeType& shape)
+{
+  ThreadBuffers& buffers = thread_buffers();
+  return get_view(buffers.vector_, shape, buffers);
+}
+
+template<int N>
+typename ScratchBufferPool<N>::TensorViewType ScratchBufferPool<N>::tensor(
+  const ShapeType& shape)
+{
+  ThreadBuffers& buffers = thread_buffers();
+  return get_view(buffers.tensor_, shape, buffers);
+}
+
+template<int N>
+size_t ScratchBufferPool<N>::get_allocation_count() const {
+  size_t count = 0;
+  for (size_t n = 0; n < buffers_.size(); n++) {
+    count += buffers_[n].allocations_;
+  }
+  return count;
+}
+
+template<int N>
+size_t ScratchBufferPool<N>::get_request_count() const {
+  size_t count = 0;
+  for (size_t n = 0; n < buffers_.size(); n++) {
+    count += buffers_[n].requests_;
+  }
+  return count;
+}
+
+template<int N>
+void ScratchBufferPool<N>::reset_counters() {
+  for (size_t n = 0; n < buffers_.size(); n++) {
+    buffers_[n].allocations_ = 0;
+    buffers_[n].requests_ = 0;
+  }
+}
+
+} // end of namespace isbi_pipeline
+
+#endif // ISBI_SCRATCH_BUFFER_POOL_HXX
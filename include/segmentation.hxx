@@ -17,6 +17,11 @@
 // own
 #include "common.h"
 #include "pipeline_helpers.hxx"
+#include "scratch_buffer_pool.hxx"
+#include "recursive_gaussian.hxx"
+#include "tensor_eigenvalues.hxx"
+#include "flat_forest.hxx"
+#include "connected_components.hxx"
 
 namespace isbi_pipeline {
 
@@ -28,6 +33,16 @@ int read_hdf5_array(
   const std::string path_in_file,
   vigra::MultiArray<N, T>& multi_array);
 
+// convolution backend of a pixel feature
+enum FilterBackend {
+  AutoFilter, // recursive above the recursive threshold, FIR otherwise
+  FIRFilter,
+  RecursiveFilter
+};
+
+// parse "fir", "recursive" or "" (auto) as found in the feature files
+FilterBackend get_filter_backend(const std::string& name);
+
 template<int N>
 class FeatureCalculator {
  public:
@@ -40,52 +55,86 @@ class FeatureCalculator {
     DataType window_size = 3.5);
   size_t get_feature_size(const std::string& feature_name) const;
   size_t get_feature_size() const;
+  // one backend per entry in feature_scales, empty means AutoFilter for all
+  void set_filter_backends(const std::vector<FilterBackend>& backends);
+  // scale above which features with AutoFilter use the recursive filters
+  void set_recursive_threshold(DataType threshold);
+  bool use_recursive_filter(size_t feature_index) const;
+  // one flag per feature channel, features without any used channel are
+  // not calculated but filled with zeros. Empty means all are used.
+  void set_used_channels(const std::vector<bool>& used_channels);
+  bool is_feature_used(size_t feature_index) const;
+  size_t get_used_feature_count() const;
+  // number of pixels along each axis the used features look at, hence
+  // the features of a subarray shrunk by this radius do not depend on the
+  // pixels outside (up to the tails of the recursive filters)
+  typename vigra::MultiArrayShape<N>::type get_support_radius() const;
+  // window size and image scales (step size) of all feature filters
+  const vigra::ConvolutionOptions<N>& get_convolution_options() const;
   int calculate(
     const vigra::MultiArrayView<N, DataType>& image,
-    vigra::MultiArray<N+1, DataType>& features);
+    vigra::MultiArray<N+1, DataType>& features,
+    const bool verbose = true);
  private:
   int calculate_gaussian_smoothing(
     const vigra::MultiArrayView<N, DataType>& image,
     vigra::MultiArrayView<N+1, DataType>& features,
-    DataType feature_scale) const;
+    DataType feature_scale,
+    const bool recursive) const;
   int calculate_laplacian_of_gaussian(
     const vigra::MultiArrayView<N, DataType>& image,
     vigra::MultiArrayView<N+1, DataType>& features,
-    DataType feature_scale) const;
+    DataType feature_scale,
+    const bool recursive);
   int calculate_gaussian_gradient_magnitude(
     const vigra::MultiArrayView<N, DataType>& image,
     vigra::MultiArrayView<N+1, DataType>& features,
-    DataType feature_scale);
+    DataType feature_scale,
+    const bool recursive);
   int calculate_difference_of_gaussians(
     const vigra::MultiArrayView<N, DataType>& image,
     vigra::MultiArrayView<N+1, DataType>& features,
-    DataType feature_scale);
+    DataType feature_scale,
+    const bool recursive);
   int calculate_structure_tensor_eigenvalues(
     const vigra::MultiArrayView<N, DataType>& image,
     vigra::MultiArrayView<N+1, DataType>& features,
-    DataType feature_scale);
+    DataType feature_scale,
+    const bool recursive);
   int calculate_hessian_of_gaussian_eigenvalues(
     const vigra::MultiArrayView<N, DataType>& image,
     vigra::MultiArrayView<N+1, DataType>& features,
-    DataType feature_scale);
+    DataType feature_scale,
+    const bool recursive);
   
-  // temporary storage for feature computation allocated only once
-  vigra::MultiArray<N, DataType> feature_temp_;
-  vigra::MultiArray<N, vigra::TinyVector<DataType, (N*(N+1))/2> > tensor_temp_;
-  vigra::MultiArray<N, vigra::TinyVector<DataType, N> > eigenvalue_temp_;
+  // per-thread temporary storage for feature computation, allocated only
+  // if a frame is larger than all previous ones
+  ScratchBufferPool<N> scratch_buffers_;
+  RecursiveGaussianFilter<N> recursive_filter_;
+  std::vector<FilterBackend> filter_backends_;
+  DataType recursive_threshold_;
+  std::vector<bool> used_channels_;
 
   const StringDataPairVectorType& feature_scales_;
   DataType window_size_;
+  vigra::TinyVector<DataType, N> image_scales_;
   std::map<std::string, size_t> feature_sizes_;
   vigra::ConvolutionOptions<N> conv_options_;
 };
 
 template<int N>
 struct Segmentation {
+  // only filled from the labels when exported and when read from a file
   vigra::MultiArray<N, LabelType> segmentation_image_;
   vigra::MultiArray<N, LabelType> label_image_;
   vigra::MultiArray<N+1, DataType> feature_image_;
   vigra::MultiArray<N+1, DataType> prediction_map_;
+  // the foreground channel of the prediction map before smoothing, only
+  // kept if the option "PredictionCache" is set
+  vigra::MultiArray<N, DataType> foreground_;
+  // statistics of the image per label (0 is the background), only filled
+  // while labeling with the option "RegionStatisticsInLabeling"
+  std::vector<RegionStatistics<N> > region_statistics_;
   size_t label_count_;
   
   void initialize(const vigra::MultiArray<N, DataType>& image, size_t num_classes = 2);
@@ -95,6 +144,50 @@ struct Segmentation {
     const bool segmentation_only = false);
 };
 
+// The prediction cache holds the foreground channel of the prediction map
+// (the sum over all forests, before smoothing) and the number of forests,
+// enough to repeat the smoothing, thresholding and labeling. Quantized
+// caches store the mean probability in 8 bits. The offset is the position
+// of the foreground in the frame if it was cropped, 0 otherwise.
+template<int N>
+int export_prediction_cache(
+  const std::string filename,
+  const vigra::MultiArrayView<N, DataType>& foreground,
+  const size_t forest_count,
+  const bool quantize,
+  const typename vigra::MultiArrayShape<N>::type& offset);
+
+template<int N>
+int read_prediction_cache(
+  const std::string filename,
+  vigra::MultiArray<N, DataType>& foreground,
+  size_t& forest_count,
+  typename vigra::MultiArrayShape<N>::type& offset);
+
+// the smoothing of the foreground channel with "PredictionMapSmoothing"
+template<int N>
+void smooth_foreground(
+  vigra::MultiArrayView<N, DataType> foreground,
+  const DataType scale);
+
+// label the connected components of the pixels whose foreground sum is
+// above the threshold (the single threshold times the number of forests),
+// returns the label count
+template<int N>
+size_t label_foreground(
+  const vigra::MultiArrayView<N, DataType>& foreground,
+  const DataType threshold,
+  vigra::MultiArray<N, LabelType>& label_image);
+
+// same as above, also accumulates the region statistics of image
+template<int N>
+size_t label_foreground(
+  const vigra::MultiArrayView<N, DataType>& foreground,
+  const DataType threshold,
+  const vigra::MultiArrayView<N, DataType>& image,
+  vigra::MultiArray<N, LabelType>& label_image,
+  std::vector<RegionStatistics<N> >& region_statistics);
+
 template<int N>
 class SegmentationCalculator {
  public:
@@ -106,8 +199,44 @@ class SegmentationCalculator {
     const vigra::MultiArray<N, DataType>& image,
     Segmentation<N>& segmentation) const;
  private:
+  // with the flat forest if available, else the vigra forest. The flat
+  // forest keeps its block state in forest_scratch.
+  void predict_probabilities(
+    const size_t forest_index,
+    const vigra::MultiArrayView<2, DataType>& features,
+    vigra::MultiArrayView<2, DataType>& probabilities,
+    FlatForest::Scratch& forest_scratch) const;
+  // Add the forest probabilities of a block of pixels to the prediction
+  // map, but stop for a pixel once the remaining forests cannot change
+  // whether its sum is above the forest threshold. The labels are the same
+  // as with all forests, the prediction map of such pixels is incomplete.
+  // Returns the number of pixel forest evaluations.
+  size_t predict_block_cascaded(
+    const vigra::MultiArrayView<2, DataType>& features,
+    vigra::MultiArrayView<2, DataType>& prediction_map,
+    const size_t channel_index,
+    const DataType forest_threshold,
+    vigra::MultiArray<2, DataType>& active_features,
+    vigra::MultiArray<2, DataType>& prediction_temp,
+    FlatForest::Scratch& forest_scratch) const;
+  // Prefilter: the pixels whose smoothed intensity is at least the
+  // threshold are the candidates for foreground. The features are only
+  // calculated on boxes around the groups of tiles containing candidates
+  // (plus the support radius), all other features are zero. If the boxes
+  // would cover more than the frame, the features are calculated on the
+  // whole frame instead. Returns the candidates as indices into the
+  // flattened image.
+  void calculate_candidate_features(
+    const vigra::MultiArray<N, DataType>& image,
+    vigra::MultiArray<N+1, DataType>& features,
+    std::vector<size_t>& candidates) const;
+
   boost::shared_ptr<FeatureCalculator<N> > feature_calculator_ptr_;
   const RandomForestVectorType random_forests_;
+  // empty if the vigra forests are used
+  FlatForestVectorType flat_forests_;
+  // upper bound of the probabilities of each forest
+  std::vector<DataType> upper_bounds_;
   const TrackingOptions& options_;
 };
 
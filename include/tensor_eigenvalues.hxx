@@ -0,0 +1,141 @@
+#ifndef ISBI_TENSOR_EIGENVALUES_HXX
+#define ISBI_TENSOR_EIGENVALUES_HXX
+
+// stl
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+// vigra
+#include <vigra/multi_array.hxx> /* for MultiArrayView */
+
+// own
+#include "common.h"
+
+namespace isbi_pipeline {
+
+// Eigenvalues of symmetric 2x2 and 3x3 matrices in closed form.
+//
+// The tensors are stored in the upper triangular component order of vigra
+// (a00, a01, a11) and (a00, a01, a02, a11, a12, a22). The eigenvalues are
+// sorted in descending order and written into the channels (last axis) of
+// eigenvalues, so no intermediate array of TinyVectors is needed.
+//
+// The tensors are solved in blocks of 64 into a stack buffer, which is then
+// copied into the channels. The 2x2 solver only needs a sqrt per tensor, the
+// 3x3 solver also calls acos and cos per tensor. Degenerate matrices are
+// handled by selects instead of special cases. The math is done in double
+// like in vigra's symmetric2x2Eigenvalues and symmetric3x3Eigenvalues.
+template<int N>
+class SymmetricEigenvalues {
+ public:
+  typedef vigra::TinyVector<DataType, (N*(N+1))/2> TensorType;
+  template<class StrideTag>
+  static void calculate(
+    const vigra::MultiArrayView<N, TensorType>& tensors,
+    vigra::MultiArrayView<N+1, DataType, StrideTag> eigenvalues);
+ private:
+  enum { block_size = 64 };
+  // solve block_size (or fewer, given by count) tensors
+  static void solve_block(
+    const TensorType* tensors,
+    size_t count,
+    double values[N][block_size]);
+};
+
+/*=============================================================================
+  Implementation
+=============================================================================*/
+
+template<>
+inline void SymmetricEigenvalues<2>::solve_block(
+  const TensorType* tensors,
+  size_t count,
+  double values[2][block_size])
+{
+  for (size_t i = 0; i < count; i++) {
+    const double a00 = tensors[i][0];
+    const double a01 = tensors[i][1];
+    const double a11 = tensors[i][2];
+    const double trace = a00 + a11;
+    const double diff = a00 - a11;
+    const double root = std::sqrt(diff * diff + 4.0 * a01 * a01);
+    values[0][i] = 0.5 * (trace + root);
+    values[1][i] = 0.5 * (trace - root);
+  }
+}
+
+// trigonometric solution of the characteristic polynomial (Smith, 1961)
+template<>
+inline void SymmetricEigenvalues<3>::solve_block(
+  const TensorType* tensors,
+  size_t count,
+  double values[3][block_size])
+{
+  const double third_of_turn = 2.0 * std::acos(-1.0) / 3.0;
+  for (size_t i = 0; i < count; i++) {
+    const double a00 = tensors[i][0];
+    const double a01 = tensors[i][1];
+    const double a02 = tensors[i][2];
+    const double a11 = tensors[i][3];
+    const double a12 = tensors[i][4];
+    const double a22 = tensors[i][5];
+    const double mean = (a00 + a11 + a22) / 3.0;
+    const double b00 = a00 - mean;
+    const double b11 = a11 - mean;
+    const double b22 = a22 - mean;
+    const double off_diagonal = a01 * a01 + a02 * a02 + a12 * a12;
+    const double p = std::sqrt(
+      (b00 * b00 + b11 * b11 + b22 * b22 + 2.0 * off_diagonal) / 6.0);
+    // a multiple of the identity has p = 0, then all eigenvalues are mean
+    const double inv_p = (p > 0.0) ? 1.0 / p : 0.0;
+    const double det = b00 * (b11 * b22 - a12 * a12)
+      - a01 * (a01 * b22 - a12 * a02)
+      + a02 * (a01 * a12 - b11 * a02);
+    const double r = std::min(
+      1.0,
+      std::max(-1.0, 0.5 * det * inv_p * inv_p * inv_p));
+    const double phi = std::acos(r) / 3.0;
+    const double largest = mean + 2.0 * p * std::cos(phi);
+    const double smallest = mean + 2.0 * p * std::cos(phi + third_of_turn);
+    values[0][i] = largest;
+    values[1][i] = 3.0 * mean - largest - smallest;
+    values[2][i] = smallest;
+  }
+}
+
+template<int N>
+template<class StrideTag>
+void SymmetricEigenvalues<N>::calculate(
+  const vigra::MultiArrayView<N, TensorType>& tensors,
+  vigra::MultiArrayView<N+1, DataType, StrideTag> eigenvalues)
+{
+  typedef vigra::MultiArrayView<N, DataType, vigra::StridedArrayTag>
+    ChannelType;
+  std::vector<ChannelType> channels;
+  std::vector<typename ChannelType::iterator> channel_its;
+  for (int k = 0; k < N; k++) {
+    channels.push_back(eigenvalues.bindOuter(k));
+  }
+  for (int k = 0; k < N; k++) {
+    channel_its.push_back(channels[k].begin());
+  }
+  double values[N][block_size];
+  // the tensor view is unstrided, hence its data is in scan order
+  const TensorType* tensor_ptr = tensors.data();
+  const size_t size = tensors.size();
+  for (size_t start = 0; start < size; start += block_size) {
+    const size_t count = std::min<size_t>(block_size, size - start);
+    solve_block(tensor_ptr + start, count, values);
+    for (int k = 0; k < N; k++) {
+      typename ChannelType::iterator& channel_it = channel_its[k];
+      for (size_t i = 0; i < count; i++, ++channel_it) {
+        *channel_it = static_cast<DataType>(values[k][i]);
+      }
+    }
+  }
+}
+
+} // end of namespace isbi_pipeline
+
+#endif // ISBI_TENSOR_EIGENVALUES_HXX
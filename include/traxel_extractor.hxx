@@ -4,6 +4,9 @@
 // stl
 #include <vector>
 #include <string>
+#include <stdexcept>
+#include <utility>
+#include <omp.h>
 
 // vigra
 #include <vigra/multi_array.hxx> /* for MultiArray */
@@ -14,72 +17,263 @@
 #include <pgmlink/traxels.h> /* for Traxels and TraxelStore */
 #include <pgmlink/merger_resolving.h> /* for extract_coordintes */
 
+// boost
+#include <boost/tuple/tuple.hpp> /* for make_tuple */
+
 // own
 #include "common.h"
 #include "segmentation.hxx"
 #include "pipeline_helpers.hxx" /* for options */
+#include "flat_forest.hxx"
+#include "object_classification.hxx"
+#include "object_feature_table.hxx"
+#include "region_moments.hxx"
+#include "label_runs.hxx"
 
 namespace isbi_pipeline {
 
-template<unsigned int N>
-void fill_coordinate_map(
-  const TraxelVectorType& traxels,
-  const vigra::MultiArray<N, LabelType>& label_image,
-  CoordinateMapPtrType coordinate_map);
+// only for the objects that the events mark as mergers, decoded from the
+// label runs of their frames. events[t] and frames[t] belong to the timestep
+// t + timestep_offset, the bounding boxes are the features CoordMin and
+// CoordMax of the traxels in ts. The mergers are decoded in parallel into
+// one map per thread, the maps are moved into coordinate_map_ptr afterwards.
+template<int N>
+void fill_merger_coordinate_map(
+  const EventVectorVectorType& events,
+  const std::vector<LabelRuns<N> >& frames,
+  const TraxelStoreType& ts,
+  const size_t timestep_offset,
+  CoordinateMapPtrType coordinate_map_ptr);
+
+// an empty coordinate map for each thread
+std::vector<CoordinateMapPtrType> get_thread_coordinate_maps();
+
+// move the coordinates of the thread maps into coordinate_map_ptr
+void merge_coordinate_maps(
+  const std::vector<CoordinateMapPtrType>& thread_maps,
+  CoordinateMapPtrType coordinate_map_ptr);
+
+// the box [c_min, c_max) of the features CoordMin and CoordMax, false if
+// they are missing
+template<int N>
+bool get_coordinate_box(
+  const FeatureMapType& feature_map,
+  vigra::TinyVector<long int, N>& c_min,
+  vigra::TinyVector<long int, N>& c_max);
 
 template<int N>
 class TraxelExtractor {
  public:
   typedef typename vigra::CoupledIteratorType<N, LabelType, DataType>::type
     CoupledIteratorType;
+  typedef vigra::CoupledArrays<N, LabelType, DataType> CoupledArraysType;
+  // the other features are calculated by get_region_moments
+  typedef acc::Select<
+    acc::LabelArg<1>,
+    acc::DataArg<2>,
+    acc::Coord<acc::Principal<acc::Kurtosis> >,
+    acc::Coord<acc::Principal<acc::Skewness> >,
+    acc::RegionRadii > PrincipalFeaturesType;
   typedef typename acc::DynamicAccumulatorChainArray<
-    vigra::CoupledArrays<N, LabelType, DataType>,
-    acc::Select<
-      acc::LabelArg<1>,
-      acc::DataArg<2>,
-      acc::Coord<acc::Maximum>,
-      acc::Coord<acc::Minimum>,
-      acc::Coord<acc::Principal<acc::Kurtosis> >,
-      acc::Coord<acc::Principal<acc::Skewness> >,
-      acc::Count,
-      acc::Kurtosis,
-      acc::Maximum,
-      acc::Mean,
-      acc::Minimum,
-      acc::RegionCenter,
-      acc::RegionRadii,
-      acc::Skewness,
-      acc::Sum,
-      acc::Variance >
-  > AccChainType;
+    CoupledArraysType,
+    PrincipalFeaturesType> AccChainType;
+  // static chain for all principal axis features, without the activation
+  // checks per pixel
+  typedef typename acc::AccumulatorChainArray<
+    CoupledArraysType,
+    PrincipalFeaturesType> PrincipalAccChainType;
   TraxelExtractor(
     const std::vector<std::string> feature_selection,
     const RandomForestVectorType& random_forests,
     const TrackingOptions& options);
+  // one row per object, the table is cleared first
+  int extract(
+    const Segmentation<N>& segmentation,
+    const vigra::MultiArrayView<N, DataType>& image,
+    const int timestep,
+    ObjectFeatureTable& objects) const;
   int extract(
     const Segmentation<N>& segmentation,
     const vigra::MultiArrayView<N, DataType>& image,
     const int timestep,
     TraxelVectorType& traxels) const;
+  // the traxels of the objects with the locator scales of the options
+  void get_traxels(
+    const ObjectFeatureTable& objects,
+    TraxelVectorType& traxels) const;
+  // number of columns of a feature in the random forest feature vector
+  static size_t get_feature_size(const std::string& feature_name);
+  size_t get_feature_size() const;
+  // one flag per column of the feature vector, features without any used
+  // column are not extracted but filled with zeros. Empty means all are used.
+  void set_used_columns(const std::vector<bool>& used_columns);
+  bool is_feature_used(size_t feature_index) const;
+  size_t get_used_feature_count() const;
+  // added to the absolute coordinates (com, RegionCenter, CoordMin and
+  // CoordMax) before classification, for images cropped from a frame
+  void set_coordinate_offset(
+    const typename vigra::MultiArrayShape<N>::type& offset);
+  // use the static chain if all principal axis features are used (default),
+  // else always the dynamic chain. The features are the same.
+  void set_use_presets(const bool use_presets);
  private:
+  enum PresetType {
+    NoPreset,
+    PrincipalPreset
+  };
+  // The feature selection compiled into one extractor per feature, which
+  // writes the values of a region to the row of a table. The principal
+  // axis features are taken from the chain, all others from the moments.
+  template<class CHAIN>
+  struct FeatureExtractors {
+    typedef void (*ExtractorType)(
+      const CHAIN& acc_chain,
+      const RegionMoments<N>& moments,
+      const size_t region_index,
+      FeatureType* values);
+    // one per entry of the feature selection, null if not used
+    std::vector<ExtractorType> selection;
+    ExtractorType count;
+    ExtractorType region_center;
+    ExtractorType coord_min;
+    ExtractorType coord_max;
+    ExtractorType mean;
+    ExtractorType variance;
+  };
+  typedef void (*ActivatorType)(AccChainType& acc_chain);
+  typedef double (RegionMoments<N>::*MomentGetterType)() const;
+  typedef typename RegionMoments<N>::CoordinateType
+    (RegionMoments<N>::*CoordinateGetterType)() const;
+  // the columns extract writes to
+  struct TableColumns {
+    // one per entry of the feature selection
+    std::vector<ObjectFeatureTable::FeatureId> selection;
+    ObjectFeatureTable::FeatureId count;
+    ObjectFeatureTable::FeatureId count_feature;
+    ObjectFeatureTable::FeatureId com;
+    ObjectFeatureTable::FeatureId region_center;
+    ObjectFeatureTable::FeatureId coord_min;
+    ObjectFeatureTable::FeatureId coord_max;
+    ObjectFeatureTable::FeatureId mean;
+    ObjectFeatureTable::FeatureId variance;
+  };
+  // Count, Mean, Variance and RegionCenter, which the labeling can provide
+  static bool is_core_feature(const std::string& feature_name);
+  // Coord<Principal<Kurtosis> >, Coord<Principal<Skewness> > and
+  // RegionRadii, which need the accumulator chain
+  static bool is_principal_feature(const std::string& feature_name);
+  // compile the feature selection and the used features, throws for
+  // unknown features
+  void compile_features();
+  // null if the feature is not a principal axis feature
+  static ActivatorType get_activator(const std::string& feature_name);
+  // null if the feature is not one of the moments
+  template<class CHAIN>
+  static typename FeatureExtractors<CHAIN>::ExtractorType get_moment_extractor(
+    const std::string& feature_name);
+  template<class CHAIN>
+  static typename FeatureExtractors<CHAIN>::ExtractorType get_extractor(
+    const std::string& feature_name);
+  // lookup gives the extractor of a used feature
+  template<class CHAIN>
+  void compile_extractors(
+    FeatureExtractors<CHAIN>& extractors,
+    typename FeatureExtractors<CHAIN>::ExtractorType (*lookup)(
+      const std::string&)) const;
+  // the typed extractors
+  template<class TAG>
+  static void activate(AccChainType& acc_chain);
+  template<class CHAIN, class TAG>
+  static void get_feature(
+    const CHAIN& acc_chain,
+    const RegionMoments<N>& moments,
+    const size_t region_index,
+    FeatureType* values);
+  template<class CHAIN, MomentGetterType GETTER>
+  static void get_moment(
+    const CHAIN& acc_chain,
+    const RegionMoments<N>& moments,
+    const size_t region_index,
+    FeatureType* values);
+  template<class CHAIN, CoordinateGetterType GETTER>
+  static void get_coordinates(
+    const CHAIN& acc_chain,
+    const RegionMoments<N>& moments,
+    const size_t region_index,
+    FeatureType* values);
+  // phase 2 of extract with the configured chain: accumulate the kept
+  // objects and fill their rows. use_moments: calculate the moments, else
+  // they are taken from the region statistics of the segmentation.
+  template<class CHAIN>
+  void extract_objects(
+    const CHAIN& acc_chain,
+    const FeatureExtractors<CHAIN>& extractors,
+    const bool use_moments,
+    const bool use_chain,
+    const Segmentation<N>& segmentation,
+    const vigra::MultiArrayView<N, DataType>& image,
+    const std::vector<RegionStatistics<N> >& bounds,
+    const std::vector<size_t>& kept_labels,
+    const double pixel_count,
+    const TableColumns& columns,
+    ObjectFeatureTable& objects) const;
+  // calculate the moments (if not null) and run the chain (if use_chain)
+  // over the objects of the sorted labels within their union bounding box,
+  // region_indices maps the labels to the regions
+  template<class CHAIN>
+  void accumulate_regions(
+    const vigra::MultiArrayView<N, LabelType>& label_image,
+    const vigra::MultiArrayView<N, DataType>& image,
+    const std::vector<RegionStatistics<N> >& bounds,
+    const std::vector<size_t>::const_iterator labels_begin,
+    const std::vector<size_t>::const_iterator labels_end,
+    const std::vector<LabelType>& region_indices,
+    std::vector<RegionMoments<N> >* moments,
+    const bool use_chain,
+    CHAIN& acc_chain) const;
+  // only the count and the bounding box of the statistics of each label
+  static void get_bounding_boxes(
+    const vigra::MultiArrayView<N, LabelType>& label_image,
+    const size_t label_count,
+    std::vector<RegionStatistics<N> >& bounds);
+  // within the size range and, with "DiscardOutsideFieldOfView", touching
+  // the field of view
+  bool is_object_kept(const RegionStatistics<N>& bounds) const;
+  // activate the used principal axis features
   int select_features(AccChainType& acc_chain) const;
+  // the principal axis features are taken from region region_index of the
+  // accumulators
+  template<class CHAIN>
   int extract_for_label(
-    const AccChainType& acc_chain,
-    const size_t label_id,
-    const int timestep,
-    TraxelVectorType& traxels) const;
-  int fill_feature_map(
-    const AccChainType& acc_chain,
-    const size_t label_id,
-    FeatureMapType& feature_map) const;
-  int get_detection_probability(FeatureMapType& feature_map) const;
+    const CHAIN& acc_chain,
+    const FeatureExtractors<CHAIN>& extractors,
+    const RegionMoments<N>& moments,
+    const size_t region_index,
+    const TableColumns& columns,
+    const size_t row,
+    ObjectFeatureTable& objects) const;
+  int get_detection_probabilities(ObjectFeatureTable& objects) const;
   const std::vector<std::string> feature_selection_;
+  std::vector<bool> feature_used_;
+  // compiled from the feature selection and the used features
+  std::vector<ActivatorType> activators_;
+  bool has_moment_features_;
+  bool has_principal_features_;
+  bool use_presets_;
+  PresetType preset_;
+  FeatureExtractors<AccChainType> extractors_;
+  FeatureExtractors<PrincipalAccChainType> principal_extractors_;
   const RandomForestVectorType& random_forests_;
+  // empty if the vigra forests are used
+  FlatForestVectorType flat_forests_;
   const TrackingOptions& options_;
+  typename vigra::MultiArrayShape<N>::type coordinate_offset_;
   unsigned int max_object_num_;
   unsigned int border_distance_;
   unsigned int lower_size_lim_;
   unsigned int upper_size_lim_;
+  bool discard_outside_;
+  vigra::TinyVector<LabelType, N> field_of_view_min_, field_of_view_max_;
   DataType x_scale_, y_scale_, z_scale_;
 };
 
@@ -87,45 +281,91 @@ class TraxelExtractor {
   Implementation
 =============================================================================*/
 
-template<unsigned int N>
-void fill_coordinate_map(
-  const TraxelVectorType& traxels,
-  const vigra::MultiArray<N, LabelType>& label_image,
+template<int N>
+bool get_coordinate_box(
+  const FeatureMapType& feature_map,
+  vigra::TinyVector<long int, N>& c_min,
+  vigra::TinyVector<long int, N>& c_max)
+{
+  FeatureMapType::const_iterator c_min_it = feature_map.find("CoordMin");
+  FeatureMapType::const_iterator c_max_it = feature_map.find("CoordMax");
+  if (c_min_it == feature_map.end() or c_max_it == feature_map.end()) {
+    return false;
+  }
+  for (int n = 0; n < N; n++) {
+    c_min[n] = static_cast<long int>((c_min_it->second)[n]);
+    c_max[n] = static_cast<long int>((c_max_it->second)[n]) + 1;
+  }
+  return true;
+}
+
+template<int N>
+void fill_merger_coordinate_map(
+  const EventVectorVectorType& events,
+  const std::vector<LabelRuns<N> >& frames,
+  const TraxelStoreType& ts,
+  const size_t timestep_offset,
   CoordinateMapPtrType coordinate_map_ptr)
 {
-  // iterate over all traxels
-  for(const pgmlink::Traxel traxel : traxels) {
-    const FeatureMapType& feature_map = traxel.features;
-    // get the upper left and lower right of this traxel
-    FeatureMapType::const_iterator c_min_it = feature_map.find("CoordMin");
-    FeatureMapType::const_iterator c_max_it = feature_map.find("CoordMax");
-    if (c_min_it == feature_map.end() or c_max_it == feature_map.end()) {
-      throw std::runtime_error(
-        "CoordMin and CoordMax not found in feature map for traxel");
+  typedef typename LabelRuns<N>::ShapeType ShapeType;
+  // the mergers and the index of their frame
+  std::vector<std::pair<size_t, const pgmlink::Traxel*> > mergers;
+  for (size_t t = 0; t < events.size() && t < frames.size(); t++) {
+    const int timestep = t + timestep_offset;
+    for (const pgmlink::Event& event : events[t]) {
+      if (event.type != pgmlink::Event::Merger) {
+        continue;
+      }
+      pgmlink::TraxelStoreByTimeid::const_iterator traxel_it =
+        ts.get<pgmlink::by_timeid>().find(
+          boost::make_tuple(timestep, event.traxel_ids[0]));
+      if (traxel_it == ts.get<pgmlink::by_timeid>().end()) {
+        throw std::runtime_error("Merger not found in traxelstore");
+      }
+      mergers.push_back(std::make_pair(t, &(*traxel_it)));
     }
-    // convert to tiny vectors of long int
-    vigra::TinyVector<long int, int(N)> c_min_vec, c_max_vec;
-    for(size_t n = 0; n < N; n++) {
-      c_min_vec[n] = static_cast<long int>((c_min_it->second)[n]);
-      c_max_vec[n] = static_cast<long int>((c_max_it->second)[n]) + 1;
+  }
+  const std::vector<CoordinateMapPtrType> thread_maps =
+    get_thread_coordinate_maps();
+  // exceptions must not leave the parallel region
+  bool is_valid = true;
+  std::string error_message;
+  #pragma omp parallel for schedule(dynamic) reduction(&&:is_valid)
+  for (size_t i = 0; i < mergers.size(); i++) {
+    try {
+      const pgmlink::Traxel& traxel = *mergers[i].second;
+      vigra::TinyVector<long int, N> c_min_vec, c_max_vec;
+      if (!get_coordinate_box<N>(traxel.features, c_min_vec, c_max_vec)) {
+        throw std::runtime_error(
+          "CoordMin and CoordMax not found in feature map for traxel");
+      }
+      // the labels of the bounding box replace the view on the label image
+      vigra::MultiArray<N, LabelType> labels;
+      frames[mergers[i].first].decode(
+        ShapeType(c_min_vec),
+        ShapeType(c_max_vec),
+        labels);
+      pgmlink::extract_coordinates<N, LabelType>(
+        thread_maps[omp_get_thread_num()],
+        labels,
+        c_min_vec,
+        traxel);
+    } catch (const std::exception& error) {
+      is_valid = false;
+      #pragma omp critical(error_message)
+      {
+        if (error_message.empty()) {
+          error_message = error.what();
+        }
+      }
     }
-    // get a view of this traxel on the label_image
-    vigra::MultiArrayView<N, LabelType> traxel_view = label_image.subarray(
-      c_min_vec,
-      c_max_vec);
-    // extract the coordinates
-    pgmlink::extract_coordinates<N, LabelType>(
-      coordinate_map_ptr,
-      traxel_view,
-      c_min_vec,
-      traxel);
-    // debug
-    TraxelIndexType t_index(traxel.Timestep, traxel.Id);
-    CoordinateMapType::const_iterator cm_it = coordinate_map_ptr->find(t_index);
   }
+  if (!is_valid) {
+    throw std::runtime_error(error_message);
+  }
+  merge_coordinate_maps(thread_maps, coordinate_map_ptr);
 }
 
-
 } // end of namespace isbi_pipeline
 
 #endif // ISBI_TRAXEL_EXTRACTOR
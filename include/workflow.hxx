@@ -28,6 +28,8 @@
 #include "pipeline_helpers.hxx"
 #include "segmentation.hxx"
 #include "traxel_extractor.hxx"
+#include "label_runs.hxx"
+#include "object_index.hxx"
 #include "lineage.hxx"
 #include "division_feature_extractor.hxx"
 
@@ -67,8 +69,10 @@ class Workflow {
   Workflow(bool calculate_segmentation, bool segmentation_dump = false);
   void init(int argc, char* argv[]);
   template<int N> Lineage run();
+  // traxels[i] is the object in row i of objects
   template<int N> void extract_masked_traxels(
       const vigra::MultiArray<N, LabelType> &segmentation,
+      const ObjectFeatureTable& objects,
       const TraxelVectorType& traxels);
   void dump_traxelstore(TraxelStoreType& ts);
 private:
@@ -78,6 +82,7 @@ private:
   TrackingOptions options_;
   // classifier config variables
   StringDataPairVectorType pix_feature_list_;
+  std::vector<FilterBackend> pix_feature_backends_;
   std::vector<std::string> cnt_feature_list_;
   std::vector<std::string> div_feature_list_;
   RandomForestVectorType pix_feature_rfs_;
@@ -106,6 +111,32 @@ Lineage Workflow::run() {
   /*=========================
     Initialization
   =========================*/
+  // skip the features the random forests never look at
+  const bool prune_features = options_.has_option<bool>("PruneUnusedFeatures")
+    && options_.get_option<bool>("PruneUnusedFeatures");
+  if (prune_features) {
+    std::cout << "prune features unused by the random forests" << std::endl;
+  }
+  // process only the field of view (plus the halo) of each frame
+  typedef typename vigra::MultiArrayShape<N>::type ShapeType;
+  bool crop = options_.has_option<bool>("CropToFieldOfView")
+    && options_.get_option<bool>("CropToFieldOfView");
+  if (crop && !calculate_segmentation_) {
+    std::cout << "CropToFieldOfView needs the segmentation to be calculated, "
+      << "process the full frames" << std::endl;
+    crop = false;
+  }
+  ShapeType crop_halo(0);
+  // the prediction cache for threshold sweeps
+  if (options_.has_option<std::string>("PredictionCache")) {
+    const std::string cache = options_.get_option<std::string>("PredictionCache");
+    if (cache.compare("float") && cache.compare("uint8")) {
+      throw std::runtime_error("PredictionCache must be \"float\" or \"uint8\"");
+    }
+  }
+  if (crop && options_.has_option<int>("CropMargin")) {
+    crop_halo = ShapeType(options_.get_option<int>("CropMargin"));
+  }
   // initialize segmentation calculator if necessary
   boost::shared_ptr<SegmentationCalculator<N> > segmentation_calc_ptr;
   if (calculate_segmentation_) {
@@ -115,6 +146,23 @@ Lineage Workflow::run() {
     // create the feature calculator
     boost::shared_ptr<FeatureCalculator<N> > feature_calc_ptr(
       new FeatureCalculator<N>(pix_feature_list_, image_scales));
+    feature_calc_ptr->set_filter_backends(pix_feature_backends_);
+    if (options_.has_option<DataType>("RecursiveFilterThreshold")) {
+      feature_calc_ptr->set_recursive_threshold(
+        options_.get_option<DataType>("RecursiveFilterThreshold"));
+    }
+    if (prune_features) {
+      std::vector<bool> used_channels =
+        get_used_feature_columns(pix_feature_rfs_);
+      feature_calc_ptr->set_used_channels(used_channels);
+      std::cout << "\tpixel features: "
+        << std::count(used_channels.begin(), used_channels.end(), true)
+        << " of " << used_channels.size() << " channels used, calculating "
+        << feature_calc_ptr->get_used_feature_count() << " of "
+        << pix_feature_list_.size() << " filters" << std::endl;
+    }
+    // the features at the crop border must not depend on the cut off pixels
+    crop_halo += feature_calc_ptr->get_support_radius();
     // assign an instance to the segmentation calculator pointer
     segmentation_calc_ptr = boost::make_shared<SegmentationCalculator<N> >(
       feature_calc_ptr, pix_feature_rfs_, options_);
@@ -124,18 +172,55 @@ Lineage Workflow::run() {
     cnt_feature_list_,
     cnt_feature_rfs_,
     options_);
+  if (prune_features and cnt_feature_rfs_.size() > 0) {
+    std::vector<bool> used_columns = get_used_feature_columns(cnt_feature_rfs_);
+    traxel_extractor.set_used_columns(used_columns);
+    std::cout << "\tobject features: "
+      << std::count(used_columns.begin(), used_columns.end(), true)
+      << " of " << used_columns.size() << " columns used, extracting "
+      << traxel_extractor.get_used_feature_count() << " of "
+      << cnt_feature_list_.size() << " features" << std::endl;
+  }
+  if (prune_features and div_feature_rfs_.size() > 0) {
+    // the division features are derived from a few object features and
+    // are always calculated, report only
+    std::vector<bool> used_columns = get_used_feature_columns(div_feature_rfs_);
+    std::cout << "\tdivision features: "
+      << std::count(used_columns.begin(), used_columns.end(), true)
+      << " of " << used_columns.size() << " columns used" << std::endl;
+  }
   // initialize the division feature extractor
   double template_size = options_.get_option<double>("templateSize");
   DivisionFeatureExtractor<N, LabelType> div_feature_extractor(template_size);
-  // initialize the coordinate map
+  const DivisionCascade div_cascade = get_division_cascade(options_);
+  div_feature_extractor.set_cascade(div_cascade);
+  // objects and skipped objects of the division cascade in all frames
+  size_t div_object_count = 0;
+  size_t div_skipped_count = 0;
+  FlatForestVectorType div_flat_rfs;
+  if (use_flat_forests(options_)) {
+    div_flat_rfs = flatten_forests(
+      div_feature_rfs_,
+      use_quantized_forests(options_));
+  }
+  // initialize the coordinate map, it is filled for the mergers only after
+  // tracking. Only ConsTracking with maxObj > 1 resolves mergers.
   CoordinateMapPtrType coordinate_map_ptr(new CoordinateMapType);
+  const size_t first_timestep = options_.get_option<size_t>("time_range_0");
+  const bool resolve_mergers =
+    !options_.get_option<std::string>("tracker").compare("ConsTracking")
+    && options_.get_option<int>("maxObj") > 1;
+  // the label images of the tracked frames as runs
+  std::vector<LabelRuns<N> > merger_frames;
   // initialize the traxelstore
   TraxelStoreType ts;
   /*=========================
     Loop over timesteps
   =========================*/
-  // for segmentation and traxel generation
-  TraxelVectorType traxels_temp[2]; // temporary storage for traxels
+  // for segmentation and traxel generation, the objects become traxels
+  // when they are added to the traxelstore
+  ObjectFeatureTable objects_temp[2]; // temporary storage for the objects
+  TraxelVectorType traxels;
   size_t curr_frame_index = 1;
   size_t prev_frame_index = 0;
   std::vector<PathType>::const_iterator raw_path_it = raw_path_vec_.begin();
@@ -143,6 +228,8 @@ Lineage Workflow::run() {
 
   // memory for the segmentation
   Segmentation<N> segmentation;
+  // labels of the whole frame if cropped
+  vigra::MultiArray<N, LabelType> frame_labels;
 
   for(
     size_t timestep = 0;
@@ -153,26 +240,56 @@ Lineage Workflow::run() {
       break;
 
     std::cout << "processing " << raw_path_it->string() << std::endl;
-    // create references to the traxels of the previous and the
+    // create references to the objects of the previous and the
     // current frame
     std::swap(curr_frame_index, prev_frame_index);
-    TraxelVectorType& traxels_curr_frame = traxels_temp[curr_frame_index];
-    TraxelVectorType& traxels_prev_frame = traxels_temp[prev_frame_index];
+    ObjectFeatureTable& objects_curr_frame = objects_temp[curr_frame_index];
+    ObjectFeatureTable& objects_prev_frame = objects_temp[prev_frame_index];
     // load the raw image
     vigra::MultiArray<N, DataType> raw_image;
     load_multi_array<N>(raw_image, *raw_path_it);
+    // crop to the field of view, the objects keep the coordinates of the
+    // whole frame
+    const ShapeType frame_shape = raw_image.shape();
+    ShapeType crop_min(0), crop_max(frame_shape);
+    if (crop) {
+      get_crop_box<N>(options_, frame_shape, crop_halo, crop_min, crop_max);
+      vigra::MultiArray<N, DataType> cropped_image(
+        raw_image.subarray(crop_min, crop_max));
+      raw_image.swap(cropped_image);
+      traxel_extractor.set_coordinate_offset(crop_min);
+      std::cout << "crop to " << crop_min << " - " << crop_max << std::endl;
+    }
+    // the labels of the whole frame
+    vigra::MultiArray<N, LabelType>& label_image =
+      crop ? frame_labels : segmentation.label_image_;
     
     if (calculate_segmentation_) {
       // calculate the segmentation
       std::cout << "calculate segmentation" << std::endl;
       segmentation_calc_ptr->calculate(raw_image, segmentation);
+      if (crop) {
+        frame_labels.reshape(frame_shape, 0);
+        frame_labels.subarray(crop_min, crop_max) = segmentation.label_image_;
+      }
       // save the segmentation
-      save_multi_array<N>(segmentation.label_image_, *seg_path_it);
+      save_multi_array<N>(label_image, *seg_path_it);
       // save the segmentation as a hdf5
       if (segmentation_dump_) {
         PathType h5_seg_path = fs::change_extension(*seg_path_it, ".h5");
         segmentation.export_hdf5(h5_seg_path.string());
       }
+      // save the foreground for threshold sweeps
+      if (options_.has_option<std::string>("PredictionCache")) {
+        PathType cache_path =
+          fs::change_extension(*seg_path_it, ".prediction.h5");
+        export_prediction_cache<N>(
+          cache_path.string(),
+          segmentation.foreground_,
+          pix_feature_rfs_.size(),
+          !options_.get_option<std::string>("PredictionCache").compare("uint8"),
+          crop_min);
+      }
     } else {
       // load the segmentation from a file
       std::cout << "load labels from " << seg_path_it->string() << std::endl;
@@ -180,17 +297,19 @@ Lineage Workflow::run() {
       LabelType min, max;
       segmentation.label_image_.minmax(&min, &max);
       segmentation.label_count_ = max;
+      segmentation.region_statistics_.clear();
     }
     // extract the traxel if this frame is within the range to be tracked:
     if (timestep < options_.get_option<size_t>("time_range_0")
         || timestep > options_.get_option<size_t>("time_range_1")) {
       // if we jumped over the last frame to track, then we still need to add its traxels to the TS
       if (timestep == 1 + options_.get_option<size_t>("time_range_1")) {
-        for(pgmlink::Traxel& t : traxels_prev_frame) {
+        traxel_extractor.get_traxels(objects_prev_frame, traxels);
+        for(pgmlink::Traxel& t : traxels) {
           pgmlink::add(ts, t);
         }
       }
-      traxels_curr_frame.clear();
+      objects_curr_frame.clear(timestep);
       continue;
     }
 
@@ -199,12 +318,12 @@ Lineage Workflow::run() {
       segmentation,
       raw_image,
       timestep,
-      traxels_curr_frame);
-    // get the coordinate map
-    fill_coordinate_map(
-      traxels_curr_frame,
-      segmentation.label_image_,
-      coordinate_map_ptr);
+      objects_curr_frame);
+    // keep the labels for the coordinates of the mergers
+    if (resolve_mergers) {
+      merger_frames.resize(timestep - first_timestep + 1);
+      merger_frames.back().encode(label_image);
+    }
     // extract the division features
     std::cout << "extract division probabilities" << std::endl;
     // compute division features and add them to the traxelstore if
@@ -212,25 +331,41 @@ Lineage Workflow::run() {
     if(raw_path_it != raw_path_vec_.begin()) {
       if (options_.get_option<bool>("withDivisions")) {
         div_feature_extractor.extract(
-          traxels_prev_frame,
-          traxels_curr_frame,
-          segmentation.label_image_);
+          objects_prev_frame,
+          objects_curr_frame,
+          label_image);
         div_feature_extractor.compute_div_prob(
-          traxels_prev_frame,
+          objects_prev_frame,
           div_feature_list_,
-          div_feature_rfs_);
+          div_feature_rfs_,
+          div_flat_rfs);
+        if (div_cascade.mode != NoDivisionCascade) {
+          const size_t skipped = div_feature_extractor.get_skipped_count();
+          std::cout << "\tdivision cascade: skipped " << skipped << " of "
+            << objects_prev_frame.get_row_count() << " objects" << std::endl;
+          div_object_count += objects_prev_frame.get_row_count();
+          div_skipped_count += skipped;
+        }
       }
       // add the traxels of the previous frame to the traxelstore
-      for(pgmlink::Traxel& t : traxels_prev_frame) {
+      traxel_extractor.get_traxels(objects_prev_frame, traxels);
+      for(pgmlink::Traxel& t : traxels) {
         pgmlink::add(ts, t);
       }
     } else if(has_mask_image_) {
       // for the first frame, if a mask image was specified, get the set of marked traxels
-      extract_masked_traxels<N>(segmentation.label_image_, traxels_curr_frame);
+      traxel_extractor.get_traxels(objects_curr_frame, traxels);
+      extract_masked_traxels<N>(label_image, objects_curr_frame, traxels);
     }
   }
+  if (div_cascade.mode != NoDivisionCascade && div_object_count > 0) {
+    std::cout << "division cascade skip rate: "
+      << 100.0 * div_skipped_count / div_object_count << "% of "
+      << div_object_count << " objects" << std::endl;
+  }
   // add the remaining traxels from the last frame
-  for(pgmlink::Traxel& t : traxels_temp[curr_frame_index]) {
+  traxel_extractor.get_traxels(objects_temp[curr_frame_index], traxels);
+  for(pgmlink::Traxel& t : traxels) {
     pgmlink::add(ts, t);
   }
 
@@ -240,9 +375,29 @@ Lineage Workflow::run() {
   /*=========================
     tracking
   =========================*/
-  // EventVectorVectorType events = track(ts, options_, coordinate_map_ptr, traxels_to_keep_);
-  EventVectorVectorType events = track(ts, options_, coordinate_map_ptr);
-  Lineage lineage(events, options_.get_option<size_t>("time_range_0"));
+  MergerCoordinatesFunctionType fill_merger_coordinates;
+  if (resolve_mergers) {
+    fill_merger_coordinates = [&](
+      const EventVectorVectorType& merger_events,
+      CoordinateMapPtrType merger_coordinate_map_ptr)
+    {
+      fill_merger_coordinate_map<N>(
+        merger_events,
+        merger_frames,
+        ts,
+        first_timestep,
+        merger_coordinate_map_ptr);
+    };
+  }
+  // EventVectorVectorType events = track(ts, options_, coordinate_map_ptr, traxels_to_keep_, fill_merger_coordinates);
+  EventVectorVectorType events = track(
+    ts,
+    options_,
+    coordinate_map_ptr,
+    {},
+    fill_merger_coordinates);
+  std::vector<LabelRuns<N> >().swap(merger_frames);
+  Lineage lineage(events, first_timestep);
   /*========================
     filter events
   ========================*/
@@ -319,29 +474,43 @@ Lineage Workflow::run() {
 template<int N>
 void Workflow::extract_masked_traxels(
     const vigra::MultiArray<N, LabelType>& segmentation,
+    const ObjectFeatureTable& objects,
     const TraxelVectorType& traxels
 )
 {
-  using namespace vigra::multi_math;
   vigra::MultiArray<N, LabelType> mask_image;
   load_multi_array<N>(mask_image, mask_image_file_);
-  // make mask image binary, background has label 0!
-  mask_image = signi(mask_image);
-  // extract part of segmentation that has been masked
-  mask_image = segmentation * mask_image;
-  // find which labels are present
-  std::set<LabelType> masked_labels_in_first_frame =
-      DivisionFeatureExtractor<N, LabelType>::find_unique_labels_in_roi(mask_image);
+  if (mask_image.shape() != segmentation.shape()) {
+    throw std::runtime_error("Shapes of mask image and segmentation differ");
+  }
+  // find which labels are present in the mask, background has label 0!
+  std::vector<bool> is_masked;
+  typename vigra::MultiArray<N, LabelType>::const_iterator m_it =
+    mask_image.begin();
+  typename vigra::MultiArray<N, LabelType>::const_iterator s_it =
+    segmentation.begin();
+  for (; s_it != segmentation.end(); s_it++, m_it++) {
+    if (*m_it != 0 && *s_it != 0) {
+      if (*s_it >= is_masked.size()) {
+        is_masked.resize(*s_it + 1, false);
+      }
+      is_masked[*s_it] = true;
+    }
+  }
+  std::vector<LabelType> masked_labels_in_first_frame;
+  for (size_t label = 1; label < is_masked.size(); label++) {
+    if (is_masked[label]) {
+      masked_labels_in_first_frame.push_back(label);
+    }
+  }
   // find corresponding traxels
+  const ObjectIndex<N> object_index(objects);
   size_t missed_labels = 0;
   for (LabelType label : masked_labels_in_first_frame)
   {
-    auto compare_predicate = [=](const pgmlink::Traxel& t) -> bool {
-      return t.Timestep == 0 && t.Id == label;
-    };
-    TraxelVectorType::const_iterator traxel_it = std::find_if(traxels.begin(), traxels.end(), compare_predicate);
-    if (traxel_it != traxels.end()) {
-      traxels_to_keep_.push_back(*traxel_it);
+    size_t row;
+    if (object_index.find_row(label, row) && traxels[row].Timestep == 0) {
+      traxels_to_keep_.push_back(traxels[row]);
     }
     else {
       std::cout << "Could not find traxel for selected label " << label 
@@ -0,0 +1,456 @@
+// stl
+#include <stdexcept>
+#include <string>
+#include <limits>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+// openmp
+#include <omp.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "connected_components.hxx"
+
+namespace isbi_pipeline {
+
+////
+//// local functions
+////
+namespace {
+
+// mask[x] = values[x * stride] > threshold
+void threshold_row(
+  const DataType* values,
+  const std::ptrdiff_t stride,
+  const size_t size,
+  const DataType threshold,
+  vigra::UInt8* mask)
+{
+  size_t x = 0;
+#ifdef __SSE2__
+  if (stride == 1) {
+    const __m128 thresholds = _mm_set1_ps(threshold);
+    for (; x + 4 <= size; x += 4) {
+      const int bits =
+        _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(values + x), thresholds));
+      mask[x] = bits & 1;
+      mask[x + 1] = (bits >> 1) & 1;
+      mask[x + 2] = (bits >> 2) & 1;
+      mask[x + 3] = (bits >> 3) & 1;
+    }
+  }
+#endif
+  for (; x < size; x++) {
+    mask[x] = values[x * stride] > threshold;
+  }
+}
+
+// union find over the provisional labels, the root of a set is its
+// smallest label
+class LabelForest {
+ public:
+  LabelForest() : parents_(1, 0) {}
+  LabelType make_label() {
+    const size_t label = parents_.size();
+    if (label > std::numeric_limits<LabelType>::max()) {
+      throw std::runtime_error(
+        "connected components: too many labels for LabelType");
+    }
+    parents_.push_back(label);
+    return label;
+  }
+  LabelType find(LabelType label) {
+    LabelType root = label;
+    while (parents_[root] != root) {
+      root = parents_[root];
+    }
+    // path compression
+    while (parents_[label] != root) {
+      const LabelType next = parents_[label];
+      parents_[label] = root;
+      label = next;
+    }
+    return root;
+  }
+  LabelType merge(const LabelType lhs, const LabelType rhs) {
+    const LabelType lhs_root = find(lhs);
+    const LabelType rhs_root = find(rhs);
+    if (lhs_root < rhs_root) {
+      parents_[rhs_root] = lhs_root;
+      return lhs_root;
+    } else {
+      parents_[lhs_root] = rhs_root;
+      return rhs_root;
+    }
+  }
+  // replace the provisional labels by the consecutive final labels in the
+  // order of the roots, returns the number of sets
+  size_t make_contiguous() {
+    size_t count = 0;
+    for (size_t label = 1; label < parents_.size(); label++) {
+      if (parents_[label] == label) {
+        parents_[label] = ++count;
+      } else {
+        // the root is smaller, hence already final
+        parents_[label] = parents_[parents_[label]];
+      }
+    }
+    return count;
+  }
+  LabelType operator[](const LabelType label) const {
+    return parents_[label];
+  }
+ private:
+  std::vector<LabelType> parents_;
+};
+
+// Union find that may be used by many threads at once. Roots are only
+// ever linked to smaller roots with compare and swap, hence the root of a
+// set is its smallest label as in LabelForest.
+class ConcurrentLabelForest {
+ public:
+  ConcurrentLabelForest(const size_t label_count) :
+    parents_(new std::atomic<LabelType>[label_count + 1]),
+    size_(label_count + 1)
+  {
+    for (size_t label = 0; label < size_; label++) {
+      parents_[label].store(label);
+    }
+  }
+  LabelType find(LabelType label) {
+    while (true) {
+      LabelType parent = parents_[label].load();
+      if (parent == label) {
+        return label;
+      }
+      // path halving, fails harmlessly if another thread was faster
+      const LabelType grandparent = parents_[parent].load();
+      parents_[label].compare_exchange_weak(parent, grandparent);
+      label = grandparent;
+    }
+  }
+  void merge(LabelType lhs, LabelType rhs) {
+    while (true) {
+      lhs = find(lhs);
+      rhs = find(rhs);
+      if (lhs == rhs) {
+        return;
+      } else if (lhs > rhs) {
+        std::swap(lhs, rhs);
+      }
+      LabelType expected = rhs;
+      if (parents_[rhs].compare_exchange_strong(expected, lhs)) {
+        return;
+      }
+    }
+  }
+  // only when no other thread uses the forest any more, see LabelForest
+  size_t make_contiguous() {
+    size_t count = 0;
+    for (size_t label = 1; label < size_; label++) {
+      const LabelType parent = parents_[label].load();
+      if (parent == label) {
+        parents_[label].store(++count);
+      } else {
+        parents_[label].store(parents_[parent].load());
+      }
+    }
+    return count;
+  }
+  LabelType operator[](const LabelType label) const {
+    return parents_[label].load();
+  }
+ private:
+  std::unique_ptr<std::atomic<LabelType>[]> parents_;
+  size_t size_;
+};
+
+// label a block of rows sequentially, the labels are consecutive and in
+// scan order. Accumulates the statistics of image if given.
+template<int N>
+size_t label_slab(
+  const vigra::MultiArrayView<N, DataType>& values,
+  const DataType threshold,
+  vigra::MultiArrayView<N, LabelType> labels,
+  const vigra::MultiArrayView<N, DataType>* image,
+  std::vector<RegionStatistics<N> >* statistics)
+{
+  // a 2d image is a volume with one slice
+  const std::ptrdiff_t size_x = values.shape(0);
+  const std::ptrdiff_t size_y = values.shape(1);
+  const std::ptrdiff_t size_z = N == 3 ? values.shape(N - 1) : 1;
+  const std::ptrdiff_t value_stride_z = N == 3 ? values.stride(N - 1) : 0;
+  const std::ptrdiff_t label_stride_z = N == 3 ? labels.stride(N - 1) : 0;
+  std::vector<vigra::UInt8> mask(size_x);
+  LabelForest forest;
+  // statistics per provisional label
+  std::vector<RegionStatistics<N> > provisional_statistics(1);
+  typename RegionStatistics<N>::CoordinateType coordinate(0.0);
+  // rows already labeled that touch the current row, with their x offset
+  // to the neighbors: (y-1, z) and (y-1..y+1, z-1)
+  std::vector<const LabelType*> neighbor_rows;
+  for (std::ptrdiff_t z = 0; z < size_z; z++) {
+    for (std::ptrdiff_t y = 0; y < size_y; y++) {
+      threshold_row(
+        values.data() + y * values.stride(1) + z * value_stride_z,
+        values.stride(0),
+        size_x,
+        threshold,
+        &mask[0]);
+      LabelType* row = labels.data() + y * labels.stride(1) + z * label_stride_z;
+      const std::ptrdiff_t label_stride_x = labels.stride(0);
+      neighbor_rows.clear();
+      if (y > 0) {
+        neighbor_rows.push_back(row - labels.stride(1));
+      }
+      if (z > 0) {
+        for (std::ptrdiff_t dy = -1; dy <= 1; dy++) {
+          if (y + dy >= 0 && y + dy < size_y) {
+            neighbor_rows.push_back(
+              row + dy * labels.stride(1) - label_stride_z);
+          }
+        }
+      }
+      for (std::ptrdiff_t x = 0; x < size_x; x++) {
+        if (!mask[x]) {
+          row[x * label_stride_x] = 0;
+          continue;
+        }
+        LabelType label = 0;
+        if (x > 0) {
+          label = row[(x - 1) * label_stride_x];
+        }
+        const std::ptrdiff_t x_begin = x > 0 ? x - 1 : 0;
+        const std::ptrdiff_t x_end = x + 1 < size_x ? x + 1 : x;
+        for (const LabelType* neighbor_row : neighbor_rows) {
+          for (std::ptrdiff_t nx = x_begin; nx <= x_end; nx++) {
+            const LabelType neighbor = neighbor_row[nx * label_stride_x];
+            if (neighbor == 0 || neighbor == label) {
+              continue;
+            } else if (label == 0) {
+              label = neighbor;
+            } else {
+              label = forest.merge(label, neighbor);
+            }
+          }
+        }
+        if (label == 0) {
+          label = forest.make_label();
+          if (statistics) {
+            provisional_statistics.push_back(RegionStatistics<N>());
+          }
+        }
+        row[x * label_stride_x] = label;
+        if (statistics) {
+          coordinate[0] = x;
+          coordinate[1] = y;
+          if (N == 3) {
+            coordinate[N - 1] = z;
+          }
+          provisional_statistics[label].add(
+            coordinate,
+            image->data()[x * image->stride(0) + y * image->stride(1)
+              + (N == 3 ? z * image->stride(N - 1) : 0)]);
+        }
+      }
+    }
+  }
+  // second pass
+  const size_t count = forest.make_contiguous();
+  for (typename vigra::MultiArrayView<N, LabelType>::iterator it =
+      labels.begin(); it != labels.end(); it++) {
+    *it = forest[*it];
+  }
+  if (statistics) {
+    statistics->assign(count + 1, RegionStatistics<N>());
+    for (size_t label = 1; label < provisional_statistics.size(); label++) {
+      (*statistics)[forest[label]].merge(provisional_statistics[label]);
+    }
+  }
+  return count;
+}
+
+// label_above_threshold, with statistics if image is given
+template<int N>
+size_t label_components(
+  const vigra::MultiArrayView<N, DataType>& values,
+  const DataType threshold,
+  vigra::MultiArrayView<N, LabelType> labels,
+  const vigra::MultiArrayView<N, DataType>* image,
+  std::vector<RegionStatistics<N> >* statistics)
+{
+  typedef typename vigra::MultiArrayShape<N>::type ShapeType;
+  if (values.shape() != labels.shape()
+      || (image && image->shape() != values.shape())) {
+    throw std::runtime_error("connected components: shapes differ");
+  }
+  // slabs along the outermost axis
+  const std::ptrdiff_t outer_size = values.shape(N - 1);
+  const size_t slab_count = std::min<std::ptrdiff_t>(
+    omp_get_max_threads(),
+    outer_size);
+  if (slab_count <= 1) {
+    return label_slab<N>(values, threshold, labels, image, statistics);
+  }
+  std::vector<ShapeType> slab_begins(slab_count), slab_ends(slab_count);
+  for (size_t slab = 0; slab < slab_count; slab++) {
+    slab_begins[slab] = ShapeType(0);
+    slab_begins[slab][N - 1] = slab * outer_size / slab_count;
+    slab_ends[slab] = values.shape();
+    slab_ends[slab][N - 1] = (slab + 1) * outer_size / slab_count;
+  }
+  // label the slabs independently, exceptions must not leave the
+  // parallel region
+  std::vector<size_t> offsets(slab_count + 1, 0);
+  std::vector<std::vector<RegionStatistics<N> > > slab_statistics(slab_count);
+  bool is_valid = true;
+  std::string error_message;
+  #pragma omp parallel for reduction(&&:is_valid)
+  for (size_t slab = 0; slab < slab_count; slab++) {
+    try {
+      const vigra::MultiArrayView<N, DataType> slab_image = image
+        ? image->subarray(slab_begins[slab], slab_ends[slab])
+        : vigra::MultiArrayView<N, DataType>();
+      offsets[slab + 1] = label_slab<N>(
+        values.subarray(slab_begins[slab], slab_ends[slab]),
+        threshold,
+        labels.subarray(slab_begins[slab], slab_ends[slab]),
+        image ? &slab_image : 0,
+        statistics ? &slab_statistics[slab] : 0);
+    } catch (const std::exception& error) {
+      is_valid = false;
+      #pragma omp critical(error_message)
+      {
+        if (error_message.empty()) {
+          error_message = error.what();
+        }
+      }
+    }
+  }
+  if (!is_valid) {
+    throw std::runtime_error(error_message);
+  }
+  // the labels of a slab follow those of the previous slabs, hence the
+  // smallest label of a component is that of its first pixel
+  for (size_t slab = 0; slab < slab_count; slab++) {
+    offsets[slab + 1] += offsets[slab];
+  }
+  if (offsets[slab_count] > std::numeric_limits<LabelType>::max()) {
+    throw std::runtime_error(
+      "connected components: too many labels for LabelType");
+  }
+  // merge the components touching across the slab borders
+  ConcurrentLabelForest forest(offsets[slab_count]);
+  #pragma omp parallel for
+  for (size_t slab = 1; slab < slab_count; slab++) {
+    const vigra::MultiArrayView<N - 1, LabelType, vigra::StridedArrayTag>
+      lower = labels.template bind<N - 1>(slab_begins[slab][N - 1] - 1);
+    const vigra::MultiArrayView<N - 1, LabelType, vigra::StridedArrayTag>
+      upper = labels.template bind<N - 1>(slab_begins[slab][N - 1]);
+    const std::ptrdiff_t size_x = upper.shape(0);
+    const std::ptrdiff_t size_y = N == 3 ? upper.shape(N - 2) : 1;
+    for (std::ptrdiff_t y = 0; y < size_y; y++) {
+      for (std::ptrdiff_t x = 0; x < size_x; x++) {
+        const LabelType label = upper.data()[
+          x * upper.stride(0) + (N == 3 ? y * upper.stride(N - 2) : 0)];
+        if (label == 0) {
+          continue;
+        }
+        // the neighbors in the last plane of the previous slab
+        for (std::ptrdiff_t ny = std::max<std::ptrdiff_t>(y - 1, 0);
+             ny <= std::min(y + 1, size_y - 1); ny++) {
+          for (std::ptrdiff_t nx = std::max<std::ptrdiff_t>(x - 1, 0);
+               nx <= std::min(x + 1, size_x - 1); nx++) {
+            const LabelType neighbor = lower.data()[
+              nx * lower.stride(0) + (N == 3 ? ny * lower.stride(N - 2) : 0)];
+            if (neighbor != 0) {
+              forest.merge(
+                offsets[slab] + label,
+                offsets[slab - 1] + neighbor);
+            }
+          }
+        }
+      }
+    }
+  }
+  const size_t count = forest.make_contiguous();
+  // merge the statistics in the order of the slabs
+  if (statistics) {
+    statistics->assign(count + 1, RegionStatistics<N>());
+    for (size_t slab = 0; slab < slab_count; slab++) {
+      typename RegionStatistics<N>::CoordinateType offset(0.0);
+      offset[N - 1] = slab_begins[slab][N - 1];
+      for (size_t label = 1; label < slab_statistics[slab].size(); label++) {
+        slab_statistics[slab][label].shift(offset);
+        (*statistics)[forest[offsets[slab] + label]].merge(
+          slab_statistics[slab][label]);
+      }
+    }
+  }
+  // final labels
+  #pragma omp parallel for
+  for (size_t slab = 0; slab < slab_count; slab++) {
+    vigra::MultiArrayView<N, LabelType> slab_labels =
+      labels.subarray(slab_begins[slab], slab_ends[slab]);
+    for (typename vigra::MultiArrayView<N, LabelType>::iterator it =
+        slab_labels.begin(); it != slab_labels.end(); it++) {
+      if (*it != 0) {
+        *it = forest[offsets[slab] + *it];
+      }
+    }
+  }
+  return count;
+}
+
+} // end of anonymous namespace
+
+////
+//// label_above_threshold
+////
+template<int N>
+size_t label_above_threshold(
+  const vigra::MultiArrayView<N, DataType>& values,
+  const DataType threshold,
+  vigra::MultiArrayView<N, LabelType> labels)
+{
+  return label_components<N>(values, threshold, labels, 0, 0);
+}
+
+template<int N>
+size_t label_above_threshold(
+  const vigra::MultiArrayView<N, DataType>& values,
+  const DataType threshold,
+  vigra::MultiArrayView<N, LabelType> labels,
+  const vigra::MultiArrayView<N, DataType>& image,
+  std::vector<RegionStatistics<N> >& statistics)
+{
+  return label_components<N>(values, threshold, labels, &image, &statistics);
+}
+
+// explicit instantiation
+template size_t label_above_threshold<2>(
+  const vigra::MultiArrayView<2, DataType>&,
+  const DataType,
+  vigra::MultiArrayView<2, LabelType>);
+template size_t label_above_threshold<3>(
+  const vigra::MultiArrayView<3, DataType>&,
+  const DataType,
+  vigra::MultiArrayView<3, LabelType>);
+template size_t label_above_threshold<2>(
+  const vigra::MultiArrayView<2, DataType>&,
+  const DataType,
+  vigra::MultiArrayView<2, LabelType>,
+  const vigra::MultiArrayView<2, DataType>&,
+  std::vector<RegionStatistics<2> >&);
+template size_t label_above_threshold<3>(
+  const vigra::MultiArrayView<3, DataType>&,
+  const DataType,
+  vigra::MultiArrayView<3, LabelType>,
+  const vigra::MultiArrayView<3, DataType>&,
+  std::vector<RegionStatistics<3> >&);
+
+} // end of namespace isbi_pipeline
@@ -1,5 +1,6 @@
 // stl
 #include <iostream>
+#include <stdexcept>
 
 // own
 #include "division_feature_extractor.hxx"
@@ -7,6 +8,35 @@
 namespace isbi_pipeline 
 {
 
+DivisionCascade::DivisionCascade() :
+	mode(NoDivisionCascade),
+	min_candidate_count(2),
+	min_ratio_count(0.0f),
+	max_ratio_count(std::numeric_limits<float>::max())
+{
+}
+
+DivisionCascade get_division_cascade(const TrackingOptions& options)
+{
+	DivisionCascade cascade;
+	if(!options.has_option<std::string>("DivisionCascade"))
+		return cascade;
+	const std::string mode = options.get_option<std::string>("DivisionCascade");
+	if(!mode.compare("exact"))
+		cascade.mode = ExactDivisionCascade;
+	else if(!mode.compare("bounds"))
+		cascade.mode = BoundsDivisionCascade;
+	else
+		throw std::runtime_error("Unknown division cascade \"" + mode + "\"");
+	if(options.has_option<size_t>("DivisionCandidateCountMin"))
+		cascade.min_candidate_count = options.get_option<size_t>("DivisionCandidateCountMin");
+	if(options.has_option<float>("DivisionRatioCountMin"))
+		cascade.min_ratio_count = options.get_option<float>("DivisionRatioCountMin");
+	if(options.has_option<float>("DivisionRatioCountMax"))
+		cascade.max_ratio_count = options.get_option<float>("DivisionRatioCountMax");
+	return cascade;
+}
+
 std::ostream& operator<<(std::ostream& lhs, const pgmlink::feature_array& rhs)
 {
 	if(rhs.size() == 0)
@@ -0,0 +1,478 @@
+// stl
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "flat_forest.hxx"
+
+namespace isbi_pipeline {
+
+////
+//// local functions
+////
+namespace {
+
+// smallest float that is not smaller than value
+float round_up_to_float(const double value) {
+  float ret = static_cast<float>(value);
+  if (static_cast<double>(ret) < value) {
+    ret = std::nextafter(ret, std::numeric_limits<float>::infinity());
+  }
+  return ret;
+}
+
+// bit i is set if ranks[i] >= rank, for 64 ranks
+#ifdef __SSE2__
+vigra::UInt64 right_mask(const vigra::UInt8* ranks, const vigra::UInt16 rank) {
+  const __m128i threshold = _mm_set1_epi8(static_cast<char>(rank));
+  const __m128i zero = _mm_setzero_si128();
+  vigra::UInt64 mask = 0;
+  for (size_t i = 0; i < 4; i++) {
+    const __m128i values = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(ranks + 16 * i));
+    // the saturated difference is zero iff rank <= value
+    const __m128i is_right =
+      _mm_cmpeq_epi8(_mm_subs_epu8(threshold, values), zero);
+    mask |= static_cast<vigra::UInt64>(_mm_movemask_epi8(is_right)) << (16 * i);
+  }
+  return mask;
+}
+
+vigra::UInt64 right_mask(const vigra::UInt16* ranks, const vigra::UInt16 rank) {
+  const __m128i threshold = _mm_set1_epi16(static_cast<short>(rank));
+  const __m128i zero = _mm_setzero_si128();
+  vigra::UInt64 mask = 0;
+  for (size_t i = 0; i < 4; i++) {
+    const __m128i low = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(ranks + 16 * i));
+    const __m128i high = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(ranks + 16 * i + 8));
+    // pack the 16 bit masks (0 or -1) to bytes
+    const __m128i is_right = _mm_packs_epi16(
+      _mm_cmpeq_epi16(_mm_subs_epu16(threshold, low), zero),
+      _mm_cmpeq_epi16(_mm_subs_epu16(threshold, high), zero));
+    mask |= static_cast<vigra::UInt64>(_mm_movemask_epi8(is_right)) << (16 * i);
+  }
+  return mask;
+}
+#else
+template<typename RankType>
+vigra::UInt64 right_mask(const RankType* ranks, const vigra::UInt16 rank) {
+  vigra::UInt64 mask = 0;
+  for (size_t i = 0; i < 64; i++) {
+    mask |= static_cast<vigra::UInt64>(ranks[i] >= rank) << i;
+  }
+  return mask;
+}
+#endif
+
+// the rank buffer of scratch for the rank type
+std::vector<vigra::UInt8>& rank_buffer(
+  FlatForest::Scratch& scratch,
+  const vigra::UInt8)
+{
+  return scratch.ranks8;
+}
+
+std::vector<vigra::UInt16>& rank_buffer(
+  FlatForest::Scratch& scratch,
+  const vigra::UInt16)
+{
+  return scratch.ranks16;
+}
+
+} // end of anonymous namespace
+
+////
+//// class FlatForest
+////
+FlatForest::FlatForest() :
+  class_count_(0),
+  column_count_(0),
+  rank_size_(0)
+{
+}
+
+FlatForest::FlatForest(const RandomForestType& random_forest) :
+  class_count_(random_forest.ext_param_.class_count_),
+  column_count_(random_forest.ext_param_.column_count_),
+  rank_size_(0)
+{
+  if (!is_supported(random_forest)) {
+    throw std::runtime_error("FlatForest: unsupported node type in forest");
+  }
+  // same weighting of the leaf probabilities as vigra
+  const int weighted = random_forest.options_.predict_weighted_;
+  for (int tree = 0; tree < random_forest.options_.tree_count_; tree++) {
+    const vigra::ArrayVector<vigra::Int32>& topology =
+      random_forest.trees_[tree].topology_;
+    const vigra::ArrayVector<double>& parameters =
+      random_forest.trees_[tree].parameters_;
+    // breadth first, siblings are always stored next to each other
+    roots_.push_back(columns_.size());
+    std::deque<vigra::Int32> queue(1, 2);
+    columns_.push_back(0);
+    thresholds_.push_back(0.0f);
+    next_.push_back(0);
+    for (size_t flat_index = roots_.back(); !queue.empty(); flat_index++) {
+      const vigra::Int32 index = queue.front();
+      queue.pop_front();
+      vigra::NodeBase node(topology, parameters, index);
+      if (node.typeID() & vigra::LeafNodeTag) {
+        vigra::Node<vigra::e_ConstProbNode> leaf(topology, parameters, index);
+        columns_[flat_index] = -1;
+        next_[flat_index] = leaf_weights_.size();
+        for (size_t l = 0; l < class_count_; l++) {
+          double weight = leaf.prob_begin()[l]
+            * (weighted * leaf.prob_begin()[-1] + (1 - weighted));
+          leaf_weights_.push_back(weight);
+        }
+      } else {
+        vigra::Node<vigra::i_ThresholdNode> split(topology, parameters, index);
+        columns_[flat_index] = split.column();
+        thresholds_[flat_index] = round_up_to_float(split.threshold());
+        next_[flat_index] = columns_.size();
+        for (size_t child = 0; child < 2; child++) {
+          queue.push_back(split.child(child));
+          columns_.push_back(0);
+          thresholds_.push_back(0.0f);
+          next_.push_back(0);
+        }
+      }
+    }
+  }
+}
+
+bool FlatForest::is_supported(const RandomForestType& random_forest) {
+  for (size_t tree = 0; tree < random_forest.trees_.size(); tree++) {
+    const vigra::ArrayVector<vigra::Int32>& topology =
+      random_forest.trees_[tree].topology_;
+    const vigra::ArrayVector<double>& parameters =
+      random_forest.trees_[tree].parameters_;
+    std::vector<vigra::Int32> node_stack(1, 2);
+    while (!node_stack.empty()) {
+      vigra::NodeBase node(topology, parameters, node_stack.back());
+      node_stack.pop_back();
+      if (node.typeID() == vigra::e_ConstProbNode) {
+        continue;
+      } else if (node.typeID() != vigra::i_ThresholdNode) {
+        return false;
+      }
+      node_stack.push_back(node.child(0));
+      node_stack.push_back(node.child(1));
+    }
+  }
+  return random_forest.options_.tree_count_
+    <= static_cast<int>(random_forest.trees_.size());
+}
+
+size_t FlatForest::get_class_count() const {
+  return class_count_;
+}
+
+size_t FlatForest::get_column_count() const {
+  return column_count_;
+}
+
+size_t FlatForest::get_node_count() const {
+  return columns_.size();
+}
+
+bool FlatForest::quantize() {
+  // collect the distinct thresholds of each column
+  std::vector<std::vector<float> > thresholds(column_count_);
+  for (size_t node = 0; node < columns_.size(); node++) {
+    if (columns_[node] >= 0) {
+      thresholds[columns_[node]].push_back(thresholds_[node]);
+    }
+  }
+  size_t max_rank = 0;
+  for (std::vector<float>& column : thresholds) {
+    std::sort(column.begin(), column.end());
+    column.erase(std::unique(column.begin(), column.end()), column.end());
+    max_rank = std::max(max_rank, column.size());
+  }
+  if (max_rank > std::numeric_limits<vigra::UInt16>::max()) {
+    return false;
+  }
+  column_offsets_.assign(1, 0);
+  column_thresholds_.clear();
+  used_columns_.clear();
+  for (size_t column = 0; column < column_count_; column++) {
+    column_thresholds_.insert(
+      column_thresholds_.end(),
+      thresholds[column].begin(),
+      thresholds[column].end());
+    column_offsets_.push_back(column_thresholds_.size());
+    if (!thresholds[column].empty()) {
+      used_columns_.push_back(column);
+    }
+  }
+  // feature < threshold[k] iff (thresholds <= feature) <= k
+  ranks_.assign(columns_.size(), 0);
+  for (size_t node = 0; node < columns_.size(); node++) {
+    if (columns_[node] >= 0) {
+      const std::vector<float>& column = thresholds[columns_[node]];
+      ranks_[node] = 1 + std::lower_bound(
+        column.begin(),
+        column.end(),
+        thresholds_[node]) - column.begin();
+    }
+  }
+  rank_size_ = max_rank < std::numeric_limits<vigra::UInt8>::max() ? 1 : 2;
+  return true;
+}
+
+size_t FlatForest::get_rank_size() const {
+  return rank_size_;
+}
+
+void FlatForest::predict_block(
+  const vigra::MultiArrayView<2, DataType>& features,
+  const size_t row_begin,
+  const size_t row_end,
+  vigra::MultiArrayView<2, DataType>& probabilities,
+  Scratch& scratch) const
+{
+  const size_t row_count = row_end - row_begin;
+  const DataType* feature_ptr = features.data() + row_begin * features.stride(0);
+  const std::ptrdiff_t row_stride = features.stride(0);
+  const std::ptrdiff_t column_stride = features.stride(1);
+  // rows containing NaN are not classified
+  bool contains_nan[block_size];
+  for (size_t row = 0; row < row_count; row++) {
+    contains_nan[row] = false;
+    for (int column = 0; column < features.shape(1); column++) {
+      const DataType value =
+        feature_ptr[row * row_stride + column * column_stride];
+      contains_nan[row] = contains_nan[row] || std::isnan(value);
+    }
+  }
+  // accumulators with the precision vigra uses
+  DataType* votes = scratch.votes.data();
+  std::fill(votes, votes + block_size * class_count_, 0.0f);
+  double total_weights[block_size];
+  std::fill(total_weights, total_weights + block_size, 0.0);
+  vigra::Int32 nodes[block_size];
+  for (size_t tree = 0; tree < roots_.size(); tree++) {
+    std::fill(nodes, nodes + row_count, roots_[tree]);
+    // advance all rows by one level until all have reached a leaf
+    bool all_leaves = false;
+    while (!all_leaves) {
+      all_leaves = true;
+      for (size_t row = 0; row < row_count; row++) {
+        const vigra::Int32 node = nodes[row];
+        const vigra::Int32 column = columns_[node];
+        if (column >= 0) {
+          const DataType value =
+            feature_ptr[row * row_stride + column * column_stride];
+          nodes[row] = next_[node] + !(value < thresholds_[node]);
+          all_leaves = false;
+        }
+      }
+    }
+    for (size_t row = 0; row < row_count; row++) {
+      const double* weights = &leaf_weights_[next_[nodes[row]]];
+      DataType* row_votes = &votes[row * class_count_];
+      for (size_t l = 0; l < class_count_; l++) {
+        row_votes[l] += static_cast<DataType>(weights[l]);
+        total_weights[row] += weights[l];
+      }
+    }
+  }
+  for (size_t row = 0; row < row_count; row++) {
+    for (size_t l = 0; l < class_count_; l++) {
+      if (contains_nan[row]) {
+        probabilities(row_begin + row, l) = 0.0f;
+      } else {
+        probabilities(row_begin + row, l) = votes[row * class_count_ + l]
+          / static_cast<DataType>(total_weights[row]);
+      }
+    }
+  }
+}
+
+template<typename RankType>
+void FlatForest::predict_block_quantized(
+  const vigra::MultiArrayView<2, DataType>& features,
+  const size_t row_begin,
+  const size_t row_end,
+  vigra::MultiArrayView<2, DataType>& probabilities,
+  Scratch& scratch) const
+{
+  const size_t row_count = row_end - row_begin;
+  // the ranks of the used columns, block_size rows per column. Rows after
+  // row_count keep stale ranks, they are not in any mask.
+  std::vector<RankType>& ranks = rank_buffer(scratch, RankType());
+  bool contains_nan[block_size];
+  std::fill(contains_nan, contains_nan + block_size, false);
+  for (size_t row = 0; row < row_count; row++) {
+    for (int column = 0; column < features.shape(1); column++) {
+      contains_nan[row] = contains_nan[row]
+        || std::isnan(features(row_begin + row, column));
+    }
+  }
+  for (const vigra::Int32 column : used_columns_) {
+    const float* begin = &column_thresholds_[column_offsets_[column]];
+    const float* end = &column_thresholds_[0] + column_offsets_[column + 1];
+    for (size_t row = 0; row < row_count; row++) {
+      ranks[column * block_size + row] = std::upper_bound(
+        begin,
+        end,
+        features(row_begin + row, column)) - begin;
+    }
+  }
+  // accumulators with the precision vigra uses
+  DataType* votes = scratch.votes.data();
+  std::fill(votes, votes + block_size * class_count_, 0.0f);
+  double total_weights[block_size];
+  std::fill(total_weights, total_weights + block_size, 0.0);
+  // the rows that reach a node, the nodes of a tree are in breadth first
+  // order, hence a parent is done before its children
+  std::vector<vigra::UInt64>& masks = scratch.masks;
+  const vigra::UInt64 all_rows = row_count == block_size
+    ? ~vigra::UInt64(0) : (vigra::UInt64(1) << row_count) - 1;
+  for (size_t tree = 0; tree < roots_.size(); tree++) {
+    const size_t root = roots_[tree];
+    const size_t end = tree + 1 < roots_.size()
+      ? roots_[tree + 1] : columns_.size();
+    masks.assign(end - root, 0);
+    masks[0] = all_rows;
+    for (size_t node = root; node < end; node++) {
+      vigra::UInt64 mask = masks[node - root];
+      if (mask == 0) {
+        continue;
+      }
+      const vigra::Int32 column = columns_[node];
+      if (column >= 0) {
+        const vigra::UInt64 right =
+          right_mask(&ranks[column * block_size], ranks_[node]);
+        masks[next_[node] - root] = mask & ~right;
+        masks[next_[node] + 1 - root] = mask & right;
+      } else {
+        const double* weights = &leaf_weights_[next_[node]];
+        while (mask != 0) {
+          const size_t row = __builtin_ctzll(mask);
+          mask &= mask - 1;
+          DataType* row_votes = &votes[row * class_count_];
+          for (size_t l = 0; l < class_count_; l++) {
+            row_votes[l] += static_cast<DataType>(weights[l]);
+            total_weights[row] += weights[l];
+          }
+        }
+      }
+    }
+  }
+  for (size_t row = 0; row < row_count; row++) {
+    for (size_t l = 0; l < class_count_; l++) {
+      if (contains_nan[row]) {
+        probabilities(row_begin + row, l) = 0.0f;
+      } else {
+        probabilities(row_begin + row, l) = votes[row * class_count_ + l]
+          / static_cast<DataType>(total_weights[row]);
+      }
+    }
+  }
+}
+
+void FlatForest::predict_probabilities(
+  const vigra::MultiArrayView<2, DataType>& features,
+  vigra::MultiArrayView<2, DataType> probabilities) const
+{
+  Scratch scratch;
+  predict_probabilities(features, probabilities, scratch);
+}
+
+void FlatForest::predict_probabilities(
+  const vigra::MultiArrayView<2, DataType>& features,
+  vigra::MultiArrayView<2, DataType> probabilities,
+  Scratch& scratch) const
+{
+  if (features.shape(0) != probabilities.shape(0)) {
+    throw std::runtime_error("FlatForest: row counts of features and "
+      "probabilities differ");
+  }
+  if (features.shape(1) < static_cast<int>(column_count_)) {
+    throw std::runtime_error("FlatForest: too few feature columns");
+  }
+  if (probabilities.shape(1) != static_cast<int>(class_count_)) {
+    throw std::runtime_error("FlatForest: wrong number of classes");
+  }
+  if (scratch.votes.size() < block_size * class_count_) {
+    scratch.votes.resize(block_size * class_count_);
+  }
+  std::vector<vigra::UInt8>& ranks8 = scratch.ranks8;
+  std::vector<vigra::UInt16>& ranks16 = scratch.ranks16;
+  if (rank_size_ == 1 && ranks8.size() < column_count_ * block_size) {
+    ranks8.resize(column_count_ * block_size);
+  } else if (rank_size_ == 2 && ranks16.size() < column_count_ * block_size) {
+    ranks16.resize(column_count_ * block_size);
+  }
+  const size_t row_count = features.shape(0);
+  for (size_t row = 0; row < row_count; row += block_size) {
+    const size_t row_end = std::min<size_t>(row + block_size, row_count);
+    if (rank_size_ == 1) {
+      predict_block_quantized<vigra::UInt8>(
+        features, row, row_end, probabilities, scratch);
+    } else if (rank_size_ == 2) {
+      predict_block_quantized<vigra::UInt16>(
+        features, row, row_end, probabilities, scratch);
+    } else {
+      predict_block(features, row, row_end, probabilities, scratch);
+    }
+  }
+}
+
+////
+//// flatten_forests
+////
+FlatForestVectorType flatten_forests(
+  const RandomForestVectorType& rfs,
+  const bool quantize)
+{
+  FlatForestVectorType flat_forests;
+  for (const RandomForestType& rf : rfs) {
+    if (!FlatForest::is_supported(rf)) {
+      return FlatForestVectorType();
+    }
+    flat_forests.push_back(FlatForest(rf));
+    if (quantize) {
+      flat_forests.back().quantize();
+    }
+  }
+  return flat_forests;
+}
+
+////
+//// use_flat_forests
+////
+bool use_flat_forests(const TrackingOptions& options) {
+  if (!options.has_option<std::string>("ForestBackend")) {
+    return false;
+  }
+  const std::string backend = options.get_option<std::string>("ForestBackend");
+  if (!backend.compare("vigra")) {
+    return false;
+  } else if (!backend.compare("flat") || !backend.compare("quantized")) {
+    return true;
+  } else {
+    throw std::runtime_error("Unknown forest backend \"" + backend + "\"");
+  }
+}
+
+////
+//// use_quantized_forests
+////
+bool use_quantized_forests(const TrackingOptions& options) {
+  return use_flat_forests(options)
+    && options.has_option<std::string>("ForestBackend")
+    && !options.get_option<std::string>("ForestBackend").compare("quantized");
+}
+
+} // end of namespace isbi_pipeline
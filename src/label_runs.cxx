@@ -0,0 +1,107 @@
+// stl
+#include <algorithm>
+#include <stdexcept>
+
+#include "label_runs.hxx"
+
+namespace isbi_pipeline {
+
+////
+//// class LabelRuns
+////
+template<int N>
+LabelRuns<N>::LabelRuns() : shape_(0), row_begins_(1, 0) {
+}
+
+template<int N>
+void LabelRuns<N>::encode(
+  const vigra::MultiArrayView<N, LabelType>& label_image)
+{
+  shape_ = label_image.shape();
+  runs_.clear();
+  row_begins_.assign(1, 0);
+  if (label_image.size() == 0) {
+    return;
+  }
+  const size_t row_count = label_image.size() / shape_[0];
+  const std::ptrdiff_t stride = label_image.stride(0);
+  row_begins_.reserve(row_count + 1);
+  // the rows in the order of get_row
+  ShapeType position(0);
+  for (size_t row = 0; row < row_count; row++) {
+    const LabelType* labels = &label_image[position];
+    std::ptrdiff_t x = 0;
+    while (x < shape_[0]) {
+      const LabelType label = labels[x * stride];
+      std::ptrdiff_t run_end = x + 1;
+      while (run_end < shape_[0] && labels[run_end * stride] == label) {
+        run_end++;
+      }
+      if (label != 0) {
+        Run run;
+        run.begin_ = x;
+        run.end_ = run_end;
+        run.label_ = label;
+        runs_.push_back(run);
+      }
+      x = run_end;
+    }
+    row_begins_.push_back(runs_.size());
+    for (int n = 1; n < N; n++) {
+      if (++position[n] < shape_[n]) {
+        break;
+      }
+      position[n] = 0;
+    }
+  }
+}
+
+template<int N>
+void LabelRuns<N>::decode(
+  const ShapeType& box_min,
+  const ShapeType& box_max,
+  vigra::MultiArray<N, LabelType>& labels) const
+{
+  for (int n = 0; n < N; n++) {
+    if (box_min[n] < 0 || box_min[n] > box_max[n] || box_max[n] > shape_[n]) {
+      throw std::runtime_error("Box is not inside the encoded label image");
+    }
+  }
+  labels.reshape(box_max - box_min, 0);
+  if (labels.size() == 0) {
+    return;
+  }
+  const size_t row_count = labels.size() / labels.shape(0);
+  ShapeType position(0);
+  for (size_t row = 0; row < row_count; row++) {
+    const size_t image_row = get_row(box_min + position);
+    // labels is unstrided, a row is contiguous
+    LabelType* box_labels = &labels[position];
+    for (size_t r = row_begins_[image_row]; r < row_begins_[image_row + 1]; r++) {
+      const Run& run = runs_[r];
+      if (run.begin_ >= box_max[0]) {
+        break;
+      }
+      if (run.end_ > box_min[0]) {
+        std::fill(
+          box_labels
+            + (std::max<std::ptrdiff_t>(run.begin_, box_min[0]) - box_min[0]),
+          box_labels
+            + (std::min<std::ptrdiff_t>(run.end_, box_max[0]) - box_min[0]),
+          run.label_);
+      }
+    }
+    for (int n = 1; n < N; n++) {
+      if (++position[n] < labels.shape(n)) {
+        break;
+      }
+      position[n] = 0;
+    }
+  }
+}
+
+// explicit instantiation
+template class LabelRuns<2>;
+template class LabelRuns<3>;
+
+} // end of namespace isbi_pipeline
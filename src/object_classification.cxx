@@ -0,0 +1,140 @@
+// stl
+#include <stdexcept>
+#include <algorithm>
+
+#include "object_classification.hxx"
+
+namespace isbi_pipeline {
+
+////
+//// get_feature_matrix
+////
+void get_feature_matrix(
+  const TraxelVectorType& traxels,
+  const std::vector<std::string>& feature_selection,
+  vigra::MultiArray<2, FeatureType>& features)
+{
+  if (traxels.empty()) {
+    features.reshape(vigra::Shape2(0, 0));
+    return;
+  }
+  // the feature sizes are taken from the first traxel
+  std::vector<size_t> feature_sizes;
+  size_t feature_size = 0;
+  for (const std::string& feature : feature_selection) {
+    FeatureMapType::const_iterator f_it = traxels[0].features.find(feature);
+    if (f_it == traxels[0].features.end()) {
+      throw std::runtime_error("Feature \"" + feature + "\" not found");
+    }
+    feature_sizes.push_back((f_it->second).size());
+    feature_size += (f_it->second).size();
+  }
+  features.reshape(vigra::Shape2(traxels.size(), feature_size));
+  // exceptions must not leave the parallel region
+  bool is_valid = true;
+  #pragma omp parallel for reduction(&&:is_valid)
+  for (size_t row = 0; row < traxels.size(); row++) {
+    const FeatureMapType& feature_map = traxels[row].features;
+    size_t offset = 0;
+    for (size_t i = 0; i < feature_selection.size(); i++) {
+      FeatureMapType::const_iterator f_it =
+        feature_map.find(feature_selection[i]);
+      if (f_it == feature_map.end()
+          || (f_it->second).size() != feature_sizes[i]) {
+        is_valid = false;
+        break;
+      }
+      for (size_t k = 0; k < feature_sizes[i]; k++) {
+        features(row, offset++) = (f_it->second)[k];
+      }
+    }
+  }
+  if (!is_valid) {
+    throw std::runtime_error("Feature not found or size differs for a traxel");
+  }
+}
+
+void get_feature_matrix(
+  const ObjectFeatureTable& objects,
+  const std::vector<std::string>& feature_selection,
+  vigra::MultiArray<2, FeatureType>& features)
+{
+  std::vector<ObjectFeatureTable::FeatureId> feature_ids;
+  size_t feature_size = 0;
+  for (const std::string& feature : feature_selection) {
+    feature_ids.push_back(objects.get_feature_id(feature));
+    feature_size += objects.get_feature_size(feature_ids.back());
+  }
+  features.reshape(vigra::Shape2(objects.get_row_count(), feature_size));
+  #pragma omp parallel for
+  for (size_t row = 0; row < objects.get_row_count(); row++) {
+    size_t offset = 0;
+    for (ObjectFeatureTable::FeatureId feature : feature_ids) {
+      const FeatureType* values = objects.get(feature, row);
+      for (size_t k = 0; k < objects.get_feature_size(feature); k++) {
+        features(row, offset++) = values[k];
+      }
+    }
+  }
+}
+
+////
+//// predict_forest_probabilities
+////
+void predict_forest_probabilities(
+  const RandomForestVectorType& random_forests,
+  const FlatForestVectorType& flat_forests,
+  const vigra::MultiArray<2, FeatureType>& features,
+  vigra::MultiArray<2, FeatureType>& probabilities)
+{
+  if (random_forests.empty()) {
+    throw std::runtime_error("Cannot predict probabilities without RF");
+  }
+  const size_t row_count = features.shape(0);
+  const size_t class_count = random_forests[0].ext_param_.class_count_;
+  const size_t forest_count = random_forests.size();
+  probabilities.reshape(vigra::Shape2(row_count, class_count), 0.0);
+  if (row_count == 0) {
+    return;
+  }
+  // check here since exceptions must not leave the parallel region
+  for (size_t n = 0; n < forest_count; n++) {
+    if (features.shape(1) < random_forests[n].ext_param_.column_count_
+        || static_cast<size_t>(random_forests[n].ext_param_.class_count_)
+          != class_count) {
+      throw std::runtime_error("Features or classes do not fit the RF");
+    }
+  }
+  // one task per forest and block of rows
+  const size_t block_size = 256;
+  const size_t block_count = (row_count + block_size - 1) / block_size;
+  std::vector<vigra::MultiArray<2, FeatureType> > forest_probabilities(
+    forest_count,
+    vigra::MultiArray<2, FeatureType>(vigra::Shape2(row_count, class_count)));
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t task = 0; task < forest_count * block_count; task++) {
+    const size_t n = task / block_count;
+    const size_t row_begin = (task % block_count) * block_size;
+    const size_t row_end = std::min(row_begin + block_size, row_count);
+    vigra::MultiArrayView<2, FeatureType> features_view = features.subarray(
+      vigra::Shape2(row_begin, 0),
+      vigra::Shape2(row_end, features.shape(1)));
+    vigra::MultiArrayView<2, FeatureType> probabilities_view =
+      forest_probabilities[n].subarray(
+        vigra::Shape2(row_begin, 0),
+        vigra::Shape2(row_end, class_count));
+    if (flat_forests.empty()) {
+      random_forests[n].predictProbabilities(
+        features_view,
+        probabilities_view);
+    } else {
+      flat_forests[n].predict_probabilities(features_view, probabilities_view);
+    }
+  }
+  // sum up in the order of the forests
+  for (size_t n = 0; n < forest_count; n++) {
+    probabilities += forest_probabilities[n];
+  }
+}
+
+} // end of namespace isbi_pipeline
@@ -0,0 +1,136 @@
+// stl
+#include <stdexcept>
+#include <algorithm>
+
+#include "object_feature_table.hxx"
+
+namespace isbi_pipeline {
+
+////
+//// class ObjectFeatureTable
+////
+ObjectFeatureTable::ObjectFeatureTable() : timestep_(0) {
+}
+
+void ObjectFeatureTable::clear(const int timestep) {
+  timestep_ = timestep;
+  labels_.clear();
+  for (FeatureId feature = 0; feature < columns_.size(); feature++) {
+    columns_[feature].clear();
+    feature_set_[feature] = false;
+  }
+}
+
+ObjectFeatureTable::FeatureId ObjectFeatureTable::add_feature(
+  const std::string& name,
+  const size_t size)
+{
+  std::map<std::string, FeatureId>::const_iterator id_it =
+    feature_ids_.find(name);
+  if (id_it != feature_ids_.end()) {
+    if (feature_sizes_[id_it->second] != size) {
+      throw std::runtime_error("Size of feature \"" + name + "\" differs");
+    }
+    const FeatureId feature = id_it->second;
+    if (!feature_set_[feature]) {
+      columns_[feature].assign(labels_.size() * size, 0.0);
+      feature_set_[feature] = true;
+    }
+    return feature;
+  }
+  const FeatureId feature = feature_names_.size();
+  feature_ids_[name] = feature;
+  feature_names_.push_back(name);
+  feature_sizes_.push_back(size);
+  feature_set_.push_back(true);
+  columns_.push_back(std::vector<FeatureType>(labels_.size() * size, 0.0));
+  return feature;
+}
+
+bool ObjectFeatureTable::has_feature(const std::string& name) const {
+  std::map<std::string, FeatureId>::const_iterator id_it =
+    feature_ids_.find(name);
+  return id_it != feature_ids_.end() && feature_set_[id_it->second];
+}
+
+ObjectFeatureTable::FeatureId ObjectFeatureTable::get_feature_id(
+  const std::string& name) const
+{
+  std::map<std::string, FeatureId>::const_iterator id_it =
+    feature_ids_.find(name);
+  if (id_it == feature_ids_.end() || !feature_set_[id_it->second]) {
+    throw std::runtime_error("Feature \"" + name + "\" not found");
+  }
+  return id_it->second;
+}
+
+const std::string& ObjectFeatureTable::get_feature_name(
+  const FeatureId feature) const
+{
+  return feature_names_[feature];
+}
+
+size_t ObjectFeatureTable::add_row(const LabelType label) {
+  labels_.push_back(label);
+  for (FeatureId feature = 0; feature < columns_.size(); feature++) {
+    if (feature_set_[feature]) {
+      columns_[feature].resize(labels_.size() * feature_sizes_[feature], 0.0);
+    }
+  }
+  return labels_.size() - 1;
+}
+
+void ObjectFeatureTable::get_traxels(
+  TraxelVectorType& traxels,
+  const DataType x_scale,
+  const DataType y_scale,
+  const DataType z_scale) const
+{
+  traxels.clear();
+  traxels.reserve(labels_.size());
+  for (size_t row = 0; row < labels_.size(); row++) {
+    // Its ok to use "new" since the Traxel class handles the
+    // destruction of the locator
+    typedef pgmlink::ComLocator LocatorType;
+    LocatorType* l_ptr = new LocatorType;
+    l_ptr->x_scale = x_scale;
+    l_ptr->y_scale = y_scale;
+    l_ptr->z_scale = z_scale;
+    traxels.push_back(
+      pgmlink::Traxel(labels_[row], timestep_, FeatureMapType(), l_ptr));
+  }
+  fill_feature_maps(traxels);
+}
+
+void ObjectFeatureTable::fill_feature_maps(TraxelVectorType& traxels) const {
+  if (traxels.size() != labels_.size()) {
+    throw std::runtime_error("Number of traxels and rows differ");
+  }
+  #pragma omp parallel for
+  for (size_t row = 0; row < labels_.size(); row++) {
+    FeatureMapType& feature_map = traxels[row].features;
+    for (FeatureId feature = 0; feature < columns_.size(); feature++) {
+      if (!feature_set_[feature]) {
+        continue;
+      }
+      const FeatureType* values = get(feature, row);
+      feature_map[feature_names_[feature]].assign(
+        values,
+        values + feature_sizes_[feature]);
+    }
+  }
+}
+
+void ObjectFeatureTable::add_traxels(const TraxelVectorType& traxels) {
+  for (const pgmlink::Traxel& traxel : traxels) {
+    const size_t row = add_row(traxel.Id);
+    for (FeatureMapType::const_iterator f_it = traxel.features.begin();
+         f_it != traxel.features.end();
+         f_it++) {
+      const FeatureId feature = add_feature(f_it->first, f_it->second.size());
+      std::copy(f_it->second.begin(), f_it->second.end(), get(feature, row));
+    }
+  }
+}
+
+} // end of namespace isbi_pipeline
@@ -0,0 +1,123 @@
+// stl
+#include <algorithm>
+
+#include "object_index.hxx"
+
+namespace isbi_pipeline {
+
+////
+//// class ObjectIndex
+////
+template<int N>
+ObjectIndex<N>::ObjectIndex(const ObjectFeatureTable& objects) :
+  cell_size_(0),
+  grid_shape_(0)
+{
+  const size_t row_count = objects.get_row_count();
+  labels_.resize(row_count);
+  for (size_t row = 0; row < row_count; row++) {
+    const LabelType label = objects.get_label(row);
+    labels_[row] = label;
+    if (label >= rows_by_label_.size()) {
+      rows_by_label_.resize(label + 1, 0);
+    }
+    if (rows_by_label_[label] == 0) {
+      rows_by_label_[label] = row + 1;
+    }
+  }
+  if (!objects.has_feature("CoordMin") || !objects.has_feature("CoordMax")) {
+    return;
+  }
+  const ObjectFeatureTable::FeatureId c_min_id =
+    objects.get_feature_id("CoordMin");
+  const ObjectFeatureTable::FeatureId c_max_id =
+    objects.get_feature_id("CoordMax");
+  box_mins_.resize(row_count);
+  box_maxs_.resize(row_count);
+  for (size_t row = 0; row < row_count; row++) {
+    const FeatureType* c_min = objects.get(c_min_id, row);
+    const FeatureType* c_max = objects.get(c_max_id, row);
+    for (int n = 0; n < N; n++) {
+      box_mins_[row][n] = static_cast<long int>(c_min[n]);
+      box_maxs_[row][n] = static_cast<long int>(c_max[n]) + 1;
+    }
+  }
+}
+
+template<int N>
+void ObjectIndex<N>::build_grid(const ShapeType& shape, const size_t cell_size) {
+  if (!has_boxes()) {
+    return;
+  }
+  cell_size_ = std::max<size_t>(cell_size, 1);
+  size_t cell_count = 1;
+  for (int n = 0; n < N; n++) {
+    grid_shape_[n] = std::max<std::ptrdiff_t>(
+      (shape[n] + cell_size_ - 1) / cell_size_,
+      1);
+    cell_count *= grid_shape_[n];
+  }
+  // count the rows per cell, then fill them in
+  cell_begins_.assign(cell_count + 1, 0);
+  for (size_t pass = 0; pass < 2; pass++) {
+    for (size_t row = 0; row < labels_.size(); row++) {
+      ShapeType cell_min, cell_max;
+      get_cells(box_mins_[row], box_maxs_[row], cell_min, cell_max);
+      ShapeType cell = cell_min;
+      const ShapeType cell_end = cell_max + ShapeType(1);
+      do {
+        const size_t cell_index = get_cell_index(cell);
+        if (pass == 0) {
+          cell_begins_[cell_index + 1]++;
+        } else {
+          cell_rows_[cell_begins_[cell_index]++] = row;
+        }
+      } while (next_position(cell, cell_min, cell_end));
+    }
+    if (pass == 0) {
+      for (size_t c = 0; c < cell_count; c++) {
+        cell_begins_[c + 1] += cell_begins_[c];
+      }
+      cell_rows_.resize(cell_begins_[cell_count]);
+    } else {
+      // filling moved each begin to the next one
+      for (size_t c = cell_count; c > 0; c--) {
+        cell_begins_[c] = cell_begins_[c - 1];
+      }
+      cell_begins_[0] = 0;
+    }
+  }
+}
+
+template<int N>
+void ObjectIndex<N>::get_cells(
+  const ShapeType& box_min,
+  const ShapeType& box_max,
+  ShapeType& cell_min,
+  ShapeType& cell_max) const
+{
+  const std::ptrdiff_t cell_size = cell_size_;
+  for (int n = 0; n < N; n++) {
+    cell_min[n] = std::min(
+      std::max<std::ptrdiff_t>(box_min[n], 0) / cell_size,
+      grid_shape_[n] - 1);
+    cell_max[n] = std::min(
+      std::max<std::ptrdiff_t>(box_max[n] - 1, 0) / cell_size,
+      grid_shape_[n] - 1);
+  }
+}
+
+template<int N>
+size_t ObjectIndex<N>::get_cell_index(const ShapeType& cell) const {
+  size_t index = 0;
+  for (int n = N - 1; n >= 0; n--) {
+    index = index * grid_shape_[n] + cell[n];
+  }
+  return index;
+}
+
+// explicit instantiation
+template class ObjectIndex<2>;
+template class ObjectIndex<3>;
+
+} // end of namespace isbi_pipeline
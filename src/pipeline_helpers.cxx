@@ -10,6 +10,7 @@
 #include <iomanip>
 #include <vector>
 #include <stdexcept>
+#include <algorithm>
 
 // vigra
 #include <vigra/random_forest_hdf5_impex.hxx>
@@ -150,6 +151,39 @@ void get_bounding_box<3>(
   bb_max[2] = options.get_option<LabelType>("z_range_1") - border_width;
 }
 
+template<int N>
+void get_crop_box(
+  const TrackingOptions& options,
+  const typename vigra::MultiArrayShape<N>::type& shape,
+  const typename vigra::MultiArrayShape<N>::type& halo,
+  typename vigra::MultiArrayShape<N>::type& crop_min,
+  typename vigra::MultiArrayShape<N>::type& crop_max)
+{
+  vigra::TinyVector<LabelType, N> bb_min, bb_max;
+  get_bounding_box<N>(options, bb_min, bb_max);
+  for (size_t n = 0; n < N; n++) {
+    const vigra::MultiArrayIndex low = bb_min[n];
+    const vigra::MultiArrayIndex high = bb_max[n];
+    crop_min[n] = std::min(std::max<vigra::MultiArrayIndex>(low - halo[n], 0),
+      shape[n]);
+    crop_max[n] = std::max(std::min(high + 1 + halo[n], shape[n]), crop_min[n]);
+  }
+}
+
+// explicit instantiation
+template void get_crop_box<2>(
+  const TrackingOptions&,
+  const vigra::MultiArrayShape<2>::type&,
+  const vigra::MultiArrayShape<2>::type&,
+  vigra::MultiArrayShape<2>::type&,
+  vigra::MultiArrayShape<2>::type&);
+template void get_crop_box<3>(
+  const TrackingOptions&,
+  const vigra::MultiArrayShape<3>::type&,
+  const vigra::MultiArrayShape<3>::type&,
+  vigra::MultiArrayShape<3>::type&,
+  vigra::MultiArrayShape<3>::type&);
+
 
 template<typename T>
 void print_vector(std::ostream& stream, const std::vector<T>& vec) {
@@ -213,6 +247,18 @@ std::string zero_padding(int num, int n_zeros) {
 int read_features_from_file(
   const std::string path,
   StringDataPairVectorType& features)
+{
+  std::vector<std::string> backends;
+  return read_features_from_file(path, features, backends);
+}
+
+/** @brief Read a csv table into a vector of string double pairs and the
+ * optional filter backend in the third column.
+ */
+int read_features_from_file(
+  const std::string path,
+  StringDataPairVectorType& features,
+  std::vector<std::string>& backends)
 {
   std::ifstream f(path.c_str());
   if (!f.is_open()) {
@@ -222,9 +268,15 @@ int read_features_from_file(
   std::string line;
   while(std::getline(f, line)) {
     Tokenizer tok(line);
-    std::string key = *tok.begin();
-    double value = boost::lexical_cast<double>(*(++tok.begin()));
+    Tokenizer::iterator tok_it = tok.begin();
+    std::string key = *tok_it;
+    double value = boost::lexical_cast<double>(*(++tok_it));
     features.push_back(std::make_pair(key, value));
+    if (++tok_it != tok.end()) {
+      backends.push_back(*tok_it);
+    } else {
+      backends.push_back("");
+    }
   }
   f.close();
   return 0;
@@ -279,6 +331,49 @@ bool get_rfs_from_file(
   return n_forests > 0;
 }
 
+/** @brief Walk all trees of the random forests and mark the feature
+ * columns the split nodes look at.
+ *
+ * Threshold nodes split on a single column. All other internal node types
+ * (hyperplanes, hyperspheres) conservatively mark every column as used.
+ */
+std::vector<bool> get_used_feature_columns(const RandomForestVectorType& rfs) {
+  std::vector<bool> used_columns;
+  for (const RandomForestType& rf : rfs) {
+    const size_t column_count = rf.ext_param_.column_count_;
+    if (used_columns.size() < column_count) {
+      used_columns.resize(column_count, false);
+    }
+    for (size_t tree = 0; tree < rf.trees_.size(); tree++) {
+      const vigra::ArrayVector<vigra::Int32>& topology =
+        rf.trees_[tree].topology_;
+      const vigra::ArrayVector<double>& parameters =
+        rf.trees_[tree].parameters_;
+      // the root node of vigra decision trees is at index 2
+      std::vector<vigra::Int32> node_stack(1, 2);
+      while (!node_stack.empty()) {
+        const vigra::Int32 index = node_stack.back();
+        node_stack.pop_back();
+        vigra::NodeBase node(topology, parameters, index);
+        if (node.typeID() & vigra::LeafNodeTag) {
+          continue;
+        } else if (node.typeID() == vigra::i_ThresholdNode) {
+          vigra::Node<vigra::i_ThresholdNode> threshold_node(
+            topology,
+            parameters,
+            index);
+          used_columns[threshold_node.column()] = true;
+        } else {
+          std::fill(used_columns.begin(), used_columns.end(), true);
+        }
+        node_stack.push_back(node.child(0));
+        node_stack.push_back(node.child(1));
+      }
+    }
+  }
+  return used_columns;
+}
+
 /** @brief Do the tracking.
  */
 // TODO the whole following code is ugly -> will someone please come
@@ -287,7 +382,8 @@ EventVectorVectorType track(
   TraxelStoreType& ts,
   const TrackingOptions& options,
   const CoordinateMapPtrType& coordinate_map_ptr,
-  const std::vector<pgmlink::Traxel>& traxels_to_keep_in_first_frame)
+  const std::vector<pgmlink::Traxel>& traxels_to_keep_in_first_frame,
+  const MergerCoordinatesFunctionType& fill_merger_coordinates)
 {
   const std::string& tracker_type = options.get_option<std::string>("tracker");
   // create the ChaingraphTracking or ConsTracking class and call the ()-
@@ -380,7 +476,10 @@ EventVectorVectorType track(
         options.get_option<double>("cplex_timeout"),
         options.get_option<double>("detWeight"))));
 
-    // merger resolving
+    // merger resolving, the coordinates are only needed for the mergers
+    if (fill_merger_coordinates) {
+      fill_merger_coordinates(*ret_ptr, coordinate_map_ptr);
+    }
     return tracker.resolve_mergers(
       ret_ptr,
       coordinate_map_ptr,
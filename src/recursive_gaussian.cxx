@@ -0,0 +1,380 @@
+// stl
+#include <cmath>
+#include <algorithm>
+
+#include "recursive_gaussian.hxx"
+
+namespace isbi_pipeline {
+
+////
+//// local functions
+////
+namespace {
+
+// reflect the line into buffer[pad, pad + size) with pad samples on each
+// side, the border sample is not repeated
+void fill_reflected(
+  const DataType* src,
+  std::ptrdiff_t src_stride,
+  size_t size,
+  size_t pad,
+  std::vector<double>& buffer)
+{
+  buffer.resize(size + 2 * pad);
+  for (size_t i = 0; i < size; i++) {
+    buffer[pad + i] = src[i * src_stride];
+  }
+  for (size_t k = 1; k <= pad; k++) {
+    buffer[pad - k] = buffer[pad + k];
+    buffer[pad + size - 1 + k] = buffer[pad + size - 1 - k];
+  }
+}
+
+// Young and van Vliet recursion coefficients
+void recursive_coefficients(double sigma, double coefficients[4]) {
+  double q;
+  if (sigma >= 2.5) {
+    q = 0.98711 * sigma - 0.96330;
+  } else {
+    q = 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * sigma);
+  }
+  const double q2 = q * q;
+  const double q3 = q2 * q;
+  const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+  const double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+  const double b2 = -(1.4281 * q2 + 1.26661 * q3);
+  const double b3 = 0.422205 * q3;
+  coefficients[1] = b1 / b0;
+  coefficients[2] = b2 / b0;
+  coefficients[3] = b3 / b0;
+  coefficients[0] = 1.0 - (coefficients[1] + coefficients[2] + coefficients[3]);
+}
+
+void recursive_smooth(std::vector<double>& buffer, double sigma) {
+  double c[4];
+  recursive_coefficients(sigma, c);
+  const size_t length = buffer.size();
+  // causal pass, the state is initialized with the first sample
+  double p1 = buffer[0], p2 = buffer[0], p3 = buffer[0];
+  for (size_t i = 0; i < length; i++) {
+    const double w = c[0] * buffer[i] + c[1] * p1 + c[2] * p2 + c[3] * p3;
+    p3 = p2; p2 = p1; p1 = w;
+    buffer[i] = w;
+  }
+  // anti-causal pass
+  p1 = p2 = p3 = buffer[length - 1];
+  for (size_t i = length; i > 0; i--) {
+    const double y = c[0] * buffer[i-1] + c[1] * p1 + c[2] * p2 + c[3] * p3;
+    p3 = p2; p2 = p1; p1 = y;
+    buffer[i-1] = y;
+  }
+}
+
+// convolve the reflected line with the FIR kernel, samples beyond the
+// reflected border are repeated
+void fir_filter(
+  const std::vector<double>& buffer,
+  size_t pad,
+  size_t size,
+  const std::vector<double>& kernel,
+  std::vector<double>& result)
+{
+  const int radius = static_cast<int>(kernel.size() / 2);
+  const int last = static_cast<int>(buffer.size()) - 1;
+  result.resize(size);
+  for (size_t i = 0; i < size; i++) {
+    double value = 0.0;
+    for (int k = -radius; k <= radius; k++) {
+      const int j = std::min(std::max(static_cast<int>(pad + i) - k, 0), last);
+      value += kernel[k + radius] * buffer[j];
+    }
+    result[i] = value;
+  }
+}
+
+} // end of anonymous namespace
+
+////
+//// fir_gaussian_kernel
+////
+void fir_gaussian_kernel(
+  double sigma,
+  unsigned int order,
+  double window_size,
+  std::vector<double>& kernel)
+{
+  const int radius = std::max(1, static_cast<int>(window_size * sigma + 0.5));
+  kernel.resize(2 * radius + 1);
+  const double sigma2 = sigma * sigma;
+  for (int i = -radius; i <= radius; i++) {
+    const double gauss = std::exp(-0.5 * i * i / sigma2);
+    if (order == 0) {
+      kernel[i + radius] = gauss;
+    } else if (order == 1) {
+      kernel[i + radius] = -i / sigma2 * gauss;
+    } else {
+      kernel[i + radius] = (i * i / sigma2 - 1.0) / sigma2 * gauss;
+    }
+  }
+  // normalize the moment of the derivative order to one
+  double mean = 0.0;
+  if (order == 2) {
+    for (size_t k = 0; k < kernel.size(); k++) {
+      mean += kernel[k];
+    }
+    mean /= kernel.size();
+  }
+  double norm = 0.0;
+  for (int i = -radius; i <= radius; i++) {
+    kernel[i + radius] -= mean;
+    if (order == 0) {
+      norm += kernel[i + radius];
+    } else if (order == 1) {
+      norm -= i * kernel[i + radius];
+    } else {
+      norm += 0.5 * i * i * kernel[i + radius];
+    }
+  }
+  for (size_t k = 0; k < kernel.size(); k++) {
+    kernel[k] /= norm;
+  }
+}
+
+////
+//// recursive_gaussian_line
+////
+void recursive_gaussian_line(
+  const DataType* src,
+  std::ptrdiff_t src_stride,
+  DataType* dest,
+  std::ptrdiff_t dest_stride,
+  size_t size,
+  double sigma,
+  unsigned int order,
+  double scale,
+  double window_size,
+  const std::vector<double>& fir_kernel,
+  std::vector<double>& buffer,
+  std::vector<double>& result)
+{
+  if (size == 0) {
+    return;
+  }
+  // the border treatment is the only part that depends on the scale
+  const size_t pad = std::min<size_t>(
+    size - 1,
+    static_cast<size_t>(std::ceil(window_size * sigma)) + 1);
+  fill_reflected(src, src_stride, size, pad, buffer);
+  if (!fir_kernel.empty()) {
+    fir_filter(buffer, pad, size, fir_kernel, result);
+    for (size_t i = 0; i < size; i++) {
+      dest[i * dest_stride] = static_cast<DataType>(scale * result[i]);
+    }
+    return;
+  }
+  recursive_smooth(buffer, sigma);
+  for (size_t i = 0; i < size; i++) {
+    const size_t j = pad + i;
+    double value;
+    if (order == 0) {
+      value = buffer[j];
+    } else if (size == 1) {
+      // a reflected line of length one is constant
+      value = 0.0;
+    } else if (order == 1) {
+      value = 0.5 * (buffer[j+1] - buffer[j-1]);
+    } else {
+      value = buffer[j+1] - 2.0 * buffer[j] + buffer[j-1];
+    }
+    dest[i * dest_stride] = static_cast<DataType>(scale * value);
+  }
+}
+
+////
+//// class RecursiveGaussianFilter
+////
+template<int N>
+RecursiveGaussianFilter<N>::RecursiveGaussianFilter(DataType window_size) :
+  step_size_(1.0),
+  window_size_(window_size)
+{
+}
+
+template<int N>
+RecursiveGaussianFilter<N>::RecursiveGaussianFilter(
+    const vigra::TinyVector<DataType, N>& step_size,
+    DataType window_size) :
+  step_size_(step_size),
+  window_size_(window_size)
+{
+}
+
+template<int N>
+void RecursiveGaussianFilter<N>::filter_axis(
+  const ViewType& src,
+  ViewType dest,
+  unsigned int axis,
+  DataType sigma,
+  unsigned int order) const
+{
+  const size_t size = src.shape(axis);
+  const double axis_sigma = sigma / step_size_[axis];
+  const double scale = std::pow(1.0 / step_size_[axis], double(order));
+  size_t line_count = 1;
+  for (size_t dim = 0; dim < N; dim++) {
+    if (dim != axis) {
+      line_count *= src.shape(dim);
+    }
+  }
+  // the kernel and the buffers are shared by all lines of the axis
+  std::vector<double> fir_kernel;
+  if (axis_sigma < min_recursive_sigma) {
+    fir_gaussian_kernel(axis_sigma, order, window_size_, fir_kernel);
+  }
+  std::vector<double> buffer;
+  std::vector<double> result;
+  for (size_t line = 0; line < line_count; line++) {
+    // get the start of this line from its coordinates on the other axes
+    std::ptrdiff_t src_offset = 0;
+    std::ptrdiff_t dest_offset = 0;
+    size_t rest = line;
+    for (size_t dim = 0; dim < N; dim++) {
+      if (dim != axis) {
+        const size_t coordinate = rest % src.shape(dim);
+        rest /= src.shape(dim);
+        src_offset += coordinate * src.stride(dim);
+        dest_offset += coordinate * dest.stride(dim);
+      }
+    }
+    recursive_gaussian_line(
+      src.data() + src_offset,
+      src.stride(axis),
+      dest.data() + dest_offset,
+      dest.stride(axis),
+      size,
+      axis_sigma,
+      order,
+      scale,
+      window_size_,
+      fir_kernel,
+      buffer,
+      result);
+  }
+}
+
+template<int N>
+void RecursiveGaussianFilter<N>::gaussian_derivative(
+  const ViewType& src,
+  ViewType dest,
+  DataType sigma,
+  const OrderType& orders) const
+{
+  // the first axis reads from src, all others work in place on dest
+  filter_axis(src, dest, 0, sigma, orders[0]);
+  for (unsigned int axis = 1; axis < N; axis++) {
+    filter_axis(dest, dest, axis, sigma, orders[axis]);
+  }
+}
+
+template<int N>
+void RecursiveGaussianFilter<N>::gaussian_smoothing(
+  const ViewType& src,
+  ViewType dest,
+  DataType sigma) const
+{
+  gaussian_derivative(src, dest, sigma, OrderType(0u));
+}
+
+template<int N>
+void RecursiveGaussianFilter<N>::laplacian_of_gaussian(
+  const ViewType& src,
+  ViewType dest,
+  DataType sigma,
+  ViewType temp) const
+{
+  OrderType orders(0u);
+  orders[0] = 2;
+  gaussian_derivative(src, dest, sigma, orders);
+  for (unsigned int axis = 1; axis < N; axis++) {
+    orders = OrderType(0u);
+    orders[axis] = 2;
+    gaussian_derivative(src, temp, sigma, orders);
+    dest += temp;
+  }
+}
+
+template<int N>
+void RecursiveGaussianFilter<N>::gaussian_gradient(
+  const ViewType& src,
+  VectorViewType dest,
+  DataType sigma) const
+{
+  vigra::MultiArrayView<N+1, DataType, vigra::StridedArrayTag> components =
+    dest.expandElements(N);
+  for (unsigned int axis = 0; axis < N; axis++) {
+    OrderType orders(0u);
+    orders[axis] = 1;
+    gaussian_derivative(
+      src,
+      components.template bind<N>(axis),
+      sigma,
+      orders);
+  }
+}
+
+template<int N>
+void RecursiveGaussianFilter<N>::hessian_of_gaussian(
+  const ViewType& src,
+  TensorViewType dest,
+  DataType sigma) const
+{
+  vigra::MultiArrayView<N+1, DataType, vigra::StridedArrayTag> components =
+    dest.expandElements(N);
+  // same (upper triangular) component order as vigra
+  unsigned int component = 0;
+  for (unsigned int i = 0; i < N; i++) {
+    for (unsigned int j = i; j < N; j++, component++) {
+      OrderType orders(0u);
+      orders[i] += 1;
+      orders[j] += 1;
+      gaussian_derivative(
+        src,
+        components.template bind<N>(component),
+        sigma,
+        orders);
+    }
+  }
+}
+
+template<int N>
+void RecursiveGaussianFilter<N>::structure_tensor(
+  const ViewType& src,
+  TensorViewType dest,
+  DataType inner_sigma,
+  DataType outer_sigma,
+  VectorViewType gradient) const
+{
+  gaussian_gradient(src, gradient, inner_sigma);
+  typename VectorViewType::iterator g_it = gradient.begin();
+  typename TensorViewType::iterator t_it = dest.begin();
+  for (; g_it != gradient.end(); g_it++, t_it++) {
+    unsigned int component = 0;
+    for (unsigned int i = 0; i < N; i++) {
+      for (unsigned int j = i; j < N; j++, component++) {
+        (*t_it)[component] = (*g_it)[i] * (*g_it)[j];
+      }
+    }
+  }
+  vigra::MultiArrayView<N+1, DataType, vigra::StridedArrayTag> components =
+    dest.expandElements(N);
+  for (unsigned int component = 0; component < (N*(N+1))/2; component++) {
+    ViewType component_view = components.template bind<N>(component);
+    gaussian_smoothing(component_view, component_view, outer_sigma);
+  }
+}
+
+// explicit instantiation
+template class RecursiveGaussianFilter<2>;
+template class RecursiveGaussianFilter<3>;
+
+} // end of namespace isbi_pipeline
@@ -0,0 +1,226 @@
+// stl
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "region_moments.hxx"
+
+namespace isbi_pipeline {
+
+////
+//// local functions
+////
+namespace {
+
+// add the sum, minimum and maximum of values[x * stride], x < size
+void add_run(
+  const DataType* values,
+  const std::ptrdiff_t stride,
+  const size_t size,
+  double& sum,
+  double& minimum,
+  double& maximum)
+{
+  size_t x = 0;
+#ifdef __SSE2__
+  if (stride == 1 && size >= 4) {
+    // two partial sums of two doubles each, the floats are widened
+    __m128d sums_low = _mm_setzero_pd();
+    __m128d sums_high = _mm_setzero_pd();
+    __m128 minima = _mm_loadu_ps(values);
+    __m128 maxima = minima;
+    for (; x + 4 <= size; x += 4) {
+      const __m128 run_values = _mm_loadu_ps(values + x);
+      sums_low = _mm_add_pd(sums_low, _mm_cvtps_pd(run_values));
+      sums_high = _mm_add_pd(
+        sums_high,
+        _mm_cvtps_pd(_mm_movehl_ps(run_values, run_values)));
+      minima = _mm_min_ps(minima, run_values);
+      maxima = _mm_max_ps(maxima, run_values);
+    }
+    double partial_sums[4];
+    float partial_minima[4];
+    float partial_maxima[4];
+    _mm_storeu_pd(partial_sums, sums_low);
+    _mm_storeu_pd(partial_sums + 2, sums_high);
+    _mm_storeu_ps(partial_minima, minima);
+    _mm_storeu_ps(partial_maxima, maxima);
+    sum += (partial_sums[0] + partial_sums[1])
+      + (partial_sums[2] + partial_sums[3]);
+    for (size_t i = 0; i < 4; i++) {
+      minimum = std::min<double>(minimum, partial_minima[i]);
+      maximum = std::max<double>(maximum, partial_maxima[i]);
+    }
+  }
+#endif
+  for (; x < size; x++) {
+    const double value = values[x * stride];
+    sum += value;
+    minimum = std::min(minimum, value);
+    maximum = std::max(maximum, value);
+  }
+}
+
+// add the powers 2, 3 and 4 of the deviations of values[x * stride], x <
+// size, from mean
+void add_run_deviations(
+  const DataType* values,
+  const std::ptrdiff_t stride,
+  const size_t size,
+  const double mean,
+  double& squared_deviations,
+  double& cubed_deviations,
+  double& quartic_deviations)
+{
+  size_t x = 0;
+#ifdef __SSE2__
+  if (stride == 1) {
+    const __m128d means = _mm_set1_pd(mean);
+    __m128d squared = _mm_setzero_pd();
+    __m128d cubed = _mm_setzero_pd();
+    __m128d quartic = _mm_setzero_pd();
+    for (; x + 4 <= size; x += 4) {
+      const __m128 run_values = _mm_loadu_ps(values + x);
+      const __m128d deviations[2] = {
+        _mm_sub_pd(_mm_cvtps_pd(run_values), means),
+        _mm_sub_pd(
+          _mm_cvtps_pd(_mm_movehl_ps(run_values, run_values)),
+          means)};
+      for (size_t i = 0; i < 2; i++) {
+        const __m128d squares = _mm_mul_pd(deviations[i], deviations[i]);
+        squared = _mm_add_pd(squared, squares);
+        cubed = _mm_add_pd(cubed, _mm_mul_pd(squares, deviations[i]));
+        quartic = _mm_add_pd(quartic, _mm_mul_pd(squares, squares));
+      }
+    }
+    double partial_sums[6];
+    _mm_storeu_pd(partial_sums, squared);
+    _mm_storeu_pd(partial_sums + 2, cubed);
+    _mm_storeu_pd(partial_sums + 4, quartic);
+    squared_deviations += partial_sums[0] + partial_sums[1];
+    cubed_deviations += partial_sums[2] + partial_sums[3];
+    quartic_deviations += partial_sums[4] + partial_sums[5];
+  }
+#endif
+  for (; x < size; x++) {
+    const double deviation = values[x * stride] - mean;
+    const double square = deviation * deviation;
+    squared_deviations += square;
+    cubed_deviations += square * deviation;
+    quartic_deviations += square * square;
+  }
+}
+
+} // end of anonymous namespace
+
+////
+//// get_region_moments
+////
+template<int N>
+void get_region_moments(
+  const vigra::MultiArrayView<N, LabelType>& region_image,
+  const vigra::MultiArrayView<N, DataType>& image,
+  const typename vigra::MultiArrayShape<N>::type& offset,
+  std::vector<RegionMoments<N> >& moments)
+{
+  if (region_image.shape() != image.shape()) {
+    throw std::runtime_error("region moments: shapes differ");
+  }
+  const std::ptrdiff_t width = region_image.shape(0);
+  const size_t depth = N == 3 ? region_image.shape(N - 1) : 1;
+  const std::ptrdiff_t region_stride_z = N == 3 ? region_image.stride(N - 1) : 0;
+  const std::ptrdiff_t value_stride_z = N == 3 ? image.stride(N - 1) : 0;
+  // pass 0 sums the intensities and coordinates, pass 1 the deviations from
+  // the means
+  for (size_t pass = 0; pass < 2; pass++) {
+    for (size_t z = 0; z < depth; z++) {
+      for (std::ptrdiff_t y = 0; y < region_image.shape(1); y++) {
+        const LabelType* regions = region_image.data()
+          + y * region_image.stride(1) + z * region_stride_z;
+        const DataType* values = image.data()
+          + y * image.stride(1) + z * value_stride_z;
+        std::ptrdiff_t run_begin = 0;
+        while (run_begin < width) {
+          const LabelType region = regions[run_begin * region_image.stride(0)];
+          std::ptrdiff_t run_end = run_begin + 1;
+          while (run_end < width
+              && regions[run_end * region_image.stride(0)] == region) {
+            run_end++;
+          }
+          if (region == 0 || region >= moments.size()) {
+            run_begin = run_end;
+            continue;
+          }
+          RegionMoments<N>& region_moments = moments[region];
+          const DataType* run_values = values + run_begin * image.stride(0);
+          const size_t run_size = run_end - run_begin;
+          if (pass == 0) {
+            add_run(
+              run_values,
+              image.stride(0),
+              run_size,
+              region_moments.sum_,
+              region_moments.minimum_,
+              region_moments.maximum_);
+            region_moments.count_ += run_size;
+            // the x coordinates of a run are consecutive
+            const double run_coordinates[3] = {
+              0.5 * (run_begin + run_end - 1),
+              static_cast<double>(y),
+              static_cast<double>(z)};
+            for (size_t n = 0; n < N; n++) {
+              region_moments.coordinate_sum_[n] +=
+                run_size * (run_coordinates[n] + offset[n]);
+            }
+            region_moments.coordinate_min_[0] = std::min<double>(
+              region_moments.coordinate_min_[0],
+              run_begin + offset[0]);
+            region_moments.coordinate_max_[0] = std::max<double>(
+              region_moments.coordinate_max_[0],
+              run_end - 1 + offset[0]);
+            for (size_t n = 1; n < N; n++) {
+              region_moments.coordinate_min_[n] = std::min(
+                region_moments.coordinate_min_[n],
+                run_coordinates[n] + offset[n]);
+              region_moments.coordinate_max_[n] = std::max(
+                region_moments.coordinate_max_[n],
+                run_coordinates[n] + offset[n]);
+            }
+          } else {
+            add_run_deviations(
+              run_values,
+              image.stride(0),
+              run_size,
+              region_moments.mean_,
+              region_moments.squared_deviations_,
+              region_moments.cubed_deviations_,
+              region_moments.quartic_deviations_);
+          }
+          run_begin = run_end;
+        }
+      }
+    }
+    if (pass == 0) {
+      for (RegionMoments<N>& region_moments : moments) {
+        region_moments.mean_ = region_moments.sum_ / region_moments.count_;
+      }
+    }
+  }
+}
+
+// explicit instantiation
+template void get_region_moments<2>(
+  const vigra::MultiArrayView<2, LabelType>&,
+  const vigra::MultiArrayView<2, DataType>&,
+  const vigra::MultiArrayShape<2>::type&,
+  std::vector<RegionMoments<2> >&);
+template void get_region_moments<3>(
+  const vigra::MultiArrayView<3, LabelType>&,
+  const vigra::MultiArrayView<3, DataType>&,
+  const vigra::MultiArrayShape<3>::type&,
+  std::vector<RegionMoments<3> >&);
+
+} // end of namespace isbi_pipeline
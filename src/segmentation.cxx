@@ -1,8 +1,13 @@
 // vigra
-#include <vigra/multi_labeling.hxx> /* for labelMultiArrayWithBackground */
 #include <vigra/multi_tensorutilities.hxx>
 #include <vigra/hdf5impex.hxx> /* for writeHDF5 */
 
+// stl
+#include <cmath> /* for std::ceil, std::floor */
+#include <limits> /* for std::numeric_limits */
+#include <algorithm> /* for std::min */
+#include <utility> /* for std::pair */
+
 #include "segmentation.hxx"
 
 namespace isbi_pipeline {
@@ -23,6 +28,43 @@ typename vigra::MultiArrayShape<N+1>::type append_to_shape(
   return ret;
 }
 
+// the box [inner_min, inner_max) enlarged by radius and clipped to shape,
+// returns its volume
+template<int N>
+size_t get_padded_box(
+  const typename vigra::MultiArrayShape<N>::type& inner_min,
+  const typename vigra::MultiArrayShape<N>::type& inner_max,
+  const typename vigra::MultiArrayShape<N>::type& radius,
+  const typename vigra::MultiArrayShape<N>::type& shape,
+  typename vigra::MultiArrayShape<N>::type& box_min,
+  typename vigra::MultiArrayShape<N>::type& box_max)
+{
+  size_t volume = 1;
+  for (size_t dim = 0; dim < N; dim++) {
+    box_min[dim] = std::max<vigra::MultiArrayIndex>(
+      inner_min[dim] - radius[dim],
+      0);
+    box_max[dim] = std::min(inner_max[dim] + radius[dim], shape[dim]);
+    volume *= box_max[dim] - box_min[dim];
+  }
+  return volume;
+}
+
+
+////
+//// get_filter_backend
+////
+FilterBackend get_filter_backend(const std::string& name) {
+  if (name.empty() || !name.compare("auto")) {
+    return AutoFilter;
+  } else if (!name.compare("fir")) {
+    return FIRFilter;
+  } else if (!name.compare("recursive") || !name.compare("iir")) {
+    return RecursiveFilter;
+  } else {
+    throw std::runtime_error("Invalid filter backend " + name);
+  }
+}
 
 ////
 //// class FeatureCalculator
@@ -31,8 +73,11 @@ template<int N>
 FeatureCalculator<N>::FeatureCalculator(
     const StringDataPairVectorType& feature_scales,
     DataType window_size) :
+  recursive_filter_(window_size),
+  recursive_threshold_(std::numeric_limits<DataType>::infinity()),
   feature_scales_(feature_scales),
-  window_size_(window_size)
+  window_size_(window_size),
+  image_scales_(1.0)
 {
   // initialize the feature dimension map
   feature_sizes_["GaussianSmoothing"] = 1;
@@ -53,6 +98,8 @@ FeatureCalculator<N>::FeatureCalculator(
   FeatureCalculator(feature_scales, window_size)
 {
   conv_options_.stepSize(image_scales);
+  image_scales_ = image_scales;
+  recursive_filter_ = RecursiveGaussianFilter<N>(image_scales, window_size);
 }
 
 template<int N>
@@ -81,13 +128,116 @@ size_t FeatureCalculator<N>::get_feature_size() const {
   return size;
 }
 
+template<int N>
+void FeatureCalculator<N>::set_filter_backends(
+  const std::vector<FilterBackend>& backends)
+{
+  if (!backends.empty() && backends.size() != feature_scales_.size()) {
+    throw std::runtime_error("Number of filter backends and features differ");
+  }
+  filter_backends_ = backends;
+}
+
+template<int N>
+void FeatureCalculator<N>::set_recursive_threshold(DataType threshold) {
+  recursive_threshold_ = threshold;
+}
+
+template<int N>
+bool FeatureCalculator<N>::use_recursive_filter(size_t feature_index) const {
+  FilterBackend backend = AutoFilter;
+  if (!filter_backends_.empty()) {
+    backend = filter_backends_[feature_index];
+  }
+  if (backend == AutoFilter) {
+    return feature_scales_[feature_index].second >= recursive_threshold_;
+  } else {
+    return backend == RecursiveFilter;
+  }
+}
+
+template<int N>
+void FeatureCalculator<N>::set_used_channels(
+  const std::vector<bool>& used_channels)
+{
+  if (!used_channels.empty() && used_channels.size() != get_feature_size()) {
+    throw std::runtime_error("Number of used channels and features differ");
+  }
+  used_channels_ = used_channels;
+}
+
+template<int N>
+bool FeatureCalculator<N>::is_feature_used(size_t feature_index) const {
+  if (used_channels_.empty()) {
+    return true;
+  }
+  size_t offset = 0;
+  for (size_t i = 0; i < feature_index; i++) {
+    offset += get_feature_size(feature_scales_[i].first);
+  }
+  const size_t size = get_feature_size(feature_scales_[feature_index].first);
+  for (size_t channel = offset; channel < offset + size; channel++) {
+    if (used_channels_[channel]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template<int N>
+size_t FeatureCalculator<N>::get_used_feature_count() const {
+  size_t count = 0;
+  for (size_t i = 0; i < feature_scales_.size(); i++) {
+    if (is_feature_used(i)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+template<int N>
+typename vigra::MultiArrayShape<N>::type
+FeatureCalculator<N>::get_support_radius() const {
+  // the largest scale of all filters applied one after another
+  DataType scale = 0.0;
+  for (size_t i = 0; i < feature_scales_.size(); i++) {
+    if (!is_feature_used(i)) {
+      continue;
+    }
+    DataType feature_scale = feature_scales_[i].second;
+    if (!feature_scales_[i].first.compare("StructureTensorEigenvalues")) {
+      // gradient followed by the smoothing of the tensor
+      feature_scale *= 1.5;
+    }
+    scale = std::max(scale, feature_scale);
+  }
+  // one more sigma for the derivative kernels and one pixel for rounding
+  typename vigra::MultiArrayShape<N>::type radius;
+  for (size_t dim = 0; dim < N; dim++) {
+    radius[dim] = static_cast<int>(
+      std::ceil((window_size_ + 1.0) * scale / image_scales_[dim])) + 1;
+  }
+  return radius;
+}
+
+template<int N>
+const vigra::ConvolutionOptions<N>&
+FeatureCalculator<N>::get_convolution_options() const {
+  return conv_options_;
+}
+
 template<int N>
 int FeatureCalculator<N>::calculate_gaussian_smoothing(
   const vigra::MultiArrayView<N, DataType>& image,
   vigra::MultiArrayView<N+1, DataType>& features,
-  DataType feature_scale) const
+  DataType feature_scale,
+  const bool recursive) const
 {
   vigra::MultiArrayView<N, DataType> results(features.template bind<N>(0));
+  if (recursive) {
+    recursive_filter_.gaussian_smoothing(image, results, feature_scale);
+    return 0;
+  }
   vigra::gaussianSmoothMultiArray(
     srcMultiArrayRange(image),
     destMultiArray(results),
@@ -100,9 +250,18 @@ template<int N>
 int FeatureCalculator<N>::calculate_laplacian_of_gaussian(
   const vigra::MultiArrayView<N, DataType>& image,
   vigra::MultiArrayView<N+1, DataType>& features,
-  DataType feature_scale) const
+  DataType feature_scale,
+  const bool recursive)
 {
   vigra::MultiArrayView<N, DataType> results(features.template bind<N>(0));
+  if (recursive) {
+    recursive_filter_.laplacian_of_gaussian(
+      image,
+      results,
+      feature_scale,
+      scratch_buffers_.scalar(image.shape()));
+    return 0;
+  }
   vigra::laplacianOfGaussianMultiArray(
     srcMultiArrayRange(image),
     destMultiArray(results),
@@ -115,36 +274,26 @@ template<int N>
 int FeatureCalculator<N>::calculate_gaussian_gradient_magnitude(
   const vigra::MultiArrayView<N, DataType>& image,
   vigra::MultiArrayView<N+1, DataType>& features,
-  DataType feature_scale)
+  DataType feature_scale,
+  const bool recursive)
 {
   vigra::MultiArrayView<N, DataType> results(features.template bind<N>(0));
   vigra::VectorNormFunctor<vigra::TinyVector<DataType, N> > norm;
-#ifndef USE_PARALLEL_FEATURES
-  // reuse eigenvalue_temp
-  if (eigenvalue_temp_.shape() != image.shape()) {
-    eigenvalue_temp_.reshape(image.shape());
+  typename ScratchBufferPool<N>::VectorViewType gradient =
+    scratch_buffers_.vector(image.shape());
+  if (recursive) {
+    recursive_filter_.gaussian_gradient(image, gradient, feature_scale);
+  } else {
+    vigra::gaussianGradientMultiArray(
+      srcMultiArrayRange(image),
+      destMultiArray(gradient),
+      feature_scale,
+      conv_options_);
   }
-  vigra::gaussianGradientMultiArray(
-    srcMultiArrayRange(image),
-    destMultiArray(eigenvalue_temp_),
-    feature_scale,
-    conv_options_);
-  vigra::transformMultiArray(
-    srcMultiArrayRange(eigenvalue_temp_),
-    destMultiArray(results),
-    norm);
-#else
-  vigra::MultiArray<N, vigra::TinyVector<DataType, N> > temp(image.shape());
-  vigra::gaussianGradientMultiArray(
-    srcMultiArrayRange(image),
-    destMultiArray(temp),
-    feature_scale,
-    conv_options_);
   vigra::transformMultiArray(
-    srcMultiArrayRange(temp),
+    srcMultiArrayRange(gradient),
     destMultiArray(results),
     norm);
-#endif
   return 0;
 }
 
@@ -152,33 +301,28 @@ template<int N>
 int FeatureCalculator<N>::calculate_difference_of_gaussians(
   const vigra::MultiArrayView<N, DataType>& image,
   vigra::MultiArrayView<N+1, DataType>& features,
-  DataType feature_scale)
+  DataType feature_scale,
+  const bool recursive)
 {
   vigra::MultiArrayView<N, DataType> results(features.template bind<N>(0));
-  vigra::gaussianSmoothMultiArray(
-    srcMultiArrayRange(image),
-    destMultiArray(results),
-    feature_scale,
-    conv_options_);
-#ifndef USE_PARALLEL_FEATURES
-  if (feature_temp_.shape() != image.shape()) {
-    feature_temp_.reshape(image.shape());
+  typename ScratchBufferPool<N>::ScalarViewType temp =
+    scratch_buffers_.scalar(image.shape());
+  if (recursive) {
+    recursive_filter_.gaussian_smoothing(image, results, feature_scale);
+    recursive_filter_.gaussian_smoothing(image, temp, feature_scale * 0.66);
+  } else {
+    vigra::gaussianSmoothMultiArray(
+      srcMultiArrayRange(image),
+      destMultiArray(results),
+      feature_scale,
+      conv_options_);
+    vigra::gaussianSmoothMultiArray(
+      srcMultiArrayRange(image),
+      destMultiArray(temp),
+      feature_scale * 0.66,
+      conv_options_);
   }
-  vigra::gaussianSmoothMultiArray(
-    srcMultiArrayRange(image),
-    destMultiArray(feature_temp_),
-    feature_scale * 0.66,
-    conv_options_);
-  results -= feature_temp_;
-#else
-  vigra::MultiArray<N, DataType> temp(image.shape());
-  vigra::gaussianSmoothMultiArray(
-    srcMultiArrayRange(image),
-    destMultiArray(temp),
-    feature_scale * 0.66,
-    conv_options_);
   results -= temp;
-#endif
   return 0;
 }
 
@@ -186,41 +330,27 @@ template<int N>
 int FeatureCalculator<N>::calculate_structure_tensor_eigenvalues(
   const vigra::MultiArrayView<N, DataType>& image,
   vigra::MultiArrayView<N+1, DataType>& features,
-  DataType feature_scale)
+  DataType feature_scale,
+  const bool recursive)
 {
-#ifndef USE_PARALLEL_FEATURES
-  if (tensor_temp_.shape() != image.shape()) {
-    tensor_temp_.reshape(image.shape());
-  }
-  if (eigenvalue_temp_.shape() != image.shape()) {
-    eigenvalue_temp_.reshape(image.shape());
+  typename ScratchBufferPool<N>::TensorViewType tensor =
+    scratch_buffers_.tensor(image.shape());
+  if (recursive) {
+    recursive_filter_.structure_tensor(
+      image,
+      tensor,
+      feature_scale,
+      feature_scale * 0.5,
+      scratch_buffers_.vector(image.shape()));
+  } else {
+    vigra::structureTensorMultiArray(
+      srcMultiArrayRange(image),
+      destMultiArray(tensor),
+      feature_scale,
+      feature_scale * 0.5,
+      conv_options_);
   }
-  vigra::structureTensorMultiArray(
-    srcMultiArrayRange(image),
-    destMultiArray(tensor_temp_),
-    feature_scale,
-    feature_scale * 0.5,
-    conv_options_);
-  vigra::tensorEigenvaluesMultiArray(
-    srcMultiArrayRange(tensor_temp_),
-    destMultiArray(eigenvalue_temp_));
-  features = eigenvalue_temp_.expandElements(N);
-#else
-  vigra::MultiArray<N, vigra::TinyVector<DataType, (N*(N+1))/2> > tensor(
-    image.shape());
-  vigra::MultiArray<N, vigra::TinyVector<DataType, N> > eigenvalues(
-    image.shape());
-  vigra::structureTensorMultiArray(
-    srcMultiArrayRange(image),
-    destMultiArray(tensor),
-    feature_scale,
-    feature_scale * 0.5,
-    conv_options_);
-  vigra::tensorEigenvaluesMultiArray(
-    srcMultiArrayRange(tensor),
-    destMultiArray(eigenvalues));
-  features = eigenvalues.expandElements(N);
-#endif
+  SymmetricEigenvalues<N>::calculate(tensor, features);
   return 0;
 }
 
@@ -228,49 +358,34 @@ template<int N>
 int FeatureCalculator<N>::calculate_hessian_of_gaussian_eigenvalues(
   const vigra::MultiArrayView<N, DataType>& image,
   vigra::MultiArrayView<N+1, DataType>& features,
-  DataType feature_scale)
+  DataType feature_scale,
+  const bool recursive)
 {
-#ifndef USE_PARALLEL_FEATURES
-  // using tensor as hessian here
-  if (tensor_temp_.shape() != image.shape()) {
-    tensor_temp_.reshape(image.shape());
-  }
-  if (eigenvalue_temp_.shape() != image.shape()) {
-    eigenvalue_temp_.reshape(image.shape());
+  typename ScratchBufferPool<N>::TensorViewType hessian =
+    scratch_buffers_.tensor(image.shape());
+  if (recursive) {
+    recursive_filter_.hessian_of_gaussian(image, hessian, feature_scale);
+  } else {
+    vigra::hessianOfGaussianMultiArray(
+      srcMultiArrayRange(image),
+      destMultiArray(hessian),
+      feature_scale,
+      conv_options_);
   }
-  vigra::hessianOfGaussianMultiArray(
-    srcMultiArrayRange(image),
-    destMultiArray(tensor_temp_),
-    feature_scale,
-    conv_options_);
-  vigra::tensorEigenvaluesMultiArray(
-    srcMultiArrayRange(tensor_temp_),
-    destMultiArray(eigenvalue_temp_));
-  features = eigenvalue_temp_.expandElements(N);
-#else
-vigra::MultiArray<N, vigra::TinyVector<DataType, (N*(N+1))/2> > hessian(
-    image.shape());
-  vigra::MultiArray<N, vigra::TinyVector<DataType, N> > eigenvalues(
-    image.shape());
-  vigra::hessianOfGaussianMultiArray(
-    srcMultiArrayRange(image),
-    destMultiArray(hessian),
-    feature_scale,
-    conv_options_);
-  vigra::tensorEigenvaluesMultiArray(
-    srcMultiArrayRange(hessian),
-    destMultiArray(eigenvalues));
-  features = eigenvalues.expandElements(N);
-#endif
+  SymmetricEigenvalues<N>::calculate(hessian, features);
   return 0;
 }
 
 template<int N>
 int FeatureCalculator<N>::calculate(
   const vigra::MultiArrayView<N, DataType>& image,
-  vigra::MultiArray<N+1, DataType>& features)
+  vigra::MultiArray<N+1, DataType>& features,
+  const bool verbose)
 {
-  std::cout << "\tcalculating " << get_feature_size() << " features" << std::endl;
+  if (verbose) {
+    std::cout << "\tcalculating " << get_feature_size() << " features"
+      << std::endl;
+  }
   typedef typename vigra::MultiArrayShape<N+1>::type FeaturesShapeType;
   typedef typename vigra::MultiArrayShape<N>::type ImageShapeType;
   typedef typename vigra::MultiArrayView<N+1, DataType> FeaturesViewType;
@@ -297,6 +412,7 @@ int FeatureCalculator<N>::calculate(
       offset += get_feature_size(it->first);
     }
   }
+  scratch_buffers_.reset_counters();
 
 #ifdef USE_PARALLEL_FEATURES
   #pragma omp parallel for
@@ -315,23 +431,56 @@ int FeatureCalculator<N>::calculate(
     // branch between the different features
     const std::string& feature_name = feature_scales_[i].first;
     const DataType& scale = feature_scales_[i].second;
+    const bool recursive = use_recursive_filter(i);
     
-    if (!feature_name.compare("GaussianSmoothing")) {
-      calculate_gaussian_smoothing(image, features_view, scale);
+    if (!is_feature_used(i)) {
+      // the random forests never look at this feature
+      features_view.init(0.0);
+    } else if (!feature_name.compare("GaussianSmoothing")) {
+      calculate_gaussian_smoothing(
+        image,
+        features_view,
+        scale,
+        recursive);
     } else if (!feature_name.compare("LaplacianOfGaussian")) {
-      calculate_laplacian_of_gaussian(image, features_view, scale);
+      calculate_laplacian_of_gaussian(
+        image,
+        features_view,
+        scale,
+        recursive);
     } else if (!feature_name.compare("GaussianGradientMagnitude")) {
-      calculate_gaussian_gradient_magnitude(image, features_view, scale);
+      calculate_gaussian_gradient_magnitude(
+        image,
+        features_view,
+        scale,
+        recursive);
     } else if (!feature_name.compare("DifferenceOfGaussians")) {
-      calculate_difference_of_gaussians(image, features_view, scale);
+      calculate_difference_of_gaussians(
+        image,
+        features_view,
+        scale,
+        recursive);
     } else if (!feature_name.compare("StructureTensorEigenvalues")) {
-      calculate_structure_tensor_eigenvalues(image, features_view, scale);
+      calculate_structure_tensor_eigenvalues(
+        image,
+        features_view,
+        scale,
+        recursive);
     } else if (!feature_name.compare("HessianOfGaussianEigenvalues")) {
-      calculate_hessian_of_gaussian_eigenvalues(image, features_view, scale);
+      calculate_hessian_of_gaussian_eigenvalues(
+        image,
+        features_view,
+        scale,
+        recursive);
     } else {
       throw std::runtime_error("Invalid feature name used");
     }
   }
+  if (verbose) {
+    std::cout << "\tscratch buffers: "
+      << scratch_buffers_.get_allocation_count() << " allocations for "
+      << scratch_buffers_.get_request_count() << " requests" << std::endl;
+  }
   return 0;
 }
 
@@ -344,8 +493,7 @@ template class FeatureCalculator<3>;
 ////
 template<int N>
 void Segmentation<N>::initialize(const vigra::MultiArray<N, DataType>& image, size_t num_classes) {
-  if (segmentation_image_.shape() != image.shape()) {
-    segmentation_image_.reshape(image.shape());
+  if (label_image_.shape() != image.shape()) {
     label_image_.reshape(image.shape());
   }
   // TODO ugly
@@ -356,6 +504,13 @@ void Segmentation<N>::initialize(const vigra::MultiArray<N, DataType>& image, si
 
 template<int N>
 int Segmentation<N>::export_hdf5(const std::string filename) {
+  // the segmentation is not kept while calculating
+  if (segmentation_image_.shape() != label_image_.shape()) {
+    segmentation_image_.reshape(label_image_.shape());
+  }
+  for (std::ptrdiff_t n = 0; n < label_image_.size(); n++) {
+    segmentation_image_[n] = label_image_[n] != 0;
+  }
   vigra::writeHDF5(filename.c_str(), "/segmentation/segmentation", segmentation_image_);
   vigra::writeHDF5(filename.c_str(), "/segmentation/labels", label_image_);
   vigra::writeHDF5(filename.c_str(), "/segmentation/features", feature_image_);
@@ -394,6 +549,7 @@ int Segmentation<N>::read_hdf5(
   LabelType min, max;
   label_image_.minmax(&min, &max);
   label_count_ = max;
+  region_statistics_.clear();
   return 0;
 }
 
@@ -401,6 +557,184 @@ int Segmentation<N>::read_hdf5(
 template class Segmentation<2>;
 template class Segmentation<3>;
 
+////
+//// prediction cache
+////
+template<int N>
+int export_prediction_cache(
+  const std::string filename,
+  const vigra::MultiArrayView<N, DataType>& foreground,
+  const size_t forest_count,
+  const bool quantize,
+  const typename vigra::MultiArrayShape<N>::type& offset)
+{
+  vigra::MultiArray<1, DataType> count(vigra::Shape1(1), forest_count);
+  vigra::writeHDF5(filename.c_str(), "/prediction/forest_count", count);
+  vigra::MultiArray<1, vigra::Int64> offset_array(vigra::Shape1(N));
+  for (int n = 0; n < N; n++) {
+    offset_array[n] = offset[n];
+  }
+  vigra::writeHDF5(filename.c_str(), "/prediction/offset", offset_array);
+  if (quantize) {
+    vigra::MultiArray<N, vigra::UInt8> quantized(foreground.shape());
+    const DataType scale = 255.0 / forest_count;
+    for (std::ptrdiff_t n = 0; n < quantized.size(); n++) {
+      const DataType value = std::floor(foreground[n] * scale + 0.5);
+      quantized[n] = std::min<DataType>(std::max<DataType>(value, 0.0), 255.0);
+    }
+    vigra::writeHDF5(filename.c_str(), "/prediction/foreground", quantized);
+  } else {
+    vigra::writeHDF5(filename.c_str(), "/prediction/foreground", foreground);
+  }
+  return 0;
+}
+
+template<int N>
+int read_prediction_cache(
+  const std::string filename,
+  vigra::MultiArray<N, DataType>& foreground,
+  size_t& forest_count,
+  typename vigra::MultiArrayShape<N>::type& offset)
+{
+  vigra::MultiArray<1, DataType> count;
+  read_hdf5_array<1, DataType>(filename, "/prediction/forest_count", count);
+  forest_count = static_cast<size_t>(count[0]);
+  // caches written before the offset was stored are not cropped
+  offset = typename vigra::MultiArrayShape<N>::type(0);
+  bool has_offset;
+  {
+    vigra::HDF5File file(filename, vigra::HDF5File::OpenReadOnly);
+    has_offset = file.existsDataset("/prediction/offset");
+  }
+  if (has_offset) {
+    vigra::MultiArray<1, vigra::Int64> offset_array;
+    read_hdf5_array<1, vigra::Int64>(
+      filename,
+      "/prediction/offset",
+      offset_array);
+    if (offset_array.size() != N) {
+      throw std::runtime_error("Prediction cache offset has wrong size");
+    }
+    for (int n = 0; n < N; n++) {
+      offset[n] = offset_array[n];
+    }
+  }
+  vigra::HDF5ImportInfo import_info(
+    filename.c_str(),
+    "/prediction/foreground");
+  if (!std::string(import_info.getPixelType()).compare("UINT8")) {
+    vigra::MultiArray<N, vigra::UInt8> quantized;
+    read_hdf5_array<N, vigra::UInt8>(
+      filename,
+      "/prediction/foreground",
+      quantized);
+    foreground.reshape(quantized.shape());
+    const DataType scale = static_cast<DataType>(forest_count) / 255.0;
+    for (std::ptrdiff_t n = 0; n < quantized.size(); n++) {
+      foreground[n] = quantized[n] * scale;
+    }
+  } else {
+    read_hdf5_array<N, DataType>(filename, "/prediction/foreground", foreground);
+  }
+  return 0;
+}
+
+// explicit instantiation
+template int export_prediction_cache<2>(
+  const std::string,
+  const vigra::MultiArrayView<2, DataType>&,
+  const size_t,
+  const bool,
+  const vigra::MultiArrayShape<2>::type&);
+template int export_prediction_cache<3>(
+  const std::string,
+  const vigra::MultiArrayView<3, DataType>&,
+  const size_t,
+  const bool,
+  const vigra::MultiArrayShape<3>::type&);
+template int read_prediction_cache<2>(
+  const std::string,
+  vigra::MultiArray<2, DataType>&,
+  size_t&,
+  vigra::MultiArrayShape<2>::type&);
+template int read_prediction_cache<3>(
+  const std::string,
+  vigra::MultiArray<3, DataType>&,
+  size_t&,
+  vigra::MultiArrayShape<3>::type&);
+
+////
+//// smooth_foreground
+////
+template<int N>
+void smooth_foreground(
+  vigra::MultiArrayView<N, DataType> foreground,
+  const DataType scale)
+{
+  vigra::ConvolutionOptions<N> conv_options;
+  conv_options.filterWindowSize(2.0);
+  vigra::gaussianSmoothMultiArray(foreground, foreground, scale, conv_options);
+}
+
+////
+//// label_foreground
+////
+template<int N>
+size_t label_foreground(
+  const vigra::MultiArrayView<N, DataType>& foreground,
+  const DataType threshold,
+  vigra::MultiArray<N, LabelType>& label_image)
+{
+  if (label_image.shape() != foreground.shape()) {
+    label_image.reshape(foreground.shape());
+  }
+  // thresholding fused into the labeling
+  return label_above_threshold<N>(foreground, threshold, label_image);
+}
+
+template<int N>
+size_t label_foreground(
+  const vigra::MultiArrayView<N, DataType>& foreground,
+  const DataType threshold,
+  const vigra::MultiArrayView<N, DataType>& image,
+  vigra::MultiArray<N, LabelType>& label_image,
+  std::vector<RegionStatistics<N> >& region_statistics)
+{
+  if (label_image.shape() != foreground.shape()) {
+    label_image.reshape(foreground.shape());
+  }
+  return label_above_threshold<N>(
+    foreground,
+    threshold,
+    label_image,
+    image,
+    region_statistics);
+}
+
+// explicit instantiation
+template void smooth_foreground<2>(vigra::MultiArrayView<2, DataType>, const DataType);
+template void smooth_foreground<3>(vigra::MultiArrayView<3, DataType>, const DataType);
+template size_t label_foreground<2>(
+  const vigra::MultiArrayView<2, DataType>&,
+  const DataType,
+  vigra::MultiArray<2, LabelType>&);
+template size_t label_foreground<3>(
+  const vigra::MultiArrayView<3, DataType>&,
+  const DataType,
+  vigra::MultiArray<3, LabelType>&);
+template size_t label_foreground<2>(
+  const vigra::MultiArrayView<2, DataType>&,
+  const DataType,
+  const vigra::MultiArrayView<2, DataType>&,
+  vigra::MultiArray<2, LabelType>&,
+  std::vector<RegionStatistics<2> >&);
+template size_t label_foreground<3>(
+  const vigra::MultiArrayView<3, DataType>&,
+  const DataType,
+  const vigra::MultiArrayView<3, DataType>&,
+  vigra::MultiArray<3, LabelType>&,
+  std::vector<RegionStatistics<3> >&);
+
 ////
 //// class SegmentationCalculator
 ////
@@ -413,7 +747,289 @@ SegmentationCalculator<N>::SegmentationCalculator(
   random_forests_(random_forests),
   options_(options)
 {
-  // assertions?
+  if (use_flat_forests(options_)) {
+    flat_forests_ = flatten_forests(
+      random_forests_,
+      use_quantized_forests(options_));
+    if (flat_forests_.empty() && !random_forests_.empty()) {
+      std::cout << "Forests contain unsupported nodes, use vigra forests for "
+        << "pixel classification" << std::endl;
+    }
+  }
+  // The probabilities of a forest are at most one up to rounding: the
+  // votes of a class are a float sum over the trees, divided by the double
+  // sum of all votes, that is less than (tree count + 4) float roundings.
+  // 1 + k * FLT_EPSILON is exactly representable.
+  for (const RandomForestType& rf : random_forests_) {
+    upper_bounds_.push_back(static_cast<DataType>(
+      1.0 + (rf.tree_count() + 5) * std::numeric_limits<float>::epsilon()));
+  }
+}
+
+template<int N>
+void SegmentationCalculator<N>::predict_probabilities(
+  const size_t forest_index,
+  const vigra::MultiArrayView<2, DataType>& features,
+  vigra::MultiArrayView<2, DataType>& probabilities,
+  FlatForest::Scratch& forest_scratch) const
+{
+  if (flat_forests_.empty()) {
+    random_forests_[forest_index].predictProbabilities(features, probabilities);
+  } else {
+    flat_forests_[forest_index].predict_probabilities(
+      features,
+      probabilities,
+      forest_scratch);
+  }
+}
+
+template<int N>
+size_t SegmentationCalculator<N>::predict_block_cascaded(
+  const vigra::MultiArrayView<2, DataType>& features,
+  vigra::MultiArrayView<2, DataType>& prediction_map,
+  const size_t channel_index,
+  const DataType forest_threshold,
+  vigra::MultiArray<2, DataType>& active_features,
+  vigra::MultiArray<2, DataType>& prediction_temp,
+  FlatForest::Scratch& forest_scratch) const
+{
+  const size_t row_count = features.shape(0);
+  const size_t class_count = prediction_map.shape(1);
+  size_t evaluation_count = 0;
+  // rows of pixels whose label is not yet decided, all at the beginning
+  std::vector<size_t> active_rows(row_count);
+  for (size_t row = 0; row < row_count; row++) {
+    active_rows[row] = row;
+  }
+  bool all_active = true;
+  for (size_t rf = 0; rf < random_forests_.size() && !active_rows.empty(); rf++) {
+    const size_t active_count = active_rows.size();
+    vigra::MultiArrayView<2, DataType> probabilities = prediction_temp.subarray(
+      vigra::Shape2(0, 0),
+      vigra::Shape2(active_count, class_count));
+    if (all_active) {
+      predict_probabilities(rf, features, probabilities, forest_scratch);
+    } else {
+      vigra::MultiArrayView<2, DataType> active_view = active_features.subarray(
+        vigra::Shape2(0, 0),
+        vigra::Shape2(active_count, features.shape(1)));
+      predict_probabilities(rf, active_view, probabilities, forest_scratch);
+    }
+    evaluation_count += active_count;
+    // add to the prediction map in the same order as without cascade
+    for (size_t l = 0; l < class_count; l++) {
+      for (size_t i = 0; i < active_count; i++) {
+        prediction_map(active_rows[i], l) += probabilities(i, l);
+      }
+    }
+    // Adding non-negative floats never decreases a sum. Hence a pixel
+    // above the threshold stays above, and a pixel that is not above it
+    // even if all remaining forests give their upper bound stays below.
+    size_t kept_count = 0;
+    for (size_t i = 0; i < active_count; i++) {
+      const DataType sum = prediction_map(active_rows[i], channel_index);
+      if (sum > forest_threshold) {
+        continue;
+      }
+      DataType bound = sum;
+      for (size_t remaining = rf + 1; remaining < upper_bounds_.size(); remaining++) {
+        bound += upper_bounds_[remaining];
+      }
+      if (bound > forest_threshold) {
+        active_rows[kept_count++] = active_rows[i];
+      }
+    }
+    if (kept_count < active_count || all_active) {
+      // compact the features of the remaining pixels
+      active_rows.resize(kept_count);
+      for (int column = 0; column < features.shape(1); column++) {
+        for (size_t i = 0; i < kept_count; i++) {
+          active_features(i, column) = features(active_rows[i], column);
+        }
+      }
+      all_active = false;
+    }
+  }
+  return evaluation_count;
+}
+
+template<int N>
+void SegmentationCalculator<N>::calculate_candidate_features(
+  const vigra::MultiArray<N, DataType>& image,
+  vigra::MultiArray<N+1, DataType>& features,
+  std::vector<size_t>& candidates) const
+{
+  typedef typename vigra::MultiArrayShape<N>::type ShapeType;
+  typedef typename vigra::MultiArrayShape<N+1>::type FeaturesShapeType;
+  const DataType threshold = options_.get_option<DataType>("PrefilterThreshold");
+  DataType scale = 1.0;
+  if (options_.has_option<DataType>("PrefilterScale")) {
+    scale = options_.get_option<DataType>("PrefilterScale");
+  }
+  // candidate pixels, smoothed in the units of the image scales like the
+  // pixel features
+  vigra::MultiArray<N, DataType> smoothed(image.shape());
+  vigra::gaussianSmoothMultiArray(
+    srcMultiArrayRange(image),
+    destMultiArray(smoothed),
+    scale,
+    feature_calculator_ptr_->get_convolution_options());
+  candidates.clear();
+  for (std::ptrdiff_t n = 0; n < smoothed.size(); n++) {
+    if (smoothed[n] >= threshold) {
+      candidates.push_back(n);
+    }
+  }
+  // The features are calculated on boxes of tiles with candidates, enlarged
+  // by the support radius. Neighboring candidate tiles (including the
+  // diagonal ones) are merged into the bounding box of their group, unless
+  // the separate tiles need less volume.
+  const size_t feature_dim = feature_calculator_ptr_->get_feature_size();
+  const int tile_size = N == 2 ? 256 : 64;
+  const ShapeType radius = feature_calculator_ptr_->get_support_radius();
+  const ShapeType shape = image.shape();
+  ShapeType tile_counts;
+  size_t tile_count = 1;
+  for (size_t dim = 0; dim < N; dim++) {
+    tile_counts[dim] = (shape[dim] + tile_size - 1) / tile_size;
+    tile_count *= tile_counts[dim];
+  }
+  // 1 for tiles with candidates, 2 once they are in a group
+  std::vector<vigra::UInt8> tile_states(tile_count, 0);
+  size_t candidate_tile_count = 0;
+  for (size_t candidate : candidates) {
+    size_t tile = 0;
+    size_t tile_stride = 1;
+    for (size_t dim = 0; dim < N; dim++) {
+      tile += (candidate % shape[dim]) / tile_size * tile_stride;
+      candidate /= shape[dim];
+      tile_stride *= tile_counts[dim];
+    }
+    if (tile_states[tile] == 0) {
+      tile_states[tile] = 1;
+      candidate_tile_count++;
+    }
+  }
+  // the inner boxes [min, max) whose features are needed
+  std::vector<std::pair<ShapeType, ShapeType> > boxes;
+  size_t box_volume = 0;
+  std::vector<size_t> group;
+  for (size_t first_tile = 0; first_tile < tile_count; first_tile++) {
+    if (tile_states[first_tile] != 1) {
+      continue;
+    }
+    // flood fill the group of the tile, tracking its bounding box in tiles
+    tile_states[first_tile] = 2;
+    group.assign(1, first_tile);
+    ShapeType group_min, group_max;
+    for (size_t i = 0; i < group.size(); i++) {
+      ShapeType position;
+      size_t index = group[i];
+      for (size_t dim = 0; dim < N; dim++) {
+        position[dim] = index % tile_counts[dim];
+        index /= tile_counts[dim];
+      }
+      if (i == 0) {
+        group_min = position;
+        group_max = position;
+      }
+      for (size_t dim = 0; dim < N; dim++) {
+        group_min[dim] = std::min(group_min[dim], position[dim]);
+        group_max[dim] = std::max(group_max[dim], position[dim]);
+      }
+      // the 3^N - 1 neighbors
+      ShapeType offset(-1);
+      do {
+        size_t neighbor = 0;
+        size_t tile_stride = 1;
+        bool is_inside = offset != ShapeType(0);
+        for (size_t dim = 0; dim < N; dim++) {
+          const vigra::MultiArrayIndex coordinate = position[dim] + offset[dim];
+          is_inside = is_inside && coordinate >= 0
+            && coordinate < tile_counts[dim];
+          neighbor += coordinate * tile_stride;
+          tile_stride *= tile_counts[dim];
+        }
+        if (is_inside && tile_states[neighbor] == 1) {
+          tile_states[neighbor] = 2;
+          group.push_back(neighbor);
+        }
+        size_t dim = 0;
+        while (dim < N && offset[dim] == 1) {
+          offset[dim++] = -1;
+        }
+        if (dim == N) {
+          break;
+        }
+        offset[dim]++;
+      } while (true);
+    }
+    // the pixel boxes of the group and of its tiles
+    ShapeType group_inner_min, group_inner_max, box_min, box_max;
+    for (size_t dim = 0; dim < N; dim++) {
+      group_inner_min[dim] = group_min[dim] * tile_size;
+      group_inner_max[dim] = std::min<vigra::MultiArrayIndex>(
+        (group_max[dim] + 1) * tile_size,
+        shape[dim]);
+    }
+    const size_t group_volume = get_padded_box<N>(
+      group_inner_min, group_inner_max, radius, shape, box_min, box_max);
+    std::vector<std::pair<ShapeType, ShapeType> > tile_boxes;
+    size_t tiles_volume = 0;
+    for (size_t tile : group) {
+      ShapeType inner_min, inner_max;
+      for (size_t dim = 0; dim < N; dim++) {
+        inner_min[dim] = (tile % tile_counts[dim]) * tile_size;
+        inner_max[dim] = std::min<vigra::MultiArrayIndex>(
+          inner_min[dim] + tile_size,
+          shape[dim]);
+        tile /= tile_counts[dim];
+      }
+      tiles_volume += get_padded_box<N>(
+        inner_min, inner_max, radius, shape, box_min, box_max);
+      tile_boxes.push_back(std::make_pair(inner_min, inner_max));
+    }
+    if (group_volume <= tiles_volume) {
+      boxes.push_back(std::make_pair(group_inner_min, group_inner_max));
+      box_volume += group_volume;
+    } else {
+      boxes.insert(boxes.end(), tile_boxes.begin(), tile_boxes.end());
+      box_volume += tiles_volume;
+    }
+  }
+  // the whole frame is cheaper once the boxes cover more than its volume
+  if (box_volume >= static_cast<size_t>(image.size())) {
+    feature_calculator_ptr_->calculate(image, features, false);
+    std::cout << "\tprefilter: " << candidates.size() << " of "
+      << image.size() << " pixels, features on the whole frame ("
+      << boxes.size() << " boxes would cover " << box_volume << " pixels)"
+      << std::endl;
+    return;
+  }
+  const FeaturesShapeType features_shape =
+    append_to_shape<N>(shape, feature_dim);
+  if (features.shape() != features_shape) {
+    features.reshape(features_shape);
+  }
+  features.init(0.0);
+  vigra::MultiArray<N+1, DataType> box_features;
+  for (const std::pair<ShapeType, ShapeType>& box : boxes) {
+    ShapeType box_min, box_max;
+    get_padded_box<N>(box.first, box.second, radius, shape, box_min, box_max);
+    feature_calculator_ptr_->calculate(
+      image.subarray(box_min, box_max),
+      box_features,
+      false);
+    features.subarray(
+      append_to_shape<N>(box.first, 0),
+      append_to_shape<N>(box.second, feature_dim)) = box_features.subarray(
+        append_to_shape<N>(box.first - box_min, 0),
+        append_to_shape<N>(box.second - box_min, feature_dim));
+  }
+  std::cout << "\tprefilter: " << candidates.size() << " of "
+    << image.size() << " pixels, features on " << boxes.size()
+    << " boxes of " << candidate_tile_count << " of " << tile_count
+    << " tiles, " << box_volume << " pixels" << std::endl;
 }
 
 template<int N>
@@ -427,8 +1043,15 @@ int SegmentationCalculator<N>::calculate(
   DataType prob_threshold = options_.get_option<DataType>("SingleThreshold");
   // initialize the segmentation
   segmentation.initialize(image, num_pixel_classification_labels);
-  // calculate the features and reshape them
-  feature_calculator_ptr_->calculate(image, segmentation.feature_image_);
+  // calculate the features and reshape them, with the prefilter only
+  // around the candidate pixels
+  const bool prefilter = options_.has_option<DataType>("PrefilterThreshold");
+  std::vector<size_t> candidates;
+  if (prefilter) {
+    calculate_candidate_features(image, segmentation.feature_image_, candidates);
+  } else {
+    feature_calculator_ptr_->calculate(image, segmentation.feature_image_);
+  }
   // get the count of pixels in image
   size_t pixel_count = 1;
   for (size_t dim = 0; dim < N; dim++) {
@@ -443,55 +1066,140 @@ int SegmentationCalculator<N>::calculate(
   vigra::MultiArrayView<2, DataType> prediction_map_view(
     vigra::Shape2(pixel_count, num_pixel_classification_labels),
     segmentation.prediction_map_.data());
-  // loop over all random forests for prediction probabilities
+  // the threshold on the sum of the forest probabilities
+  const DataType forest_threshold = prob_threshold * random_forests_.size();
+  // stop evaluating the forests on a pixel once its label is decided
+  bool cascade = options_.has_option<bool>("CascadedClassification")
+    && options_.get_option<bool>("CascadedClassification");
+  if (cascade && options_.has_option<DataType>("PredictionMapSmoothing")) {
+    // the smoothed probabilities depend on the neighbors of a pixel
+    std::cout << "\tCascadedClassification is not exact with "
+      << "PredictionMapSmoothing, evaluate all forests" << std::endl;
+    cascade = false;
+  }
+  if (cascade && options_.has_option<std::string>("PredictionCache")) {
+    // the cache is thresholded again at other thresholds
+    std::cout << "\tCascadedClassification is not exact with "
+      << "PredictionCache, evaluate all forests" << std::endl;
+    cascade = false;
+  }
+  // loop over blocks of pixels (or candidates) and evaluate all random
+  // forests on each block. The forests are summed in the same order for
+  // every pixel, hence the prediction map does not depend on the number of
+  // threads. Pixels that are no candidates keep zero probabilities.
   std::cout << "\tPixel Classification" << std::endl;
-  #pragma omp parallel for
-  for(size_t rf = 0; rf < random_forests_.size(); rf++)
+  const size_t row_count = prefilter ? candidates.size() : pixel_count;
+  const size_t block_size = 4096;
+  const size_t block_count = (row_count + block_size - 1) / block_size;
+  size_t evaluation_count = 0;
+  #pragma omp parallel reduction(+:evaluation_count)
   {
-    vigra::MultiArray<2, DataType> prediction_temp(pixel_count, num_pixel_classification_labels);
-    random_forests_[rf].predictProbabilities(
-      feature_view,
-      prediction_temp);
-
-    #pragma omp critical
-    {
-      prediction_map_view += prediction_temp;
+    vigra::MultiArray<2, DataType> block_prediction(
+      vigra::Shape2(block_size, num_pixel_classification_labels));
+    FlatForest::Scratch forest_scratch;
+    vigra::MultiArray<2, DataType> active_features;
+    if (cascade) {
+      active_features.reshape(vigra::Shape2(block_size, feature_dim));
+    }
+    // the features and probabilities of the candidates of a block
+    vigra::MultiArray<2, DataType> candidate_features;
+    vigra::MultiArray<2, DataType> candidate_map;
+    if (prefilter) {
+      candidate_features.reshape(vigra::Shape2(block_size, feature_dim));
+      candidate_map.reshape(
+        vigra::Shape2(block_size, num_pixel_classification_labels));
     }
+    #pragma omp for schedule(dynamic)
+    for (size_t block = 0; block < block_count; block++) {
+      const size_t row_begin = block * block_size;
+      const size_t row_end = std::min(row_begin + block_size, row_count);
+      // rows of the gathered candidates or of the image
+      const size_t view_begin = prefilter ? 0 : row_begin;
+      const size_t view_end = view_begin + row_end - row_begin;
+      vigra::MultiArrayView<2, DataType> block_features =
+        (prefilter ? candidate_features : feature_view).subarray(
+          vigra::Shape2(view_begin, 0),
+          vigra::Shape2(view_end, feature_dim));
+      vigra::MultiArrayView<2, DataType> block_map =
+        (prefilter ? candidate_map : prediction_map_view).subarray(
+          vigra::Shape2(view_begin, 0),
+          vigra::Shape2(view_end, num_pixel_classification_labels));
+      if (prefilter) {
+        block_map.init(0.0);
+        for (size_t column = 0; column < feature_dim; column++) {
+          for (size_t row = row_begin; row < row_end; row++) {
+            block_features(row - row_begin, column) =
+              feature_view(candidates[row], column);
+          }
+        }
+      }
+      if (cascade) {
+        evaluation_count += predict_block_cascaded(
+          block_features,
+          block_map,
+          channel_index,
+          forest_threshold,
+          active_features,
+          block_prediction,
+          forest_scratch);
+      } else {
+        vigra::MultiArrayView<2, DataType> block_temp =
+          block_prediction.subarray(
+            vigra::Shape2(0, 0),
+            vigra::Shape2(row_end - row_begin, num_pixel_classification_labels));
+        for (size_t rf = 0; rf < random_forests_.size(); rf++) {
+          predict_probabilities(rf, block_features, block_temp, forest_scratch);
+          block_map += block_temp;
+        }
+        evaluation_count += (row_end - row_begin) * random_forests_.size();
+      }
+      if (prefilter) {
+        for (int l = 0; l < num_pixel_classification_labels; l++) {
+          for (size_t row = row_begin; row < row_end; row++) {
+            prediction_map_view(candidates[row], l) =
+              block_map(row - row_begin, l);
+          }
+        }
+      }
+    }
+  }
+  if (cascade) {
+    std::cout << "\tcascade: " << evaluation_count << " of "
+      << row_count * random_forests_.size() << " pixel forest evaluations"
+      << std::endl;
   }
 
+  vigra::MultiArrayView<N, DataType> foreground =
+    segmentation.prediction_map_.template bind<N>(channel_index);
+  // keep the foreground for the prediction cache
+  if (options_.has_option<std::string>("PredictionCache")) {
+    segmentation.foreground_ = foreground;
+  }
   // smooth prediction map
   if (options_.has_option<DataType>("PredictionMapSmoothing")) {
-    vigra::ConvolutionOptions<N> conv_options;
-    conv_options.filterWindowSize(2.0);
-    vigra::MultiArrayView<N, DataType> prediction_map_channel_view =
-      segmentation.prediction_map_.template bind<N>(channel_index);
-      
-    vigra::gaussianSmoothMultiArray(
-      prediction_map_channel_view,
-      prediction_map_channel_view,
-      options_.get_option<DataType>("PredictionMapSmoothing"),
-      conv_options);
-  }
-
-  // assign the labels
-  std::cout << "\tThresholding" << std::endl;
-  prob_threshold = prob_threshold * random_forests_.size();
-  typename vigra::MultiArrayView<N, LabelType>::iterator seg_it;
-  seg_it = segmentation.segmentation_image_.begin();
-  for (size_t n = 0; n < pixel_count; n++, seg_it++) {
-    if (prediction_map_view(n, channel_index) > prob_threshold) {
-      *seg_it = 1;
-    } else {
-      *seg_it = 0;
-    }
+    smooth_foreground<N>(
+      foreground,
+      options_.get_option<DataType>("PredictionMapSmoothing"));
+  }
+
+  // assign the labels and extract objects
+  std::cout << "\tThresholding and Connected Components" << std::endl;
+  if (options_.has_option<bool>("RegionStatisticsInLabeling")
+      && options_.get_option<bool>("RegionStatisticsInLabeling")) {
+    // the traxel extractor takes the core features from these
+    segmentation.label_count_ = label_foreground<N>(
+      foreground,
+      forest_threshold,
+      image,
+      segmentation.label_image_,
+      segmentation.region_statistics_);
+  } else {
+    segmentation.region_statistics_.clear();
+    segmentation.label_count_ = label_foreground<N>(
+      foreground,
+      forest_threshold,
+      segmentation.label_image_);
   }
-  std::cout << "\tConnected Components" << std::endl;
-  // extract objects
-  segmentation.label_count_ = vigra::labelMultiArrayWithBackground(
-    segmentation.segmentation_image_,
-    segmentation.label_image_,
-    vigra::IndirectNeighborhood,
-    static_cast<LabelType>(0));
   return return_status;
 }
 
@@ -5,6 +5,10 @@
 
 #include "traxel_extractor.hxx"
 #include <iostream>
+#include <algorithm>
+#include <set>
+#include <omp.h>
+#include <iterator>
 
 namespace isbi_pipeline {
 
@@ -29,78 +33,15 @@ void dump(const FeatureMapType& feature_map) {
   }
 }
 
-template<typename T>
-void set_feature(FeatureMapType& feature_map, const std::string& name, T value) {
-  FeatureArrayType f;
-  f.push_back(static_cast<FeatureType>(value));
-  feature_map[name] = f;
-}
-
-template<>
-void set_feature(
-  FeatureMapType& feature_map,
-  const std::string& name,
-  vigra::TinyVector<double, 2> value)
-{
-  FeatureArrayType f;
-  f.clear();
-  f.push_back(static_cast<FeatureType>(value[0]));
-  f.push_back(static_cast<FeatureType>(value[1]));
-  feature_map[name] = f;
-}
-
-template<>
-void set_feature(
-  FeatureMapType& feature_map,
-  const std::string& name,
-  vigra::TinyVector<double, 3> value)
-{
-  FeatureArrayType f;
-  f.clear();
-  f.push_back(static_cast<FeatureType>(value[0]));
-  f.push_back(static_cast<FeatureType>(value[1]));
-  f.push_back(static_cast<FeatureType>(value[2]));
-  feature_map[name] = f;
-}
-
-template<int N, typename T1, typename T2>
-void set_feature_with_offset(
-  FeatureMapType& feature_map,
-  const std::string& name,
-  vigra::TinyVector<T1,N> value,
-  vigra::TinyVector<T2,N> offset)
-{
-  FeatureArrayType f;
-  f.clear();
-  for(int i = 0; i < N; i++) {
-    f.push_back(static_cast<FeatureType>(value[i] + offset[i]));
-  }
-  feature_map[name] = f;
-}
-
-template<>
-void set_feature(
-  FeatureMapType& feature_map,
-  const std::string& name,
-  vigra::linalg::Matrix<DataType> value)
-{
-  FeatureArrayType f;
-  f.clear();
-  for(auto it = value.begin(); it != value.end(); ++it) {
-    f.push_back(static_cast<FeatureType>(*it));
-  }
-  feature_map[name] = f;
+// write a scalar or vector feature to its values in an object table
+void set_values(FeatureType* values, const double value) {
+  values[0] = static_cast<FeatureType>(value);
 }
 
-template<unsigned int N, typename T>
-void copy_vector(
-  const std::vector<T>& vector,
-  vigra::MultiArrayView<N, T>& multi_array_view)
-{
-  typename std::vector<T>::const_iterator v_it = vector.begin();
-  typename vigra::MultiArrayView<N, T>::iterator m_it = multi_array_view.begin();
-  for (; v_it != vector.end(); v_it++, m_it++) {
-    *m_it = *v_it;
+template<int M>
+void set_values(FeatureType* values, const vigra::TinyVector<double, M>& value) {
+  for (int i = 0; i < M; i++) {
+    values[i] = static_cast<FeatureType>(value[i]);
   }
 }
 
@@ -113,8 +54,10 @@ TraxelExtractor<N>::TraxelExtractor(
     const RandomForestVectorType& random_forests,
     const TrackingOptions& options) :
   feature_selection_(feature_selection),
+  use_presets_(true),
   random_forests_(random_forests),
-  options_(options)
+  options_(options),
+  coordinate_offset_(0)
 {
   // assertions?
   if (!options.get_option<std::string>("tracker").compare("ConsTracking")) {
@@ -125,9 +68,99 @@ TraxelExtractor<N>::TraxelExtractor(
   border_distance_ = options.get_option<int>("borderWidth");
   lower_size_lim_ = options.get_option<int>("size_range_0");
   upper_size_lim_ = options.get_option<int>("size_range_1");
+  discard_outside_ = options.has_option<bool>("DiscardOutsideFieldOfView")
+    && options.get_option<bool>("DiscardOutsideFieldOfView");
+  if (discard_outside_) {
+    get_bounding_box<N>(options, field_of_view_min_, field_of_view_max_);
+  }
   x_scale_ = options.get_option<double>("scales_0");
   y_scale_ = options.get_option<double>("scales_1");
   z_scale_ = options.get_option<double>("scales_2");
+  if (use_flat_forests(options)) {
+    flat_forests_ = flatten_forests(
+      random_forests_,
+      use_quantized_forests(options));
+  }
+  compile_features();
+}
+
+template<int N>
+size_t TraxelExtractor<N>::get_feature_size(const std::string& feature_name) {
+  if (!feature_name.compare("Coord<Principal<Kurtosis> >")
+      || !feature_name.compare("Coord<Principal<Skewness> >")
+      || !feature_name.compare("RegionCenter")
+      || !feature_name.compare("RegionRadii")) {
+    return N;
+  } else {
+    return 1;
+  }
+}
+
+template<int N>
+size_t TraxelExtractor<N>::get_feature_size() const {
+  size_t size = 0;
+  for (std::string feature : feature_selection_) {
+    size += get_feature_size(feature);
+  }
+  return size;
+}
+
+template<int N>
+void TraxelExtractor<N>::set_used_columns(
+  const std::vector<bool>& used_columns)
+{
+  feature_used_.clear();
+  if (used_columns.empty()) {
+    compile_features();
+    return;
+  }
+  if (used_columns.size() != get_feature_size()) {
+    throw std::runtime_error("Number of used columns and features differ");
+  }
+  size_t offset = 0;
+  for (std::string feature : feature_selection_) {
+    const size_t size = get_feature_size(feature);
+    // these are always extracted, tracking and division features need them
+    bool used = (!feature.compare("Count")
+      || !feature.compare("Mean")
+      || !feature.compare("Variance")
+      || !feature.compare("RegionCenter"));
+    for (size_t column = offset; column < offset + size; column++) {
+      used = used or used_columns[column];
+    }
+    feature_used_.push_back(used);
+    offset += size;
+  }
+  compile_features();
+}
+
+template<int N>
+bool TraxelExtractor<N>::is_feature_used(size_t feature_index) const {
+  return feature_used_.empty() or feature_used_[feature_index];
+}
+
+template<int N>
+size_t TraxelExtractor<N>::get_used_feature_count() const {
+  size_t count = 0;
+  for (size_t i = 0; i < feature_selection_.size(); i++) {
+    if (is_feature_used(i)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+template<int N>
+void TraxelExtractor<N>::set_coordinate_offset(
+  const typename vigra::MultiArrayShape<N>::type& offset)
+{
+  coordinate_offset_ = offset;
+}
+
+template<int N>
+void TraxelExtractor<N>::set_use_presets(const bool use_presets) {
+  use_presets_ = use_presets;
+  compile_features();
 }
 
 template<int N>
@@ -137,281 +170,642 @@ int TraxelExtractor<N>::extract(
   const int timestep,
   TraxelVectorType& traxels) const
 {
-  traxels.clear();
+  ObjectFeatureTable objects;
+  const int return_status = extract(segmentation, image, timestep, objects);
+  get_traxels(objects, traxels);
+  return return_status;
+}
+
+template<int N>
+void TraxelExtractor<N>::get_traxels(
+  const ObjectFeatureTable& objects,
+  TraxelVectorType& traxels) const
+{
+  objects.get_traxels(traxels, x_scale_, y_scale_, z_scale_);
+}
+
+template<int N>
+int TraxelExtractor<N>::extract(
+  const Segmentation<N>& segmentation,
+  const vigra::MultiArrayView<N, DataType>& image,
+  const int timestep,
+  ObjectFeatureTable& objects) const
+{
+  objects.clear(timestep);
   int return_status = 0;
-  // initialize the accumulator chain
-  AccChainType acc_chain;
-  acc_chain.ignoreLabel(0);
-  // always enable com, count, mean and bounding box
-  acc_chain.template activate<acc::RegionCenter>();
-  acc_chain.template activate<acc::Count>();
-  acc_chain.template activate<acc::Mean>();
-  acc_chain.template activate<acc::Variance>();
-  acc_chain.template activate<acc::Coord<acc::Minimum> >();
-  acc_chain.template activate<acc::Coord<acc::Maximum> >();
-  // select the other features
-  select_features(acc_chain);
-  // initialize the coupled iterator
-  CoupledIteratorType start_it = vigra::createCoupledIterator(
-    segmentation.label_image_,
-    image);
-  CoupledIteratorType end_it = start_it.getEndIterator();
-  // extract the features
-  vigra::acc::extractFeatures(start_it, end_it, acc_chain);
-  // loop over all labels
-  for (size_t label_id = 1; label_id <= segmentation.label_count_; label_id++) {
-    extract_for_label(
+  const size_t label_count = segmentation.label_count_;
+  // the core features and bounding boxes of the labeling, if calculated
+  const bool has_statistics =
+    segmentation.region_statistics_.size() == label_count + 1;
+  // phase 1: discard the objects by their size and bounding box
+  std::vector<RegionStatistics<N> > computed_bounds;
+  if (!has_statistics) {
+    get_bounding_boxes(segmentation.label_image_, label_count, computed_bounds);
+  }
+  const std::vector<RegionStatistics<N> >& bounds =
+    has_statistics ? segmentation.region_statistics_ : computed_bounds;
+  std::vector<size_t> kept_labels;
+  double pixel_count = 0.0;
+  for (size_t label_id = 1; label_id <= label_count; label_id++) {
+    if (is_object_kept(bounds[label_id])) {
+      kept_labels.push_back(label_id);
+      pixel_count += bounds[label_id].count_;
+    }
+  }
+  // the columns, looked up once per frame
+  TableColumns columns;
+  for (const std::string& feature : feature_selection_) {
+    columns.selection.push_back(
+      objects.add_feature(feature, get_feature_size(feature)));
+  }
+  columns.count = objects.add_feature("count", 1);
+  columns.count_feature = objects.add_feature("Count", 1);
+  columns.com = objects.add_feature("com", 3);
+  columns.region_center = objects.add_feature("RegionCenter", N);
+  columns.coord_min = objects.add_feature("CoordMin", N);
+  columns.coord_max = objects.add_feature("CoordMax", N);
+  columns.mean = objects.add_feature("Mean", 1);
+  columns.variance = objects.add_feature("Variance", 1);
+  // the moments are only calculated if the labeling does not provide the
+  // used ones, the chain only for the principal axis features
+  const bool use_moments = !has_statistics || has_moment_features_;
+  const bool use_chain = has_principal_features_;
+  // phase 2: accumulate and fill the rows with the chain of the selection
+  if (preset_ == PrincipalPreset) {
+    PrincipalAccChainType acc_chain;
+    acc_chain.ignoreLabel(0);
+    extract_objects(
+      acc_chain,
+      principal_extractors_,
+      use_moments,
+      use_chain,
+      segmentation,
+      image,
+      bounds,
+      kept_labels,
+      pixel_count,
+      columns,
+      objects);
+  } else {
+    AccChainType acc_chain;
+    acc_chain.ignoreLabel(0);
+    select_features(acc_chain);
+    extract_objects(
       acc_chain,
-      label_id,
-      timestep,
-      traxels);
+      extractors_,
+      use_moments,
+      use_chain,
+      segmentation,
+      image,
+      bounds,
+      kept_labels,
+      pixel_count,
+      columns,
+      objects);
+  }
+  // coordinates in the frame the image was cropped from
+  if (coordinate_offset_ != typename vigra::MultiArrayShape<N>::type(0)) {
+    const ObjectFeatureTable::FeatureId coordinate_features[] = {
+      columns.com, columns.region_center, columns.coord_min, columns.coord_max};
+    for (size_t row = 0; row < objects.get_row_count(); row++) {
+      for (ObjectFeatureTable::FeatureId feature : coordinate_features) {
+        FeatureType* coordinates = objects.get(feature, row);
+        for (size_t n = 0; n < N; n++) {
+          coordinates[n] += coordinate_offset_[n];
+        }
+      }
+    }
+  }
+  // classify all objects of this frame at once
+  if (random_forests_.size() > 0) {
+    get_detection_probabilities(objects);
   }
   return return_status;
 }
 
 template<int N>
-int TraxelExtractor<N>::extract_for_label(
-  const AccChainType& acc_chain,
-  const size_t label_id,
-  const int timestep,
-  TraxelVectorType& traxels) const
+template<class CHAIN>
+void TraxelExtractor<N>::extract_objects(
+  const CHAIN& acc_chain,
+  const FeatureExtractors<CHAIN>& extractors,
+  const bool use_moments,
+  const bool use_chain,
+  const Segmentation<N>& segmentation,
+  const vigra::MultiArrayView<N, DataType>& image,
+  const std::vector<RegionStatistics<N> >& bounds,
+  const std::vector<size_t>& kept_labels,
+  const double pixel_count,
+  const TableColumns& columns,
+  ObjectFeatureTable& objects) const
 {
-  int return_status = 0;
-  // get the feature map
-  FeatureMapType feature_map;
-  fill_feature_map(acc_chain, label_id, feature_map);
-  // get the object size
-  DataType size = acc::get<acc::Count>(acc_chain, label_id);
-  // filter size
-  bool fits_lower_lim = ((lower_size_lim_ == 0) or (size >= lower_size_lim_));
-  bool fits_upper_lim = ((upper_size_lim_ == 0) or (size <= upper_size_lim_));
-  if (fits_upper_lim and fits_lower_lim) {
-    // get the count (for tracking and divion feature calculation)
-    feature_map["count"].push_back(size);
-    if (feature_map.count("Count") == 0) {
-      feature_map["Count"].push_back(size);
+  const size_t label_count = segmentation.label_count_;
+  // the kept objects are split into groups of consecutive labels with about
+  // the same number of pixels, one per thread. Every group has its own
+  // accumulator chain which only sees the objects of the group within their
+  // union bounding box, hence each object is accumulated from the same
+  // pixels in the same order as with a single chain.
+  const size_t group_count = std::max<size_t>(
+    std::min<size_t>(omp_get_max_threads(), kept_labels.size()),
+    1);
+  std::vector<size_t> group_begins(1, 0);
+  double group_pixel_count = 0.0;
+  for (size_t i = 0; i < kept_labels.size(); i++) {
+    if (group_begins.size() < group_count && i > group_begins.back()
+        && group_pixel_count >= pixel_count * group_begins.size() / group_count) {
+      group_begins.push_back(i);
+    }
+    group_pixel_count += bounds[kept_labels[i]].count_;
+  }
+  group_begins.push_back(kept_labels.size());
+  // the region of a kept label in the chain of its group
+  std::vector<LabelType> region_indices(label_count + 1, 0);
+  for (size_t group = 0; group + 1 < group_begins.size(); group++) {
+    for (size_t i = group_begins[group]; i < group_begins[group + 1]; i++) {
+      region_indices[kept_labels[i]] = i - group_begins[group] + 1;
+    }
+  }
+  std::vector<CHAIN> acc_chains(group_begins.size() - 1, acc_chain);
+  std::vector<std::vector<RegionMoments<N> > > moments(acc_chains.size());
+  // exceptions must not leave the parallel region
+  bool is_valid = true;
+  #pragma omp parallel for schedule(dynamic) reduction(&&:is_valid)
+  for (size_t group = 0; group < acc_chains.size(); group++) {
+    try {
+      const size_t region_count = group_begins[group + 1] - group_begins[group];
+      acc_chains[group].setMaxRegionLabel(region_count);
+      if (use_moments) {
+        moments[group].resize(region_count + 1);
+      }
+      if (use_moments || use_chain) {
+        accumulate_regions(
+          segmentation.label_image_,
+          image,
+          bounds,
+          kept_labels.begin() + group_begins[group],
+          kept_labels.begin() + group_begins[group + 1],
+          region_indices,
+          use_moments ? &moments[group] : 0,
+          use_chain,
+          acc_chains[group]);
+      }
+    } catch (const std::exception&) {
+      is_valid = false;
+    }
+  }
+  if (!is_valid) {
+    throw std::runtime_error("Failed to accumulate the region features");
+  }
+  // one row per kept label, filled in parallel by group
+  for (size_t label_id : kept_labels) {
+    objects.add_row(label_id);
+  }
+  #pragma omp parallel for schedule(dynamic) reduction(&&:is_valid)
+  for (size_t group = 0; group < acc_chains.size(); group++) {
+    for (size_t i = group_begins[group]; i < group_begins[group + 1]; i++) {
+      const size_t label_id = kept_labels[i];
+      const LabelType region_index = region_indices[label_id];
+      try {
+        extract_for_label(
+          acc_chains[group],
+          extractors,
+          use_moments
+            ? moments[group][region_index]
+            : RegionMoments<N>(segmentation.region_statistics_[label_id]),
+          region_index,
+          columns,
+          i,
+          objects);
+      } catch (const std::exception&) {
+        is_valid = false;
+      }
+    }
+  }
+  if (!is_valid) {
+    throw std::runtime_error("Failed to extract the region features");
+  }
+}
+
+template<int N>
+template<class CHAIN>
+void TraxelExtractor<N>::accumulate_regions(
+  const vigra::MultiArrayView<N, LabelType>& label_image,
+  const vigra::MultiArrayView<N, DataType>& image,
+  const std::vector<RegionStatistics<N> >& bounds,
+  const std::vector<size_t>::const_iterator labels_begin,
+  const std::vector<size_t>::const_iterator labels_end,
+  const std::vector<LabelType>& region_indices,
+  std::vector<RegionMoments<N> >* moments,
+  const bool use_chain,
+  CHAIN& acc_chain) const
+{
+  typedef typename vigra::MultiArrayShape<N>::type ShapeType;
+  if (labels_begin == labels_end) {
+    return;
+  }
+  // the union bounding box
+  ShapeType box_min(image.shape()), box_max(0);
+  for (std::vector<size_t>::const_iterator it = labels_begin;
+       it != labels_end; it++) {
+    for (size_t n = 0; n < N && bounds[*it].count_ > 0; n++) {
+      box_min[n] = std::min<std::ptrdiff_t>(
+        box_min[n],
+        bounds[*it].coordinate_min_[n]);
+      box_max[n] = std::max<std::ptrdiff_t>(
+        box_max[n],
+        bounds[*it].coordinate_max_[n] + 1);
     }
-    // get the region center (maybe once again)
-    set_feature(
-      feature_map,
-      "com",
-      acc::get<acc::RegionCenter>(acc_chain, label_id));
-    if (feature_map.count("RegionCenter") == 0) {
-      set_feature(
-        feature_map,
-        "RegionCenter",
-        acc::get<acc::RegionCenter>(acc_chain, label_id));
+  }
+  for (size_t n = 0; n < N; n++) {
+    if (box_min[n] >= box_max[n]) {
+      return;
     }
-    // get the bounding box
-    set_feature(
-      feature_map,
-      "CoordMin",
-      acc::get<acc::Coord<acc::Minimum> >(acc_chain, label_id));
-    set_feature(
-      feature_map,
-      "CoordMax",
-      acc::get<acc::Coord<acc::Maximum> >(acc_chain, label_id));
-    if (feature_map["com"].size() == 2) {
-      feature_map["com"].push_back(0.0);
+  }
+  // the labels are sorted, other labels within the box get region 0
+  const size_t first_label = *labels_begin;
+  const size_t last_label = *(labels_end - 1);
+  const vigra::MultiArrayView<N, LabelType> box_labels =
+    label_image.subarray(box_min, box_max);
+  vigra::MultiArray<N, LabelType> region_image(box_labels.shape());
+  typename vigra::MultiArray<N, LabelType>::iterator r_it =
+    region_image.begin();
+  for (typename vigra::MultiArrayView<N, LabelType>::const_iterator l_it =
+      box_labels.begin(); l_it != box_labels.end(); l_it++, r_it++) {
+    const bool in_group = *l_it >= first_label && *l_it <= last_label;
+    *r_it = in_group ? region_indices[*l_it] : 0;
+  }
+  if (moments) {
+    get_region_moments<N>(
+      region_image,
+      image.subarray(box_min, box_max),
+      box_min,
+      *moments);
+  }
+  if (use_chain) {
+    acc_chain.setCoordinateOffset(box_min);
+    // initialize the coupled iterator
+    CoupledIteratorType start_it = vigra::createCoupledIterator(
+      region_image,
+      image.subarray(box_min, box_max));
+    CoupledIteratorType end_it = start_it.getEndIterator();
+    // extract the features
+    vigra::acc::extractFeatures(start_it, end_it, acc_chain);
+  }
+}
+
+template<int N>
+void TraxelExtractor<N>::get_bounding_boxes(
+  const vigra::MultiArrayView<N, LabelType>& label_image,
+  const size_t label_count,
+  std::vector<RegionStatistics<N> >& bounds)
+{
+  bounds.assign(label_count + 1, RegionStatistics<N>());
+  for (typename vigra::MultiArrayView<N, LabelType>::const_iterator it =
+      label_image.begin(); it != label_image.end(); it++) {
+    if (*it == 0 || *it > label_count) {
+      continue;
     }
-    // get the mean
-    if (feature_map.count("Mean") == 0) {
-      set_feature(
-        feature_map,
-        "Mean",
-        acc::get<acc::Mean>(acc_chain, label_id));
+    RegionStatistics<N>& region = bounds[*it];
+    region.count_ += 1.0;
+    for (size_t n = 0; n < N; n++) {
+      region.coordinate_min_[n] = std::min<double>(
+        region.coordinate_min_[n],
+        it.point()[n]);
+      region.coordinate_max_[n] = std::max<double>(
+        region.coordinate_max_[n],
+        it.point()[n]);
     }
-    // get the variance
-    if (feature_map.count("Variance") == 0) {
-      set_feature(
-        feature_map,
-        "Variance",
-        acc::get<acc::Variance>(acc_chain, label_id));
+  }
+}
+
+template<int N>
+bool TraxelExtractor<N>::is_object_kept(
+  const RegionStatistics<N>& bounds) const
+{
+  // filter size
+  const DataType size = bounds.count_;
+  bool fits_lower_lim = ((lower_size_lim_ == 0) or (size >= lower_size_lim_));
+  bool fits_upper_lim = ((upper_size_lim_ == 0) or (size <= upper_size_lim_));
+  if (!(fits_upper_lim and fits_lower_lim)) {
+    return false;
+  }
+  // same test as Lineage::restrict_to_bounding_box
+  if (discard_outside_ && bounds.count_ > 0) {
+    for (size_t n = 0; n < N; n++) {
+      const double coord_min = bounds.coordinate_min_[n] + coordinate_offset_[n];
+      const double coord_max = bounds.coordinate_max_[n] + coordinate_offset_[n];
+      if (coord_max < field_of_view_min_[n]
+          || coord_min > field_of_view_max_[n]) {
+        return false;
+      }
     }
-    if (random_forests_.size() > 0) {
-      get_detection_probability(feature_map);
+  }
+  return true;
+}
+
+template<int N>
+template<class CHAIN>
+int TraxelExtractor<N>::extract_for_label(
+  const CHAIN& acc_chain,
+  const FeatureExtractors<CHAIN>& extractors,
+  const RegionMoments<N>& moments,
+  const size_t region_index,
+  const TableColumns& columns,
+  const size_t row,
+  ObjectFeatureTable& objects) const
+{
+  int return_status = 0;
+  // the selected features, the rows of unused features stay zero
+  for (size_t i = 0; i < extractors.selection.size(); i++) {
+    if (extractors.selection[i]) {
+      extractors.selection[i](
+        acc_chain,
+        moments,
+        region_index,
+        objects.get(columns.selection[i], row));
     }
-    // Its ok to use "new" since the Traxel class handles the
-    // destruction of the locator
-    typedef pgmlink::ComLocator LocatorType;
-    LocatorType* l_ptr = new LocatorType;
-    l_ptr->x_scale = x_scale_;
-    l_ptr->y_scale = y_scale_;
-    l_ptr->z_scale = z_scale_;
-    // create the traxel and add it to the traxel store
-    pgmlink::Traxel traxel(label_id, timestep, feature_map, l_ptr);
-    traxels.push_back(traxel);
   }
+  // get the count (for tracking and divion feature calculation)
+  extractors.count(
+    acc_chain,
+    moments,
+    region_index,
+    objects.get(columns.count, row));
+  extractors.count(
+    acc_chain,
+    moments,
+    region_index,
+    objects.get(columns.count_feature, row));
+  // get the region center (maybe once again), com has 3 entries
+  extractors.region_center(
+    acc_chain,
+    moments,
+    region_index,
+    objects.get(columns.com, row));
+  extractors.region_center(
+    acc_chain,
+    moments,
+    region_index,
+    objects.get(columns.region_center, row));
+  // get the bounding box
+  extractors.coord_min(
+    acc_chain,
+    moments,
+    region_index,
+    objects.get(columns.coord_min, row));
+  extractors.coord_max(
+    acc_chain,
+    moments,
+    region_index,
+    objects.get(columns.coord_max, row));
+  // get the mean and the variance
+  extractors.mean(
+    acc_chain,
+    moments,
+    region_index,
+    objects.get(columns.mean, row));
+  extractors.variance(
+    acc_chain,
+    moments,
+    region_index,
+    objects.get(columns.variance, row));
   return return_status;
 }
 
 template<int N>
-int TraxelExtractor<N>::select_features(
-  AccChainType& acc_chain) const
-{
-  int ret = 0;
-  for (std::string feature : feature_selection_) {
-    if (!feature.compare("Coord<Principal<Kurtosis> >")) {
-      acc_chain.template activate<acc::Coord<acc::Principal<acc::Kurtosis> > >();
-    } else if (!feature.compare("Coord<Principal<Skewness> >")) {
-      acc_chain.template activate<acc::Coord<acc::Principal<acc::Skewness> > >();
-    } else if (!feature.compare("Count")) {
-      acc_chain.template activate<acc::Count>();
-    } else if (!feature.compare("Kurtosis")) {
-      acc_chain.template activate<acc::Kurtosis>();
-    } else if (!feature.compare("Maximum")) {
-      acc_chain.template activate<acc::Maximum>();
-    } else if (!feature.compare("Mean")) {
-      acc_chain.template activate<acc::Mean>();
-    } else if (!feature.compare("Minimum")) {
-      acc_chain.template activate<acc::Minimum>();
-    } else if (!feature.compare("RegionCenter")) {
-      acc_chain.template activate<acc::RegionCenter>();
-    } else if (!feature.compare("RegionRadii")) {
-      acc_chain.template activate<acc::RegionRadii>();
-    } else if (!feature.compare("Skewness")) {
-      acc_chain.template activate<acc::Skewness>();
-    } else if (!feature.compare("Sum")) {
-      acc_chain.template activate<acc::Sum>();
-    } else if (!feature.compare("Variance")) {
-      acc_chain.template activate<acc::Variance>();
-    } else {
-      throw std::runtime_error("Unknown feature \"" + feature + "\"");
-      ret = 1;
+bool TraxelExtractor<N>::is_core_feature(const std::string& feature_name) {
+  return (!feature_name.compare("Count")
+    || !feature_name.compare("Mean")
+    || !feature_name.compare("Variance")
+    || !feature_name.compare("RegionCenter"));
+}
+
+template<int N>
+bool TraxelExtractor<N>::is_principal_feature(const std::string& feature_name) {
+  return (!feature_name.compare("Coord<Principal<Kurtosis> >")
+    || !feature_name.compare("Coord<Principal<Skewness> >")
+    || !feature_name.compare("RegionRadii"));
+}
+
+template<int N>
+void TraxelExtractor<N>::compile_features() {
+  activators_.clear();
+  has_moment_features_ = false;
+  has_principal_features_ = false;
+  size_t principal_feature_count = 0;
+  for (size_t i = 0; i < feature_selection_.size(); i++) {
+    const std::string& feature = feature_selection_[i];
+    // throws for unknown features
+    get_extractor<AccChainType>(feature);
+    const bool principal = is_principal_feature(feature);
+    activators_.push_back(is_feature_used(i) ? get_activator(feature) : 0);
+    if (is_feature_used(i) && principal) {
+      has_principal_features_ = true;
+      principal_feature_count++;
+    } else if (is_feature_used(i) && !is_core_feature(feature)) {
+      has_moment_features_ = true;
     }
   }
-  return ret;
+  // the static chain calculates all principal axis features
+  preset_ = NoPreset;
+  if (use_presets_ && principal_feature_count == 3) {
+    preset_ = PrincipalPreset;
+  }
+  compile_extractors(extractors_, &get_extractor<AccChainType>);
+  if (preset_ == PrincipalPreset) {
+    compile_extractors(
+      principal_extractors_,
+      &get_extractor<PrincipalAccChainType>);
+  }
 }
 
 template<int N>
-int TraxelExtractor<N>::fill_feature_map(
-  const AccChainType& acc_chain,
-  const size_t label_id,
-  FeatureMapType& feature_map) const
+template<class CHAIN>
+void TraxelExtractor<N>::compile_extractors(
+  FeatureExtractors<CHAIN>& extractors,
+  typename FeatureExtractors<CHAIN>::ExtractorType (*lookup)(
+    const std::string&)) const
 {
-  int ret = 0;
+  typedef RegionMoments<N> MomentsType;
+  extractors.selection.clear();
+  for (size_t i = 0; i < feature_selection_.size(); i++) {
+    extractors.selection.push_back(
+      is_feature_used(i) ? lookup(feature_selection_[i]) : 0);
+  }
+  extractors.count = &get_moment<CHAIN, &MomentsType::get_count>;
+  extractors.region_center =
+    &get_coordinates<CHAIN, &MomentsType::get_center>;
+  extractors.coord_min =
+    &get_coordinates<CHAIN, &MomentsType::get_coordinate_min>;
+  extractors.coord_max =
+    &get_coordinates<CHAIN, &MomentsType::get_coordinate_max>;
+  extractors.mean = &get_moment<CHAIN, &MomentsType::get_mean>;
+  extractors.variance = &get_moment<CHAIN, &MomentsType::get_variance>;
+}
+
+template<int N>
+typename TraxelExtractor<N>::ActivatorType TraxelExtractor<N>::get_activator(
+  const std::string& feature_name)
+{
+  if (!feature_name.compare("Coord<Principal<Kurtosis> >")) {
+    return &activate<acc::Coord<acc::Principal<acc::Kurtosis> > >;
+  } else if (!feature_name.compare("Coord<Principal<Skewness> >")) {
+    return &activate<acc::Coord<acc::Principal<acc::Skewness> > >;
+  } else if (!feature_name.compare("RegionRadii")) {
+    return &activate<acc::RegionRadii>;
+  } else {
+    return 0;
+  }
+}
+
+template<int N>
+template<class CHAIN>
+typename TraxelExtractor<N>::template FeatureExtractors<CHAIN>::ExtractorType
+TraxelExtractor<N>::get_moment_extractor(const std::string& feature_name) {
+  typedef RegionMoments<N> MomentsType;
+  if (!feature_name.compare("Count")) {
+    return &get_moment<CHAIN, &MomentsType::get_count>;
+  } else if (!feature_name.compare("Kurtosis")) {
+    return &get_moment<CHAIN, &MomentsType::get_kurtosis>;
+  } else if (!feature_name.compare("Maximum")) {
+    return &get_moment<CHAIN, &MomentsType::get_maximum>;
+  } else if (!feature_name.compare("Mean")) {
+    return &get_moment<CHAIN, &MomentsType::get_mean>;
+  } else if (!feature_name.compare("Minimum")) {
+    return &get_moment<CHAIN, &MomentsType::get_minimum>;
+  } else if (!feature_name.compare("RegionCenter")) {
+    return &get_coordinates<CHAIN, &MomentsType::get_center>;
+  } else if (!feature_name.compare("Skewness")) {
+    return &get_moment<CHAIN, &MomentsType::get_skewness>;
+  } else if (!feature_name.compare("Sum")) {
+    return &get_moment<CHAIN, &MomentsType::get_sum>;
+  } else if (!feature_name.compare("Variance")) {
+    return &get_moment<CHAIN, &MomentsType::get_variance>;
+  } else {
+    return 0;
+  }
+}
+
+template<int N>
+template<class CHAIN>
+typename TraxelExtractor<N>::template FeatureExtractors<CHAIN>::ExtractorType
+TraxelExtractor<N>::get_extractor(const std::string& feature_name) {
   // local typedefs
   typedef acc::Coord<acc::Principal<acc::Kurtosis> > CoordPK;
   typedef acc::Coord<acc::Principal<acc::Skewness> > CoordPS;
-  for (std::string feature : feature_selection_) {
-    if (!feature.compare("Coord<Principal<Kurtosis> >")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<CoordPK>(acc_chain, label_id));
-    } else if (!feature.compare("Coord<Principal<Skewness> >")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<CoordPS>(acc_chain, label_id));
-    } else if (!feature.compare("Count")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<acc::Count>(acc_chain, label_id));
-    } else if (!feature.compare("Kurtosis")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<acc::Kurtosis>(acc_chain, label_id));
-    } else if (!feature.compare("Maximum")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<acc::Maximum>(acc_chain, label_id));
-    } else if (!feature.compare("Mean")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<acc::Mean>(acc_chain, label_id));
-    } else if (!feature.compare("Minimum")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<acc::Minimum>(acc_chain, label_id));
-    } else if (!feature.compare("RegionCenter")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<acc::RegionCenter>(acc_chain, label_id));
-      if (feature_map["com"].size() == 2) {
-        feature_map["com"].push_back(0.0);
-      }
-    } else if (!feature.compare("RegionRadii")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<acc::RegionRadii>(acc_chain, label_id));
-    } else if (!feature.compare("Skewness")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<acc::Skewness>(acc_chain, label_id));
-    } else if (!feature.compare("Sum")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<acc::Sum>(acc_chain, label_id));
-    } else if (!feature.compare("Variance")) {
-      set_feature(
-        feature_map,
-        feature,
-        acc::get<acc::Variance>(acc_chain, label_id));
-    } else {
-      throw std::runtime_error("Unknown region feature \"" + feature + "\"");
-      ret = 1;
+  if (!feature_name.compare("Coord<Principal<Kurtosis> >")) {
+    return &get_feature<CHAIN, CoordPK>;
+  } else if (!feature_name.compare("Coord<Principal<Skewness> >")) {
+    return &get_feature<CHAIN, CoordPS>;
+  } else if (!feature_name.compare("RegionRadii")) {
+    return &get_feature<CHAIN, acc::RegionRadii>;
+  } else if (get_moment_extractor<CHAIN>(feature_name)) {
+    return get_moment_extractor<CHAIN>(feature_name);
+  } else {
+    throw std::runtime_error("Unknown region feature \"" + feature_name + "\"");
+  }
+}
+
+template<int N>
+template<class TAG>
+void TraxelExtractor<N>::activate(AccChainType& acc_chain) {
+  acc_chain.template activate<TAG>();
+}
+
+template<int N>
+template<class CHAIN, class TAG>
+void TraxelExtractor<N>::get_feature(
+  const CHAIN& acc_chain,
+  const RegionMoments<N>& moments,
+  const size_t region_index,
+  FeatureType* values)
+{
+  set_values(values, acc::get<TAG>(acc_chain, region_index));
+}
+
+template<int N>
+template<class CHAIN, typename TraxelExtractor<N>::MomentGetterType GETTER>
+void TraxelExtractor<N>::get_moment(
+  const CHAIN& acc_chain,
+  const RegionMoments<N>& moments,
+  const size_t region_index,
+  FeatureType* values)
+{
+  set_values(values, (moments.*GETTER)());
+}
+
+template<int N>
+template<class CHAIN, typename TraxelExtractor<N>::CoordinateGetterType GETTER>
+void TraxelExtractor<N>::get_coordinates(
+  const CHAIN& acc_chain,
+  const RegionMoments<N>& moments,
+  const size_t region_index,
+  FeatureType* values)
+{
+  set_values(values, (moments.*GETTER)());
+}
+
+template<int N>
+int TraxelExtractor<N>::select_features(AccChainType& acc_chain) const {
+  for (const ActivatorType activator : activators_) {
+    // unused features are filled with zeros, the others are moments
+    if (activator) {
+      activator(acc_chain);
     }
   }
-  return ret;
+  return 0;
 }
 
 template<int N>
-int TraxelExtractor<N>::get_detection_probability(
-  FeatureMapType& feature_map) const
+int TraxelExtractor<N>::get_detection_probabilities(
+  ObjectFeatureTable& objects) const
 {
   if(random_forests_.size() < 1){
     throw std::runtime_error("Cannot extract detection probability without RF");
   }
-  // get the size of the feature vector
-  size_t feature_size = 0;
-  for(std::string feature : feature_selection_) {
-    FeatureMapType::const_iterator f_it = feature_map.find(feature);
-    if (f_it == feature_map.end()) {
-      throw std::runtime_error("Feature \"" + feature + "\" not found");
-    } else {
-      feature_size += (f_it->second).size();
+  // one row of features per object
+  vigra::MultiArray<2, FeatureType> features;
+  get_feature_matrix(objects, feature_selection_, features);
+  // evaluate the random forests
+  vigra::MultiArray<2, FeatureType> probabilities;
+  predict_forest_probabilities(
+    random_forests_,
+    flat_forests_,
+    features,
+    probabilities);
+  // fill the detection probabilities
+  const ObjectFeatureTable::FeatureId det_prob =
+    objects.add_feature("detProb", probabilities.shape(1));
+  #pragma omp parallel for
+  for (size_t row = 0; row < objects.get_row_count(); row++) {
+    FeatureType* det_array = objects.get(det_prob, row);
+    for (int l = 0; l < probabilities.shape(1); l++) {
+      det_array[l] = probabilities(row, l);
     }
   }
-  // get all features into one multi array
-  size_t offset = 0;
-  vigra::MultiArray<2, FeatureType> features(vigra::Shape2(1, feature_size));
-  for(std::string feature : feature_selection_) {
-    FeatureMapType::const_iterator f_it = feature_map.find(feature);
-    size_t size = (f_it->second).size();
-    vigra::MultiArrayView<2, FeatureType> features_view = features.subarray(
-      vigra::Shape2(0, offset),
-      vigra::Shape2(1, offset+size));
-    copy_vector(f_it->second, features_view);
-    offset += size;
+  return 0;
+}
+
+////
+//// coordinate maps
+////
+std::vector<CoordinateMapPtrType> get_thread_coordinate_maps() {
+  std::vector<CoordinateMapPtrType> thread_maps(omp_get_max_threads());
+  for (CoordinateMapPtrType& thread_map : thread_maps) {
+    thread_map.reset(new CoordinateMapType);
   }
-  // evaluate the random forests
-  size_t num_classes = random_forests_[0].ext_param_.class_count_;
-  vigra::MultiArray<2, FeatureType> probabilities(
-    vigra::Shape2(1, num_classes),
-    0.0);
-  for (size_t n = 0; n < random_forests_.size(); n++) {
-    vigra::MultiArray<2, FeatureType> probabilities_temp(
-      vigra::Shape2(1, num_classes));
-    random_forests_[n].predictProbabilities(features, probabilities_temp);
-    probabilities += probabilities_temp;
-  }
-  // fill the feature map
-  FeatureArrayType& det_array = feature_map["detProb"];
-  det_array.clear();
-  for (auto it = probabilities.begin(); it != probabilities.end(); it++) {
-    det_array.push_back(*it);
+  return thread_maps;
+}
+
+void merge_coordinate_maps(
+  const std::vector<CoordinateMapPtrType>& thread_maps,
+  CoordinateMapPtrType coordinate_map_ptr)
+{
+  for (const CoordinateMapPtrType& thread_map : thread_maps) {
+    coordinate_map_ptr->insert(
+      std::make_move_iterator(thread_map->begin()),
+      std::make_move_iterator(thread_map->end()));
+    thread_map->clear();
   }
-  return 0;
 }
 
 // explicit instantiation
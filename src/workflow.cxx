@@ -117,12 +117,21 @@ void load_forests(
 
 void load_features(
   StringDataPairVectorType& feature_list,
+  std::vector<FilterBackend>& backends,
   const PathType path)
 {
-  int read_status = read_features_from_file(path.string(), feature_list);
+  std::vector<std::string> backend_names;
+  int read_status = read_features_from_file(
+    path.string(),
+    feature_list,
+    backend_names);
   if (read_status == 1) {
     throw std::runtime_error("could not read feature file " + path.string());
   }
+  backends.clear();
+  for (size_t i = 0; i < backend_names.size(); i++) {
+    backends.push_back(get_filter_backend(backend_names[i]));
+  }
 }
 
 void load_features(
@@ -193,7 +202,7 @@ void Workflow::init(int argc, char* argv[]) {
   load_forests(div_feature_rfs_, classifier_file, "DivisionDetection");
   // load the feature files
   if (calculate_segmentation_) {
-    load_features(pix_feature_list_, pix_feature_file);
+    load_features(pix_feature_list_, pix_feature_backends_, pix_feature_file);
   }
   load_features(cnt_feature_list_, cnt_feature_file);
   load_features(div_feature_list_, div_feature_file);
@@ -0,0 +1,211 @@
+// stl
+#include <iostream>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+// openmp
+#include <omp.h>
+
+// vigra
+#include <vigra/multi_array.hxx>
+#include <vigra/multi_labeling.hxx> /* for labelMultiArrayWithBackground */
+#include <vigra/multi_convolution.hxx> /* for gaussianSmoothMultiArray */
+#include <vigra/accumulator.hxx>
+
+// own
+#include "common.h"
+#include "connected_components.hxx"
+
+namespace isbi = isbi_pipeline;
+namespace acc = vigra::acc;
+
+// uniform noise, smoothed with scale if it is positive so that the
+// components span many rows and slabs
+template<int N>
+void fill_random(
+  const unsigned int seed,
+  const double scale,
+  vigra::MultiArray<N, isbi::DataType>& values)
+{
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<isbi::DataType> distribution(0.0, 1.0);
+  for (std::ptrdiff_t n = 0; n < values.size(); n++) {
+    values[n] = distribution(generator);
+  }
+  if (scale > 0.0) {
+    vigra::MultiArray<N, isbi::DataType> noise(values);
+    vigra::gaussianSmoothMultiArray(
+      srcMultiArrayRange(noise),
+      destMultiArray(values),
+      scale);
+  }
+}
+
+// the value below which the given fraction of values lies
+template<int N>
+isbi::DataType get_quantile(
+  const vigra::MultiArray<N, isbi::DataType>& values,
+  const double fraction)
+{
+  std::vector<isbi::DataType> sorted(values.begin(), values.end());
+  std::sort(sorted.begin(), sorted.end());
+  return sorted[static_cast<size_t>(fraction * (sorted.size() - 1))];
+}
+
+bool is_close(const double value, const double reference) {
+  return std::abs(value - reference)
+    <= 1e-9 * std::max(1.0, std::abs(reference));
+}
+
+// Compare the labels of label_above_threshold with those of vigra on the
+// thresholded values, with and without the region statistics, and the
+// statistics with the vigra accumulators. Returns the number of failures.
+template<int N>
+size_t compare_with_vigra(
+  const vigra::MultiArray<N, isbi::DataType>& values,
+  const isbi::DataType threshold,
+  const std::vector<int>& thread_counts)
+{
+  typedef typename isbi::RegionStatistics<N>::CoordinateType CoordinateType;
+  // reference labels and statistics
+  vigra::MultiArray<N, vigra::UInt8> mask(values.shape());
+  for (std::ptrdiff_t n = 0; n < values.size(); n++) {
+    mask[n] = values[n] > threshold;
+  }
+  vigra::MultiArray<N, isbi::LabelType> reference(values.shape());
+  const size_t reference_count = vigra::labelMultiArrayWithBackground(
+    mask,
+    reference,
+    vigra::IndirectNeighborhood,
+    vigra::UInt8(0));
+  typedef acc::AccumulatorChainArray<
+    vigra::CoupledArrays<N, isbi::DataType, isbi::LabelType>,
+    acc::Select<
+      acc::DataArg<1>,
+      acc::LabelArg<2>,
+      acc::Count,
+      acc::Mean,
+      acc::Variance,
+      acc::RegionCenter,
+      acc::Coord<acc::Minimum>,
+      acc::Coord<acc::Maximum> >
+  > ChainType;
+  ChainType acc_chain;
+  acc_chain.ignoreLabel(0);
+  acc::extractFeatures(values, reference, acc_chain);
+
+  size_t failures = 0;
+  for (const int thread_count : thread_counts) {
+    omp_set_num_threads(thread_count);
+    vigra::MultiArray<N, isbi::LabelType> labels(values.shape());
+    const size_t count = isbi::label_above_threshold<N>(
+      values,
+      threshold,
+      labels);
+    vigra::MultiArray<N, isbi::LabelType> labels_with_statistics(
+      values.shape());
+    std::vector<isbi::RegionStatistics<N> > statistics;
+    const size_t count_with_statistics = isbi::label_above_threshold<N>(
+      values,
+      threshold,
+      labels_with_statistics,
+      values,
+      statistics);
+    // the labels
+    bool is_equal = count == reference_count
+      && count_with_statistics == reference_count
+      && labels == reference
+      && labels_with_statistics == reference
+      && statistics.size() == reference_count + 1;
+    // the statistics
+    size_t differing_count = 0;
+    for (size_t label = 1; is_equal && label <= reference_count; label++) {
+      const isbi::RegionStatistics<N>& region = statistics[label];
+      bool is_region_equal =
+        region.count_ == acc::get<acc::Count>(acc_chain, label)
+        && is_close(region.mean_, acc::get<acc::Mean>(acc_chain, label))
+        && is_close(
+          region.get_variance(),
+          acc::get<acc::Variance>(acc_chain, label));
+      const CoordinateType center = region.get_center();
+      const CoordinateType coordinate_min =
+        acc::get<acc::Coord<acc::Minimum> >(acc_chain, label);
+      const CoordinateType coordinate_max =
+        acc::get<acc::Coord<acc::Maximum> >(acc_chain, label);
+      for (int n = 0; n < N; n++) {
+        is_region_equal = is_region_equal
+          && is_close(
+            center[n],
+            acc::get<acc::RegionCenter>(acc_chain, label)[n])
+          && region.coordinate_min_[n] == coordinate_min[n]
+          && region.coordinate_max_[n] == coordinate_max[n];
+      }
+      if (!is_region_equal) {
+        differing_count++;
+      }
+    }
+    std::cout << "\t" << thread_count << " threads: " << count << " of "
+      << reference_count << " components";
+    if (!is_equal) {
+      std::cout << ", labels differ from vigra" << std::endl;
+      failures++;
+    } else if (differing_count > 0) {
+      std::cout << ", statistics of " << differing_count
+        << " components differ from vigra" << std::endl;
+      failures++;
+    } else {
+      std::cout << ", ok" << std::endl;
+    }
+  }
+  return failures;
+}
+
+// random masks of several densities, from isolated pixels to components
+// that cross every slab border
+template<int N>
+size_t test_random_masks(
+  const typename vigra::MultiArrayShape<N>::type& shape,
+  const std::vector<int>& thread_counts)
+{
+  const double scales[] = {0.0, 1.5};
+  const double fractions[] = {0.3, 0.5, 0.8};
+  size_t failures = 0;
+  unsigned int seed = 42;
+  for (const double scale : scales) {
+    vigra::MultiArray<N, isbi::DataType> values(shape);
+    fill_random<N>(seed++, scale, values);
+    for (const double fraction : fractions) {
+      std::cout << N << "D " << shape << ", smoothing " << scale
+        << ", background fraction " << fraction << std::endl;
+      failures += compare_with_vigra<N>(
+        values,
+        get_quantile<N>(values, fraction),
+        thread_counts);
+    }
+  }
+  return failures;
+}
+
+int main() {
+  const int max_thread_count = omp_get_max_threads();
+  // one slab, a few slabs and as many slabs as the machine has threads
+  std::vector<int> thread_counts;
+  thread_counts.push_back(1);
+  thread_counts.push_back(2);
+  thread_counts.push_back(3);
+  if (max_thread_count > 3) {
+    thread_counts.push_back(max_thread_count);
+  }
+  size_t failures = 0;
+  failures += test_random_masks<2>(vigra::Shape2(211, 157), thread_counts);
+  failures += test_random_masks<3>(vigra::Shape3(47, 39, 31), thread_counts);
+  omp_set_num_threads(max_thread_count);
+  if (failures > 0) {
+    std::cout << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "all tests passed" << std::endl;
+  return 0;
+}
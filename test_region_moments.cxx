@@ -0,0 +1,404 @@
+// stl
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+// openmp
+#include <omp.h>
+
+// vigra
+#include <vigra/multi_array.hxx>
+#include <vigra/multi_convolution.hxx> /* for gaussianSmoothMultiArray */
+#include <vigra/accumulator.hxx>
+
+// own
+#include "common.h"
+#include "pipeline_helpers.hxx" /* for TrackingOptions */
+#include "connected_components.hxx"
+#include "region_moments.hxx"
+#include "object_feature_table.hxx"
+#include "traxel_extractor.hxx"
+
+namespace isbi = isbi_pipeline;
+namespace acc = vigra::acc;
+
+// uniform noise, smoothed with scale if it is positive
+template<int N>
+void fill_random(
+  const unsigned int seed,
+  const double scale,
+  vigra::MultiArray<N, isbi::DataType>& values)
+{
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<isbi::DataType> distribution(0.0, 1.0);
+  for (std::ptrdiff_t n = 0; n < values.size(); n++) {
+    values[n] = distribution(generator);
+  }
+  if (scale > 0.0) {
+    vigra::MultiArray<N, isbi::DataType> noise(values);
+    vigra::gaussianSmoothMultiArray(
+      srcMultiArrayRange(noise),
+      destMultiArray(values),
+      scale);
+  }
+}
+
+// true if both are nan or they differ by at most tolerance relative to the
+// reference
+bool is_close(
+  const double value,
+  const double reference,
+  const double tolerance)
+{
+  if (std::isnan(value) || std::isnan(reference)) {
+    return std::isnan(value) && std::isnan(reference);
+  }
+  return std::abs(value - reference)
+    <= tolerance * std::max(1.0, std::abs(reference));
+}
+
+// The components of smoothed noise above its median with the intensities of
+// fresh noise, the first one with constant intensity, and every 97th pixel
+// as a region of its own. Returns the number of regions.
+template<int N>
+size_t fill_regions(
+  const unsigned int seed,
+  vigra::MultiArray<N, isbi::LabelType>& labels,
+  vigra::MultiArray<N, isbi::DataType>& image)
+{
+  fill_random<N>(seed, 1.5, image);
+  std::vector<isbi::DataType> sorted(image.begin(), image.end());
+  std::nth_element(
+    sorted.begin(),
+    sorted.begin() + sorted.size() / 2,
+    sorted.end());
+  size_t label_count = isbi::label_above_threshold<N>(
+    image,
+    sorted[sorted.size() / 2],
+    labels);
+  fill_random<N>(seed + 1, 0.0, image);
+  for (std::ptrdiff_t n = 0; n < image.size(); n++) {
+    if (labels[n] == 1) {
+      image[n] = 0.5;
+    }
+  }
+  for (std::ptrdiff_t n = 0; n < labels.size(); n += 97) {
+    labels[n] = ++label_count;
+  }
+  return label_count;
+}
+
+// Compare get_region_moments on the views with the vigra accumulators.
+// Returns the number of failures.
+template<int N>
+size_t compare_with_vigra(
+  const vigra::MultiArrayView<N, isbi::LabelType>& labels,
+  const vigra::MultiArrayView<N, isbi::DataType>& image,
+  const size_t label_count,
+  const typename vigra::MultiArrayShape<N>::type& offset,
+  const std::string& description)
+{
+  typedef typename isbi::RegionMoments<N>::CoordinateType CoordinateType;
+  typedef acc::AccumulatorChainArray<
+    vigra::CoupledArrays<N, isbi::DataType, isbi::LabelType>,
+    acc::Select<
+      acc::DataArg<1>,
+      acc::LabelArg<2>,
+      acc::Count,
+      acc::Sum,
+      acc::Mean,
+      acc::Variance,
+      acc::Skewness,
+      acc::Kurtosis,
+      acc::Minimum,
+      acc::Maximum,
+      acc::RegionCenter,
+      acc::Coord<acc::Minimum>,
+      acc::Coord<acc::Maximum> >
+  > ChainType;
+  ChainType acc_chain;
+  acc_chain.ignoreLabel(0);
+  acc_chain.setMaxRegionLabel(label_count);
+  acc::extractFeatures(image, labels, acc_chain);
+
+  std::vector<isbi::RegionMoments<N> > moments(label_count + 1);
+  isbi::get_region_moments<N>(labels, image, offset, moments);
+
+  size_t region_count = 0;
+  size_t differing_count = 0;
+  for (size_t label = 1; label <= label_count; label++) {
+    // regions that the view does not hit
+    const double count = acc::get<acc::Count>(acc_chain, label);
+    if (count == 0.0) {
+      continue;
+    }
+    region_count++;
+    const isbi::RegionMoments<N>& region = moments[label];
+    bool is_region_equal = region.get_count() == count
+      && is_close(region.get_sum(), acc::get<acc::Sum>(acc_chain, label), 1e-9)
+      && is_close(
+        region.get_mean(),
+        acc::get<acc::Mean>(acc_chain, label),
+        1e-9)
+      && is_close(
+        region.get_variance(),
+        acc::get<acc::Variance>(acc_chain, label),
+        1e-9)
+      && region.get_minimum() == acc::get<acc::Minimum>(acc_chain, label)
+      && region.get_maximum() == acc::get<acc::Maximum>(acc_chain, label);
+    // undefined for constant intensities and single pixels
+    if (acc::get<acc::Variance>(acc_chain, label) > 0.0) {
+      is_region_equal = is_region_equal
+        && is_close(
+          region.get_skewness(),
+          acc::get<acc::Skewness>(acc_chain, label),
+          1e-6)
+        && is_close(
+          region.get_kurtosis(),
+          acc::get<acc::Kurtosis>(acc_chain, label),
+          1e-6);
+    }
+    const CoordinateType center = region.get_center();
+    const CoordinateType coordinate_min = region.get_coordinate_min();
+    const CoordinateType coordinate_max = region.get_coordinate_max();
+    for (int n = 0; n < N; n++) {
+      is_region_equal = is_region_equal
+        && is_close(
+          center[n],
+          acc::get<acc::RegionCenter>(acc_chain, label)[n] + offset[n],
+          1e-9)
+        && coordinate_min[n]
+          == acc::get<acc::Coord<acc::Minimum> >(acc_chain, label)[n]
+            + offset[n]
+        && coordinate_max[n]
+          == acc::get<acc::Coord<acc::Maximum> >(acc_chain, label)[n]
+            + offset[n];
+    }
+    if (!is_region_equal) {
+      differing_count++;
+    }
+  }
+  std::cout << "\t" << description << ": " << region_count << " regions";
+  if (differing_count > 0) {
+    std::cout << ", moments of " << differing_count
+      << " regions differ from vigra" << std::endl;
+    return 1;
+  }
+  std::cout << ", ok" << std::endl;
+  return 0;
+}
+
+// the moments of contiguous, shifted, transposed and subsampled views
+template<int N>
+size_t test_views(const typename vigra::MultiArrayShape<N>::type& shape) {
+  typedef typename vigra::MultiArrayShape<N>::type ShapeType;
+  std::cout << N << "D " << shape << std::endl;
+  vigra::MultiArray<N, isbi::LabelType> labels(shape);
+  vigra::MultiArray<N, isbi::DataType> image(shape);
+  const size_t label_count = fill_regions<N>(42, labels, image);
+  ShapeType offset;
+  for (int n = 0; n < N; n++) {
+    offset[n] = 3 + 2 * n;
+  }
+  size_t failures = 0;
+  failures += compare_with_vigra<N>(
+    labels,
+    image,
+    label_count,
+    ShapeType(0),
+    "contiguous");
+  failures += compare_with_vigra<N>(
+    labels,
+    image,
+    label_count,
+    offset,
+    "with offset");
+  failures += compare_with_vigra<N>(
+    labels.transpose(),
+    image.transpose(),
+    label_count,
+    ShapeType(0),
+    "transposed");
+  failures += compare_with_vigra<N>(
+    labels.stridearray(ShapeType(2)),
+    image.stridearray(ShapeType(2)),
+    label_count,
+    ShapeType(0),
+    "every second pixel");
+  return failures;
+}
+
+// true if the tables have the same rows and features, and the values are
+// equal up to tolerance (0 compares bitwise)
+bool is_table_equal(
+  const isbi::ObjectFeatureTable& objects,
+  const isbi::ObjectFeatureTable& reference,
+  const double tolerance)
+{
+  typedef isbi::ObjectFeatureTable::FeatureId FeatureId;
+  if (objects.get_row_count() != reference.get_row_count()
+      || objects.get_feature_count() != reference.get_feature_count()) {
+    return false;
+  }
+  for (size_t row = 0; row < reference.get_row_count(); row++) {
+    if (objects.get_label(row) != reference.get_label(row)) {
+      return false;
+    }
+  }
+  for (FeatureId feature = 0; feature < reference.get_feature_count();
+       feature++) {
+    if (objects.get_feature_name(feature)
+        != reference.get_feature_name(feature)
+        || objects.get_feature_size(feature)
+        != reference.get_feature_size(feature)) {
+      return false;
+    }
+    for (size_t row = 0; row < reference.get_row_count(); row++) {
+      const isbi::FeatureType* values = objects.get(feature, row);
+      const isbi::FeatureType* reference_values = reference.get(feature, row);
+      for (size_t i = 0; i < reference.get_feature_size(feature); i++) {
+        const bool is_equal = tolerance > 0.0
+          ? is_close(values[i], reference_values[i], tolerance)
+          : values[i] == reference_values[i]
+            || (std::isnan(values[i]) && std::isnan(reference_values[i]));
+        if (!is_equal) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// options of the traxel extractor that keep every object
+isbi::TrackingOptions get_options() {
+  const std::string path = "test_region_moments_options.txt";
+  std::ofstream file(path.c_str());
+  file << "tracker,ChaingraphTracking" << std::endl;
+  file << "borderWidth,0" << std::endl;
+  file << "size_range_0,0" << std::endl;
+  file << "size_range_1,0" << std::endl;
+  file << "scales_0,1.0" << std::endl;
+  file << "scales_1,1.0" << std::endl;
+  file << "scales_2,1.0" << std::endl;
+  file.close();
+  isbi::TrackingOptions options(path);
+  std::remove(path.c_str());
+  return options;
+}
+
+// The features of the traxel extractor with one accumulator group per
+// thread compared bitwise with those of a single group, and the core
+// features from the statistics of the labeling with those from the moments.
+template<int N>
+size_t test_extractor(
+  const typename vigra::MultiArrayShape<N>::type& shape,
+  const std::vector<int>& thread_counts)
+{
+  std::cout << N << "D " << shape << " traxel extractor" << std::endl;
+  const isbi::TrackingOptions options = get_options();
+  vigra::MultiArray<N, isbi::LabelType> labels(shape);
+  vigra::MultiArray<N, isbi::DataType> image(shape);
+  isbi::Segmentation<N> segmentation;
+  segmentation.label_count_ = fill_regions<N>(43, labels, image);
+  segmentation.label_image_ = labels;
+  const char* feature_names[] = {
+    "Count",
+    "Sum",
+    "Mean",
+    "Variance",
+    "Skewness",
+    "Kurtosis",
+    "Minimum",
+    "Maximum",
+    "RegionCenter",
+    "Coord<Principal<Kurtosis> >",
+    "Coord<Principal<Skewness> >",
+    "RegionRadii"
+  };
+  const std::vector<std::string> feature_selection(
+    feature_names,
+    feature_names + 12);
+  isbi::TraxelExtractor<N> extractor(
+    feature_selection,
+    isbi::RandomForestVectorType(),
+    options);
+  size_t failures = 0;
+  omp_set_num_threads(1);
+  isbi::ObjectFeatureTable reference;
+  extractor.extract(segmentation, image, 0, reference);
+  for (const int thread_count : thread_counts) {
+    omp_set_num_threads(thread_count);
+    isbi::ObjectFeatureTable objects;
+    extractor.extract(segmentation, image, 0, objects);
+    std::cout << "\t" << thread_count << " threads: "
+      << objects.get_row_count() << " of " << reference.get_row_count()
+      << " objects";
+    if (!is_table_equal(objects, reference, 0.0)) {
+      std::cout << ", features differ from one thread" << std::endl;
+      failures++;
+    } else {
+      std::cout << ", ok" << std::endl;
+    }
+  }
+
+  // the core features only, from the statistics of the labeling
+  std::vector<std::string> core_selection;
+  core_selection.push_back("Count");
+  core_selection.push_back("Mean");
+  core_selection.push_back("Variance");
+  core_selection.push_back("RegionCenter");
+  isbi::TraxelExtractor<N> core_extractor(
+    core_selection,
+    isbi::RandomForestVectorType(),
+    options);
+  isbi::Segmentation<N> labeled;
+  labeled.label_image_.reshape(shape);
+  labeled.label_count_ = isbi::label_above_threshold<N>(
+    image,
+    0.5,
+    labeled.label_image_,
+    image,
+    labeled.region_statistics_);
+  isbi::ObjectFeatureTable statistics_objects;
+  core_extractor.extract(labeled, image, 0, statistics_objects);
+  labeled.region_statistics_.clear();
+  isbi::ObjectFeatureTable moment_objects;
+  core_extractor.extract(labeled, image, 0, moment_objects);
+  std::cout << "\tstatistics of the labeling: "
+    << statistics_objects.get_row_count() << " objects";
+  if (!is_table_equal(statistics_objects, moment_objects, 1e-5)) {
+    std::cout << ", features differ from the moments" << std::endl;
+    failures++;
+  } else {
+    std::cout << ", ok" << std::endl;
+  }
+  return failures;
+}
+
+int main() {
+  const int max_thread_count = omp_get_max_threads();
+  std::vector<int> thread_counts;
+  thread_counts.push_back(2);
+  thread_counts.push_back(3);
+  if (max_thread_count > 3) {
+    thread_counts.push_back(max_thread_count);
+  }
+  size_t failures = 0;
+  failures += test_views<2>(vigra::Shape2(211, 157));
+  failures += test_views<3>(vigra::Shape3(47, 39, 31));
+  failures += test_extractor<2>(vigra::Shape2(211, 157), thread_counts);
+  failures += test_extractor<3>(vigra::Shape3(47, 39, 31), thread_counts);
+  omp_set_num_threads(max_thread_count);
+  if (failures > 0) {
+    std::cout << failures << " tests failed" << std::endl;
+    return 1;
+  }
+  std::cout << "all tests passed" << std::endl;
+  return 0;
+}
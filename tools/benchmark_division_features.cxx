@@ -0,0 +1,490 @@
+// stl
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <set>
+#include <memory>
+#include <algorithm>
+
+// boost
+#include <boost/lexical_cast.hpp>
+
+// pgmlink
+#include <pgmlink/feature_calculator.h>
+
+// vigra
+#include <vigra/multi_array.hxx>
+
+// own
+#include "pipeline_helpers.hxx"
+#include "segmentation.hxx"
+#include "traxel_extractor.hxx"
+#include "division_feature_extractor.hxx"
+#include "flat_forest.hxx"
+
+namespace isbi = isbi_pipeline;
+
+typedef std::chrono::high_resolution_clock ClockType;
+typedef isbi::DivisionFeatureExtractor<3, isbi::LabelType>
+  DivisionFeatureExtractorType;
+
+double seconds_since(const ClockType::time_point& start) {
+  std::chrono::duration<double> elapsed = ClockType::now() - start;
+  return elapsed.count();
+}
+
+// a grid of noisy balls, one label per ball. The balls of odd frames are
+// shifted by a few pixels.
+void fill_test_volume(
+  const int frame,
+  vigra::MultiArray<3, isbi::DataType>& volume,
+  isbi::Segmentation<3>& segmentation)
+{
+  const int spacing = 12;
+  const int radius = 4;
+  const int shift = frame % 2 ? 3 : 0;
+  const vigra::Shape3 shape = volume.shape();
+  segmentation.label_image_.reshape(shape);
+  segmentation.label_count_ = 0;
+  segmentation.region_statistics_.clear();
+  vigra::MultiArray<3, isbi::LabelType> ball_labels(vigra::Shape3(
+    shape[0] / spacing + 2,
+    shape[1] / spacing + 1,
+    shape[2] / spacing + 1));
+  std::srand(42 + frame);
+  for (int z = 0; z < shape[2]; z++) {
+    for (int y = 0; y < shape[1]; y++) {
+      for (int x = 0; x < shape[0]; x++) {
+        const int dx = (x + shift) % spacing - spacing / 2;
+        const int dy = y % spacing - spacing / 2;
+        const int dz = z % spacing - spacing / 2;
+        const bool inside = dx*dx + dy*dy + dz*dz <= radius * radius;
+        isbi::LabelType& ball_label =
+          ball_labels((x + shift) / spacing, y / spacing, z / spacing);
+        if (inside && ball_label == 0) {
+          ball_label = ++segmentation.label_count_;
+        }
+        segmentation.label_image_(x, y, z) = inside ? ball_label : 0;
+        volume(x, y, z) = (inside ? 150.0 : 50.0)
+          + 50.0 * std::rand() / RAND_MAX;
+      }
+    }
+  }
+}
+
+// number of values that are not bitwise identical
+size_t count_differing(
+  const isbi::ObjectFeatureTable& lhs,
+  const isbi::ObjectFeatureTable& rhs)
+{
+  size_t differing = 0;
+  for (size_t feature = 0; feature < lhs.get_feature_count(); feature++) {
+    const size_t size = lhs.get_feature_size(feature);
+    for (size_t row = 0; row < lhs.get_row_count(); row++) {
+      if (std::memcmp(
+          lhs.get(feature, row),
+          rhs.get(feature, row),
+          size * sizeof(isbi::FeatureType))) {
+        differing += size;
+      }
+    }
+  }
+  return differing;
+}
+
+////
+//// per-traxel division stage
+////
+// The division stage before the object tables, kept to time against: the
+// features go through the feature maps of the traxels, the children are
+// found by a linear search over the traxels of the next frame and the
+// forests are evaluated on one traxel at a time.
+pgmlink::feature_array legacy_parent_children_ratio(
+  const pgmlink::feature_array& a,
+  const pgmlink::feature_array& b,
+  const pgmlink::feature_array& c)
+{
+  pgmlink::feature_array ret(a.size(), 0.);
+  for (size_t i = 0; i < a.size(); i++) {
+    ret[i] = b[i] + c[i];
+    if (ret[i] < 0.000001) {
+      ret[i] = 9999.0;
+    } else {
+      ret[i] = a[i] / ret[i];
+    }
+  }
+  return ret;
+}
+
+pgmlink::feature_array legacy_parent_children_angle(
+  const pgmlink::feature_array& a,
+  const pgmlink::feature_array& b,
+  const pgmlink::feature_array& c)
+{
+  pgmlink::feature_array ret(1, 0.);
+  vigra::TinyVector<float, 3> v1, v2;
+  for (size_t i = 0; i < 3; i++) {
+    v1[i] = b[i] - a[i];
+    v2[i] = c[i] - a[i];
+  }
+  float length_product = sqrt(vigra::squaredNorm(v1) * vigra::squaredNorm(v2));
+  if (length_product != 0) {
+    ret[0] = acos(vigra::dot(v1, v2) / length_product) * 180.0 / M_PI;
+  }
+  return ret;
+}
+
+class LegacyDivisionStage {
+ public:
+  typedef std::shared_ptr<pgmlink::feature_extraction::FeatureCalculator>
+    CalculatorPtrType;
+  LegacyDivisionStage(const size_t template_size);
+  void extract(
+    isbi::TraxelVectorType& traxels_current_frame,
+    isbi::TraxelVectorType& traxels_next_frame,
+    vigra::MultiArrayView<3, isbi::LabelType> label_image_next_frame) const;
+  void compute_div_prob(
+    isbi::TraxelVectorType& traxels_current_frame,
+    const std::vector<std::string>& feature_selection,
+    const isbi::RandomForestVectorType& random_forests) const;
+ private:
+  size_t template_size_;
+  CalculatorPtrType squared_distance_calculator_;
+  CalculatorPtrType children_ratio_calculator_;
+  CalculatorPtrType parent_children_ratio_calculator_;
+  CalculatorPtrType parent_children_angle_calculator_;
+};
+
+LegacyDivisionStage::LegacyDivisionStage(const size_t template_size) :
+  template_size_(template_size),
+  squared_distance_calculator_(
+    new pgmlink::feature_extraction::SquareRootSquaredDifferenceCalculator()),
+  children_ratio_calculator_(
+    new pgmlink::feature_extraction::RatioCalculator()),
+  parent_children_ratio_calculator_(
+    new pgmlink::feature_extraction::TripletOperationCalculator(
+      legacy_parent_children_ratio,
+      "ParentChildrenRatio")),
+  parent_children_angle_calculator_(
+    new pgmlink::feature_extraction::TripletOperationCalculator(
+      legacy_parent_children_angle,
+      "ParentChildrenAngle"))
+{
+}
+
+void LegacyDivisionStage::extract(
+  isbi::TraxelVectorType& traxels_current_frame,
+  isbi::TraxelVectorType& traxels_next_frame,
+  vigra::MultiArrayView<3, isbi::LabelType> label_image_next_frame) const
+{
+  typedef DivisionFeatureExtractorType::TraxelWithDistance
+    TraxelWithDistance;
+  #pragma omp parallel for
+  for (size_t i = 0; i < traxels_current_frame.size(); i++) {
+    pgmlink::Traxel& t = traxels_current_frame[i];
+    const pgmlink::feature_array& position = t.features["RegionCenter"];
+    // the labels in the template around the parent
+    vigra::TinyVector<size_t, 3> start, stop;
+    for (int n = 0; n < 3; n++) {
+      start[n] = std::max(0, int(position[n] - template_size_ / 2));
+      stop[n] = std::min(
+        int(label_image_next_frame.shape(n)),
+        int(position[n] + template_size_ / 2));
+    }
+    const std::set<isbi::LabelType> labels_in_roi =
+      DivisionFeatureExtractorType::find_unique_labels_in_roi(
+        label_image_next_frame.subarray(start, stop));
+    // the traxels of these labels, sorted by distance
+    std::vector<TraxelWithDistance> nearest_neighbors;
+    for (isbi::LabelType label : labels_in_roi) {
+      for (size_t n = 0; n < traxels_next_frame.size(); n++) {
+        pgmlink::Traxel& tr = traxels_next_frame[n];
+        if (tr.Id == label) {
+          pgmlink::feature_array distance =
+            squared_distance_calculator_->calculate(
+              position,
+              tr.features["RegionCenter"]);
+          nearest_neighbors.push_back(std::make_pair(n, distance[0]));
+          break;
+        }
+      }
+    }
+    std::sort(
+      nearest_neighbors.begin(),
+      nearest_neighbors.end(),
+      [](const TraxelWithDistance& a, const TraxelWithDistance& b) {
+        return a.second < b.second;
+      });
+    // the features
+    t.features["SquaredDistances_0"] = {9999.f};
+    t.features["SquaredDistances_1"] = {9999.f};
+    t.features["SquaredDistances_2"] = {9999.f};
+    for (size_t n = 0; n < nearest_neighbors.size(); n++) {
+      t.features["SquaredDistances_" + boost::lexical_cast<std::string>(n)] =
+        {nearest_neighbors[n].second};
+    }
+    if (nearest_neighbors.size() > 1) {
+      isbi::FeatureMapType& child_0 =
+        traxels_next_frame[nearest_neighbors[0].first].features;
+      isbi::FeatureMapType& child_1 =
+        traxels_next_frame[nearest_neighbors[1].first].features;
+      t.features["ChildrenRatio_Count"] = children_ratio_calculator_->calculate(
+        child_0["Count"],
+        child_1["Count"]);
+      t.features["ChildrenRatio_Mean"] = children_ratio_calculator_->calculate(
+        child_0["Mean"],
+        child_1["Mean"]);
+      t.features["ParentChildrenRatio_Mean"] =
+        parent_children_ratio_calculator_->calculate(
+          t.features["Mean"],
+          child_0["Mean"],
+          child_1["Mean"]);
+      t.features["ParentChildrenRatio_Count"] =
+        parent_children_ratio_calculator_->calculate(
+          t.features["Count"],
+          child_0["Count"],
+          child_1["Count"]);
+      float angle = parent_children_angle_calculator_->calculate(
+        position,
+        child_0["RegionCenter"],
+        child_1["RegionCenter"])[0];
+      if (nearest_neighbors.size() > 2) {
+        isbi::FeatureMapType& child_2 =
+          traxels_next_frame[nearest_neighbors[2].first].features;
+        angle = std::max(angle, parent_children_angle_calculator_->calculate(
+          position,
+          child_1["RegionCenter"],
+          child_2["RegionCenter"])[0]);
+        angle = std::max(angle, parent_children_angle_calculator_->calculate(
+          position,
+          child_0["RegionCenter"],
+          child_2["RegionCenter"])[0]);
+      }
+      t.features["ParentChildrenAngle_RegionCenter"] = {angle};
+    } else {
+      t.features["ChildrenRatio_Count"] = {0.0f};
+      t.features["ChildrenRatio_Mean"] = {0.0f};
+      t.features["ParentChildrenRatio_Mean"] = {0.0f};
+      t.features["ParentChildrenRatio_Count"] = {0.0f};
+      t.features["ParentChildrenAngle_RegionCenter"] = {0.0f};
+    }
+  }
+}
+
+void LegacyDivisionStage::compute_div_prob(
+  isbi::TraxelVectorType& traxels_current_frame,
+  const std::vector<std::string>& feature_selection,
+  const isbi::RandomForestVectorType& random_forests) const
+{
+  for (pgmlink::Traxel& traxel : traxels_current_frame) {
+    // the size of the feature vector
+    size_t feature_size = 0;
+    for (const std::string& feature_name : feature_selection) {
+      if (traxel.features.count(feature_name) == 0) {
+        throw std::runtime_error("Feature " + feature_name + " not found");
+      }
+      feature_size += traxel.features[feature_name].size();
+    }
+    // one row with all features
+    vigra::MultiArray<2, isbi::FeatureType> features(
+      vigra::Shape2(1, feature_size));
+    size_t offset = 0;
+    for (const std::string& feature_name : feature_selection) {
+      for (isbi::FeatureType value : traxel.features[feature_name]) {
+        features(0, offset++) = value;
+      }
+    }
+    vigra::MultiArray<2, isbi::FeatureType> probabilities(
+      vigra::Shape2(1, 2),
+      0.0);
+    for (size_t n = 0; n < random_forests.size(); n++) {
+      vigra::MultiArray<2, isbi::FeatureType> probabilities_temp(
+        vigra::Shape2(1, 2));
+      random_forests[n].predictProbabilities(features, probabilities_temp);
+      probabilities += probabilities_temp;
+    }
+    traxel.features["divProb"].clear();
+    traxel.features["divProb"].push_back(probabilities(0, 1));
+  }
+}
+
+// number of values of the features that are not bitwise identical in the
+// traxels and the rows of the table
+size_t count_differing(
+  const isbi::TraxelVectorType& traxels,
+  const isbi::ObjectFeatureTable& objects,
+  const std::vector<std::string>& feature_names)
+{
+  size_t differing = 0;
+  for (const std::string& feature_name : feature_names) {
+    const isbi::ObjectFeatureTable::FeatureId feature =
+      objects.get_feature_id(feature_name);
+    const size_t size = objects.get_feature_size(feature);
+    for (size_t row = 0; row < objects.get_row_count(); row++) {
+      isbi::FeatureMapType::const_iterator f_it =
+        traxels[row].features.find(feature_name);
+      if (f_it == traxels[row].features.end()
+          || f_it->second.size() != size
+          || std::memcmp(
+            &f_it->second[0],
+            objects.get(feature, row),
+            size * sizeof(isbi::FeatureType))) {
+        differing += size;
+      }
+    }
+  }
+  return differing;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0];
+    std::cout << " <config file> <volume edge length>"
+      << " [<classifier file> <division feature file>]" << std::endl;
+    std::cout << "compares the division features found by scanning the"
+      << " template with the grid over the objects, then the division"
+      << " probabilities of the vigra and the flat forests, then the whole"
+      << " stage with the per-traxel stage on feature maps" << std::endl;
+    std::cout << "an edge length of 204 gives about 5000 objects per frame"
+      << std::endl;
+    return 1;
+  }
+  isbi::TrackingOptions options(argv[1]);
+  const int size = boost::lexical_cast<int>(argv[2]);
+  // the objects of two frames with the features the division features
+  // are derived from
+  const char* feature_names[] = {
+    "Count",
+    "Mean",
+    "RegionCenter"
+  };
+  std::vector<std::string> feature_selection(feature_names, feature_names + 3);
+  isbi::RandomForestVectorType div_rfs;
+  std::vector<std::string> div_feature_selection;
+  if (argc > 4) {
+    if (!isbi::get_rfs_from_file(
+        div_rfs,
+        argv[3],
+        "DivisionDetection/ClassifierForests/Forest",
+        4)) {
+      std::cout << "could not read the forests from " << argv[3] << std::endl;
+      return 1;
+    }
+    isbi::read_region_features_from_file(argv[4], div_feature_selection);
+  }
+  const isbi::RandomForestVectorType no_forests;
+  isbi::TraxelExtractor<3> traxel_extractor(
+    feature_selection,
+    no_forests,
+    options);
+  vigra::MultiArray<3, isbi::DataType> volume(vigra::Shape3(size, size, size));
+  isbi::Segmentation<3> segmentation;
+  isbi::ObjectFeatureTable objects_next_frame;
+  fill_test_volume(1, volume, segmentation);
+  traxel_extractor.extract(segmentation, volume, 1, objects_next_frame);
+  vigra::MultiArray<3, isbi::LabelType> label_image_next_frame(
+    segmentation.label_image_);
+  isbi::ObjectFeatureTable objects[2];
+  fill_test_volume(0, volume, segmentation);
+  traxel_extractor.extract(segmentation, volume, 0, objects[0]);
+  objects[1] = objects[0];
+  // the same objects as traxels for the per-traxel stage
+  isbi::TraxelVectorType traxels_current_frame, traxels_next_frame;
+  traxel_extractor.get_traxels(objects[0], traxels_current_frame);
+  traxel_extractor.get_traxels(objects_next_frame, traxels_next_frame);
+  // division features by scanning the template and with the grid
+  const size_t template_size = options.get_option<double>("templateSize");
+  DivisionFeatureExtractorType div_feature_extractor(template_size);
+  double times[2];
+  for (size_t use_grid = 0; use_grid < 2; use_grid++) {
+    div_feature_extractor.set_use_grid(use_grid);
+    ClockType::time_point start = ClockType::now();
+    div_feature_extractor.extract(
+      objects[use_grid],
+      objects_next_frame,
+      label_image_next_frame);
+    times[use_grid] = seconds_since(start);
+  }
+  const double grid_time = times[1];
+  const size_t object_count = objects[0].get_row_count();
+  std::cout << "objects,template size,scan [s],grid [s],speedup,"
+    << "scan [us/object],grid [us/object],differing values" << std::endl;
+  std::cout << object_count << "," << template_size << "," << times[0] << ","
+    << times[1] << "," << times[0] / times[1] << ","
+    << 1e6 * times[0] / object_count << ","
+    << 1e6 * times[1] / object_count << ","
+    << count_differing(objects[0], objects[1]) << std::endl;
+  // the per-traxel stage on the feature maps
+  const LegacyDivisionStage legacy_stage(template_size);
+  ClockType::time_point start = ClockType::now();
+  legacy_stage.extract(
+    traxels_current_frame,
+    traxels_next_frame,
+    label_image_next_frame);
+  const double legacy_feature_time = seconds_since(start);
+  const char* division_feature_names[] = {
+    "SquaredDistances_0",
+    "SquaredDistances_1",
+    "SquaredDistances_2",
+    "ChildrenRatio_Count",
+    "ChildrenRatio_Mean",
+    "ParentChildrenRatio_Mean",
+    "ParentChildrenRatio_Count",
+    "ParentChildrenAngle_RegionCenter"
+  };
+  std::vector<std::string> compared_features(
+    division_feature_names,
+    division_feature_names + 8);
+  double legacy_div_prob_time = 0.0;
+  double div_prob_time = 0.0;
+  if (!div_rfs.empty()) {
+    start = ClockType::now();
+    legacy_stage.compute_div_prob(
+      traxels_current_frame,
+      div_feature_selection,
+      div_rfs);
+    legacy_div_prob_time = seconds_since(start);
+    // division probabilities of the whole frame, with the vigra and the
+    // flat forests
+    start = ClockType::now();
+    const isbi::FlatForestVectorType div_flat_rfs =
+      isbi::flatten_forests(div_rfs);
+    const double flatten_time = seconds_since(start);
+    const isbi::FlatForestVectorType no_flat_forests;
+    for (size_t flat = 0; flat < 2; flat++) {
+      start = ClockType::now();
+      div_feature_extractor.compute_div_prob(
+        objects[flat],
+        div_feature_selection,
+        div_rfs,
+        flat ? div_flat_rfs : no_flat_forests);
+      times[flat] = seconds_since(start);
+    }
+    div_prob_time = times[1];
+    compared_features.push_back("divProb");
+    std::cout << "objects,forests,flatten [s],vigra [s],flat [s],speedup,"
+      << "vigra [us/object],flat [us/object],differing values" << std::endl;
+    std::cout << object_count << "," << div_rfs.size() << "," << flatten_time
+      << "," << times[0] << "," << times[1] << "," << times[0] / times[1]
+      << "," << 1e6 * times[0] / object_count << ","
+      << 1e6 * times[1] / object_count << ","
+      << count_differing(objects[0], objects[1]) << std::endl;
+  }
+  // the whole stage with the grid and the flat forests against the
+  // per-traxel stage, the conversion to traxels is not timed
+  const double legacy_time = legacy_feature_time + legacy_div_prob_time;
+  const double table_time = grid_time + div_prob_time;
+  std::cout << "objects,per-traxel features [s],per-traxel divProb [s],"
+    << "table features [s],table divProb [s],speedup,differing values"
+    << std::endl;
+  std::cout << object_count << "," << legacy_feature_time << ","
+    << legacy_div_prob_time << "," << grid_time << "," << div_prob_time << ","
+    << legacy_time / table_time << ","
+    << count_differing(traxels_current_frame, objects[1], compared_features)
+    << std::endl;
+  return 0;
+}
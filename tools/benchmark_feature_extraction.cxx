@@ -0,0 +1,253 @@
+// stl
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+// boost
+#include <boost/lexical_cast.hpp>
+
+// vigra
+#include <vigra/multi_array.hxx>
+#include <vigra/accumulator.hxx>
+
+// own
+#include "pipeline_helpers.hxx"
+#include "segmentation.hxx"
+#include "traxel_extractor.hxx"
+#include "region_moments.hxx"
+
+namespace isbi = isbi_pipeline;
+
+typedef std::chrono::high_resolution_clock ClockType;
+
+double seconds_since(const ClockType::time_point& start) {
+  std::chrono::duration<double> elapsed = ClockType::now() - start;
+  return elapsed.count();
+}
+
+// a grid of noisy balls, one label per ball
+void fill_test_volume(
+  vigra::MultiArray<3, isbi::DataType>& volume,
+  isbi::Segmentation<3>& segmentation)
+{
+  const int spacing = 16;
+  const int radius = 6;
+  const vigra::Shape3 shape = volume.shape();
+  segmentation.label_image_.reshape(shape);
+  segmentation.label_count_ = 0;
+  vigra::MultiArray<3, isbi::LabelType> ball_labels(vigra::Shape3(
+    shape[0] / spacing + 1,
+    shape[1] / spacing + 1,
+    shape[2] / spacing + 1));
+  std::srand(42);
+  for (int z = 0; z < shape[2]; z++) {
+    for (int y = 0; y < shape[1]; y++) {
+      for (int x = 0; x < shape[0]; x++) {
+        const int dx = x % spacing - spacing / 2;
+        const int dy = y % spacing - spacing / 2;
+        const int dz = z % spacing - spacing / 2;
+        const bool inside = dx*dx + dy*dy + dz*dz <= radius * radius;
+        isbi::LabelType& ball_label =
+          ball_labels(x / spacing, y / spacing, z / spacing);
+        if (inside && ball_label == 0) {
+          ball_label = ++segmentation.label_count_;
+        }
+        segmentation.label_image_(x, y, z) = inside ? ball_label : 0;
+        volume(x, y, z) = (inside ? 150.0 : 50.0)
+          + 50.0 * std::rand() / RAND_MAX;
+      }
+    }
+  }
+}
+
+// number of values that are not bitwise identical
+size_t count_differing(
+  const isbi::ObjectFeatureTable& lhs,
+  const isbi::ObjectFeatureTable& rhs)
+{
+  size_t differing = 0;
+  for (size_t feature = 0; feature < lhs.get_feature_count(); feature++) {
+    const size_t size = lhs.get_feature_size(feature);
+    for (size_t row = 0; row < lhs.get_row_count(); row++) {
+      if (std::memcmp(
+          lhs.get(feature, row),
+          rhs.get(feature, row),
+          size * sizeof(isbi::FeatureType))) {
+        differing += size;
+      }
+    }
+  }
+  return differing;
+}
+
+// relative deviation in percent
+double get_deviation(const double value, const double reference) {
+  return 100.0 * std::abs(value - reference)
+    / std::max(std::abs(reference), 1e-12);
+}
+
+// compare get_region_moments with the vigra accumulators on all objects
+void compare_moments(
+  const isbi::Segmentation<3>& segmentation,
+  const vigra::MultiArray<3, isbi::DataType>& volume)
+{
+  namespace acc = vigra::acc;
+  typedef acc::AccumulatorChainArray<
+    vigra::CoupledArrays<3, isbi::LabelType, isbi::DataType>,
+    acc::Select<
+      acc::LabelArg<1>,
+      acc::DataArg<2>,
+      acc::Count,
+      acc::Sum,
+      acc::Mean,
+      acc::Variance,
+      acc::Skewness,
+      acc::Kurtosis,
+      acc::Minimum,
+      acc::Maximum,
+      acc::RegionCenter,
+      acc::Coord<acc::Minimum>,
+      acc::Coord<acc::Maximum> >
+  > MomentsChainType;
+  MomentsChainType acc_chain;
+  acc_chain.ignoreLabel(0);
+  acc_chain.setMaxRegionLabel(segmentation.label_count_);
+  ClockType::time_point start = ClockType::now();
+  vigra::CoupledIteratorType<3, isbi::LabelType, isbi::DataType>::type start_it =
+    vigra::createCoupledIterator(segmentation.label_image_, volume);
+  acc::extractFeatures(start_it, start_it.getEndIterator(), acc_chain);
+  const double vigra_time = seconds_since(start);
+  std::vector<isbi::RegionMoments<3> > moments(segmentation.label_count_ + 1);
+  start = ClockType::now();
+  isbi::get_region_moments<3>(
+    segmentation.label_image_,
+    volume,
+    vigra::Shape3(0),
+    moments);
+  const double kernel_time = seconds_since(start);
+  // the largest deviation of the scalar moments and the center
+  double deviation = 0.0;
+  for (size_t label = 1; label <= segmentation.label_count_; label++) {
+    const isbi::RegionMoments<3>& m = moments[label];
+    const double values[] = {
+      m.get_count(), m.get_sum(), m.get_mean(), m.get_variance(),
+      m.get_skewness(), m.get_kurtosis(), m.get_minimum(), m.get_maximum()};
+    const double references[] = {
+      acc::get<acc::Count>(acc_chain, label),
+      acc::get<acc::Sum>(acc_chain, label),
+      acc::get<acc::Mean>(acc_chain, label),
+      acc::get<acc::Variance>(acc_chain, label),
+      acc::get<acc::Skewness>(acc_chain, label),
+      acc::get<acc::Kurtosis>(acc_chain, label),
+      acc::get<acc::Minimum>(acc_chain, label),
+      acc::get<acc::Maximum>(acc_chain, label)};
+    for (size_t i = 0; i < 8; i++) {
+      deviation = std::max(deviation, get_deviation(values[i], references[i]));
+    }
+    for (size_t n = 0; n < 3; n++) {
+      deviation = std::max(deviation, get_deviation(
+        m.get_center()[n],
+        acc::get<acc::RegionCenter>(acc_chain, label)[n]));
+      deviation = std::max(deviation, get_deviation(
+        m.get_coordinate_min()[n],
+        acc::get<acc::Coord<acc::Minimum> >(acc_chain, label)[n]));
+      deviation = std::max(deviation, get_deviation(
+        m.get_coordinate_max()[n],
+        acc::get<acc::Coord<acc::Maximum> >(acc_chain, label)[n]));
+    }
+  }
+  std::cout << "moments,vigra [s],kernel [s],speedup,"
+    << "vigra [ns/pixel],kernel [ns/pixel],max deviation [%]" << std::endl;
+  std::cout << segmentation.label_count_ << "," << vigra_time << ","
+    << kernel_time << "," << vigra_time / kernel_time << ","
+    << 1e9 * vigra_time / volume.size() << ","
+    << 1e9 * kernel_time / volume.size() << "," << deviation << std::endl;
+}
+
+// seconds for the extraction of all objects
+double extract(
+  const isbi::TraxelExtractor<3>& traxel_extractor,
+  const isbi::Segmentation<3>& segmentation,
+  const vigra::MultiArray<3, isbi::DataType>& volume,
+  isbi::ObjectFeatureTable& objects)
+{
+  ClockType::time_point start = ClockType::now();
+  traxel_extractor.extract(segmentation, volume, 0, objects);
+  return seconds_since(start);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0];
+    std::cout << " <config file> <volume edge length> [<region features>]"
+      << std::endl;
+    std::cout << "compares the moments kernel with the vigra accumulators,"
+      << " then the dynamic accumulator chain with the static chain for no"
+      << " features, all features and the given region feature file"
+      << std::endl;
+    return 1;
+  }
+  isbi::TrackingOptions options(argv[1]);
+  const int size = boost::lexical_cast<int>(argv[2]);
+  vigra::MultiArray<3, isbi::DataType> volume(vigra::Shape3(size, size, size));
+  isbi::Segmentation<3> segmentation;
+  fill_test_volume(volume, segmentation);
+  compare_moments(segmentation, volume);
+  // the selections to compare
+  std::vector<std::vector<std::string> > selections(2);
+  const char* feature_names[] = {
+    "Coord<Principal<Kurtosis> >",
+    "Coord<Principal<Skewness> >",
+    "Count",
+    "Kurtosis",
+    "Maximum",
+    "Mean",
+    "Minimum",
+    "RegionCenter",
+    "RegionRadii",
+    "Skewness",
+    "Sum",
+    "Variance"
+  };
+  selections[1].assign(feature_names, feature_names + 12);
+  if (argc > 3) {
+    selections.push_back(std::vector<std::string>());
+    isbi::read_region_features_from_file(argv[3], selections.back());
+  }
+  const isbi::RandomForestVectorType no_forests;
+  std::cout << "features,objects,dynamic [s],static [s],speedup,"
+    << "dynamic [ns/pixel],static [ns/pixel],dynamic [us/object],"
+    << "static [us/object],differing values" << std::endl;
+  for (const std::vector<std::string>& selection : selections) {
+    isbi::TraxelExtractor<3> traxel_extractor(selection, no_forests, options);
+    isbi::ObjectFeatureTable dynamic_objects;
+    isbi::ObjectFeatureTable static_objects;
+    traxel_extractor.set_use_presets(false);
+    const double dynamic_time = extract(
+      traxel_extractor,
+      segmentation,
+      volume,
+      dynamic_objects);
+    traxel_extractor.set_use_presets(true);
+    const double static_time = extract(
+      traxel_extractor,
+      segmentation,
+      volume,
+      static_objects);
+    const size_t object_count = static_objects.get_row_count();
+    std::cout << selection.size() << "," << object_count << ","
+      << dynamic_time << "," << static_time << ","
+      << dynamic_time / static_time << ","
+      << 1e9 * dynamic_time / volume.size() << ","
+      << 1e9 * static_time / volume.size() << ","
+      << 1e6 * dynamic_time / object_count << ","
+      << 1e6 * static_time / object_count << ","
+      << count_differing(dynamic_objects, static_objects) << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+// stl
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+
+// vigra
+#include <vigra/multi_array.hxx>
+#include <vigra/hdf5impex.hxx>
+
+// own
+#include "pipeline_helpers.hxx"
+#include "segmentation.hxx" /* for read_hdf5_array */
+#include "flat_forest.hxx"
+
+namespace isbi = isbi_pipeline;
+
+typedef std::chrono::high_resolution_clock ClockType;
+
+double seconds_since(const ClockType::time_point& start) {
+  std::chrono::duration<double> elapsed = ClockType::now() - start;
+  return elapsed.count();
+}
+
+// read the features of a segmentation dump as a pixels x channels matrix
+template<int N>
+void read_feature_matrix(
+  const std::string& filename,
+  vigra::MultiArray<2, isbi::DataType>& feature_matrix)
+{
+  vigra::MultiArray<N+1, isbi::DataType> features;
+  isbi::read_hdf5_array<N+1, isbi::DataType>(
+    filename,
+    "/segmentation/features",
+    features);
+  size_t pixel_count = 1;
+  for (size_t dim = 0; dim < N; dim++) {
+    pixel_count *= features.shape(dim);
+  }
+  vigra::MultiArrayView<2, isbi::DataType> feature_view(
+    vigra::Shape2(pixel_count, features.shape(N)),
+    features.data());
+  feature_matrix = feature_view;
+}
+
+// number of values that are not bitwise identical
+size_t count_differing(
+  const vigra::MultiArray<2, isbi::DataType>& lhs,
+  const vigra::MultiArray<2, isbi::DataType>& rhs)
+{
+  size_t differing = 0;
+  for (size_t i = 0; i < lhs.size(); i++) {
+    if (std::memcmp(&lhs[i], &rhs[i], sizeof(isbi::DataType))) {
+      differing++;
+    }
+  }
+  return differing;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0];
+    std::cout << " <classifier file> <segmentation dump>" << std::endl;
+    std::cout << "segmentation dumps are written by the pipeline with"
+      << " segmentation dumping enabled" << std::endl;
+    return 1;
+  }
+  // load the forests
+  isbi::RandomForestVectorType rfs;
+  if (!isbi::get_rfs_from_file(
+      rfs,
+      argv[1],
+      "PixelClassification/ClassifierForests/Forest",
+      4)) {
+    std::cout << "could not read the forests from " << argv[1] << std::endl;
+    return 1;
+  }
+  ClockType::time_point start = ClockType::now();
+  isbi::FlatForestVectorType flat_rfs = isbi::flatten_forests(rfs);
+  if (flat_rfs.empty()) {
+    std::cout << "forests contain unsupported nodes" << std::endl;
+    return 1;
+  }
+  std::cout << "flattened " << rfs.size() << " forests in "
+    << seconds_since(start) << " s" << std::endl;
+  // load the features
+  vigra::HDF5ImportInfo import_info(argv[2], "/segmentation/features");
+  vigra::MultiArray<2, isbi::DataType> features;
+  if (import_info.numDimensions() == 3) {
+    read_feature_matrix<2>(argv[2], features);
+  } else {
+    read_feature_matrix<3>(argv[2], features);
+  }
+  std::cout << features.shape(0) << " pixels with " << features.shape(1)
+    << " features" << std::endl;
+  // compare
+  std::cout << "forest,nodes,vigra [s],flat [s],speedup,differing values,"
+    << "rank bytes,quantized [s],speedup,differing values" << std::endl;
+  for (size_t n = 0; n < rfs.size(); n++) {
+    const size_t class_count = flat_rfs[n].get_class_count();
+    vigra::MultiArray<2, isbi::DataType> vigra_probabilities(
+      vigra::Shape2(features.shape(0), class_count));
+    vigra::MultiArray<2, isbi::DataType> flat_probabilities(
+      vigra::Shape2(features.shape(0), class_count));
+    start = ClockType::now();
+    rfs[n].predictProbabilities(features, vigra_probabilities);
+    const double vigra_time = seconds_since(start);
+    start = ClockType::now();
+    flat_rfs[n].predict_probabilities(features, flat_probabilities);
+    const double flat_time = seconds_since(start);
+    // the results must be bitwise identical
+    const size_t differing =
+      count_differing(vigra_probabilities, flat_probabilities);
+    isbi::FlatForest quantized_rf(flat_rfs[n]);
+    quantized_rf.quantize();
+    start = ClockType::now();
+    quantized_rf.predict_probabilities(features, flat_probabilities);
+    const double quantized_time = seconds_since(start);
+    std::cout << n << "," << flat_rfs[n].get_node_count() << ","
+      << vigra_time << "," << flat_time << "," << vigra_time / flat_time
+      << "," << differing << "," << quantized_rf.get_rank_size() << ","
+      << quantized_time << "," << vigra_time / quantized_time << ","
+      << count_differing(vigra_probabilities, flat_probabilities) << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+// stl
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+
+// boost
+#include <boost/lexical_cast.hpp>
+
+// vigra
+#include <vigra/multi_array.hxx>
+
+// own
+#include "segmentation.hxx"
+
+namespace isbi = isbi_pipeline;
+
+typedef vigra::MultiArray<3, isbi::DataType> DataVolumeType;
+typedef vigra::MultiArray<4, isbi::DataType> FeatureVolumeType;
+
+// noise on top of a few blobs and a step, values in [0, 255]
+void fill_test_volume(DataVolumeType& volume) {
+  std::srand(42);
+  for (int z = 0; z < volume.shape(2); z++) {
+    for (int y = 0; y < volume.shape(1); y++) {
+      for (int x = 0; x < volume.shape(0); x++) {
+        double value = (x < volume.shape(0) / 2) ? 50.0 : 100.0;
+        for (int blob = 1; blob <= 3; blob++) {
+          const double dx = x - blob * volume.shape(0) / 4.0;
+          const double dy = y - blob * volume.shape(1) / 4.0;
+          const double dz = z - volume.shape(2) / 2.0;
+          value += 100.0 * std::exp(-(dx*dx + dy*dy + dz*dz) / 50.0);
+        }
+        value += 50.0 * std::rand() / RAND_MAX;
+        volume(x, y, z) = std::min(255.0, value);
+      }
+    }
+  }
+}
+
+double calculate_features(
+  const DataVolumeType& volume,
+  const isbi::StringDataPairVectorType& feature_scales,
+  const vigra::TinyVector<isbi::DataType, 3>& step_sizes,
+  isbi::FilterBackend backend,
+  FeatureVolumeType& features)
+{
+  isbi::FeatureCalculator<3> calculator(feature_scales, step_sizes);
+  calculator.set_filter_backends(
+    std::vector<isbi::FilterBackend>(feature_scales.size(), backend));
+  std::chrono::time_point<std::chrono::high_resolution_clock> start =
+    std::chrono::high_resolution_clock::now();
+  calculator.calculate(volume, features);
+  std::chrono::duration<double> elapsed =
+    std::chrono::high_resolution_clock::now() - start;
+  return elapsed.count();
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0];
+    std::cout << " <volume edge length> <scale> [<scale> ...]" << std::endl;
+    return 1;
+  }
+  const int size = boost::lexical_cast<int>(argv[1]);
+  DataVolumeType volume(vigra::Shape3(size, size, size));
+  fill_test_volume(volume);
+  const char* feature_names[] = {
+    "GaussianSmoothing",
+    "LaplacianOfGaussian",
+    "GaussianGradientMagnitude",
+    "DifferenceOfGaussians",
+    "StructureTensorEigenvalues",
+    "HessianOfGaussianEigenvalues"
+  };
+  // isotropic and anisotropic (coarse z axis) sampling
+  const vigra::TinyVector<isbi::DataType, 3> step_sizes[] = {
+    vigra::TinyVector<isbi::DataType, 3>(1.0, 1.0, 1.0),
+    vigra::TinyVector<isbi::DataType, 3>(1.0, 1.0, 3.5)
+  };
+  std::cout << "feature,scale,step size z,fir [s],recursive [s],"
+    << "max deviation [%]" << std::endl;
+  for (int arg_index = 2; arg_index < argc; arg_index++) {
+    const isbi::DataType scale =
+      boost::lexical_cast<isbi::DataType>(argv[arg_index]);
+    for (size_t j = 0; j < 2; j++) {
+      for (size_t i = 0; i < 6; i++) {
+        isbi::StringDataPairVectorType feature_scales;
+        feature_scales.push_back(std::make_pair(feature_names[i], scale));
+        FeatureVolumeType fir_features;
+        FeatureVolumeType recursive_features;
+        const double fir_time = calculate_features(
+          volume,
+          feature_scales,
+          step_sizes[j],
+          isbi::FIRFilter,
+          fir_features);
+        const double recursive_time = calculate_features(
+          volume,
+          feature_scales,
+          step_sizes[j],
+          isbi::RecursiveFilter,
+          recursive_features);
+        // deviation in units of the dynamic range of the input
+        double deviation = 0.0;
+        for (size_t k = 0; k < fir_features.size(); k++) {
+          deviation = std::max(
+            deviation,
+            std::abs(
+              double(fir_features[k]) - double(recursive_features[k])));
+        }
+        std::cout << feature_names[i] << "," << scale << ","
+          << step_sizes[j][2] << "," << fir_time << ","
+          << recursive_time << "," << 100.0 * deviation / 255.0 << std::endl;
+      }
+    }
+  }
+  return 0;
+}
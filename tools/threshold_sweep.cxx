@@ -0,0 +1,157 @@
+// stl
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+
+// boost
+#include <boost/lexical_cast.hpp>
+
+// vigra
+#include <vigra/multi_array.hxx>
+#include <vigra/hdf5impex.hxx>
+
+// own
+#include "pipeline_helpers.hxx"
+#include "segmentation.hxx"
+#include "traxel_extractor.hxx"
+
+namespace isbi = isbi_pipeline;
+
+// parse a comma separated list like "0.3,0.4,0.5"
+std::vector<isbi::DataType> parse_list(const std::string& list) {
+  std::vector<isbi::DataType> values;
+  std::stringstream stream(list);
+  std::string value;
+  while (std::getline(stream, value, ',')) {
+    values.push_back(boost::lexical_cast<isbi::DataType>(value));
+  }
+  return values;
+}
+
+// Segment all frames for every pair of smoothing scale and threshold and
+// print the number of objects within the size range per frame.
+template<int N>
+int sweep(
+  const isbi::TrackingOptions& options,
+  const std::vector<isbi::DataType>& thresholds,
+  const std::vector<isbi::DataType>& scales,
+  const std::vector<std::string>& filenames)
+{
+  // the object counts do not need intensity features or classifiers
+  const std::vector<std::string> no_features;
+  const isbi::RandomForestVectorType no_forests;
+  const size_t frame_count = filenames.size();
+  const size_t setting_count = scales.size() * thresholds.size();
+  std::vector<size_t> object_counts(frame_count * setting_count, 0);
+  // one task per frame and smoothing scale, the smoothed foreground is
+  // shared by all thresholds. Exceptions must not leave the parallel
+  // region.
+  bool is_valid = true;
+  std::string error_message;
+  #pragma omp parallel for schedule(dynamic) reduction(&&:is_valid)
+  for (size_t task = 0; task < frame_count * scales.size(); task++) {
+    const size_t frame = task / scales.size();
+    const size_t scale_index = task % scales.size();
+    try {
+      vigra::MultiArray<N, isbi::DataType> foreground;
+      size_t forest_count;
+      typename vigra::MultiArrayShape<N>::type offset;
+      // nor the critical section
+      bool is_read = true;
+      std::string read_error;
+      #pragma omp critical(hdf5)
+      {
+        try {
+          isbi::read_prediction_cache<N>(
+            filenames[frame],
+            foreground,
+            forest_count,
+            offset);
+        } catch (const std::exception& error) {
+          is_read = false;
+          read_error = error.what();
+        }
+      }
+      if (!is_read) {
+        throw std::runtime_error(read_error);
+      }
+      if (scales[scale_index] > 0.0) {
+        isbi::smooth_foreground<N>(foreground, scales[scale_index]);
+      }
+      // caches of cropped frames need the offset for the field of view
+      isbi::TraxelExtractor<N> traxel_extractor(
+        no_features,
+        no_forests,
+        options);
+      traxel_extractor.set_coordinate_offset(offset);
+      isbi::Segmentation<N> segmentation;
+      isbi::ObjectFeatureTable objects;
+      for (size_t t = 0; t < thresholds.size(); t++) {
+        segmentation.label_count_ = isbi::label_foreground<N>(
+          foreground,
+          thresholds[t] * forest_count,
+          segmentation.label_image_);
+        traxel_extractor.extract(segmentation, foreground, frame, objects);
+        object_counts[frame * setting_count + scale_index * thresholds.size() + t]
+          = objects.get_row_count();
+      }
+    } catch (const std::exception& error) {
+      is_valid = false;
+      #pragma omp critical(error_message)
+      {
+        if (error_message.empty()) {
+          error_message = filenames[frame] + ": " + error.what();
+        }
+      }
+    }
+  }
+  if (!is_valid) {
+    throw std::runtime_error("threshold sweep failed, " + error_message);
+  }
+  // one line per setting
+  std::cout << "smoothing,threshold,objects";
+  for (size_t frame = 0; frame < frame_count; frame++) {
+    std::cout << "," << frame;
+  }
+  std::cout << std::endl;
+  for (size_t setting = 0; setting < setting_count; setting++) {
+    size_t total = 0;
+    for (size_t frame = 0; frame < frame_count; frame++) {
+      total += object_counts[frame * setting_count + setting];
+    }
+    std::cout << scales[setting / thresholds.size()] << ","
+      << thresholds[setting % thresholds.size()] << "," << total;
+    for (size_t frame = 0; frame < frame_count; frame++) {
+      std::cout << "," << object_counts[frame * setting_count + setting];
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 5) {
+    std::cout << "usage: " << argv[0];
+    std::cout << " <config file> <thresholds> <smoothing scales>"
+      << " <prediction cache>..." << std::endl;
+    std::cout << "thresholds and scales are comma separated lists, a scale"
+      << " of 0 disables the smoothing" << std::endl;
+    std::cout << "the pipeline writes the prediction caches next to the"
+      << " segmentation with the option PredictionCache" << std::endl;
+    return 1;
+  }
+  isbi::TrackingOptions options(argv[1]);
+  const std::vector<isbi::DataType> thresholds = parse_list(argv[2]);
+  const std::vector<isbi::DataType> scales = parse_list(argv[3]);
+  const std::vector<std::string> filenames(argv + 4, argv + argc);
+  vigra::HDF5ImportInfo import_info(
+    filenames[0].c_str(),
+    "/prediction/foreground");
+  if (import_info.numDimensions() == 2) {
+    return sweep<2>(options, thresholds, scales, filenames);
+  } else {
+    return sweep<3>(options, thresholds, scales, filenames);
+  }
+}